@@ -0,0 +1,182 @@
+// Measures the tensor arenas the classifier and the audio preprocessor need,
+// by allocating their tensors with the ops they are registered with on the
+// board, and prints them plus a margin as the template variables the
+// main/*.jinja templates are rendered with:
+//
+//   tensor_arena_size           the classifier's whole arena
+//   tensor_arena_internal_size  the internal RAM part of a hybrid one, the
+//                               smallest that the activations fit in
+//   preprocessor_arena_size     the audio preprocessor's arena
+//
+// The memory planner lays the tensors out the same way here as on the board,
+// but the host's pointers are twice as wide and the reference kernels don't
+// ask for the same scratch buffers as the ESP-NN ones, which the margin is
+// for. The board logs the arena usage at startup, to check against.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "main_functions.h"
+#include "micro_features_generator.h"
+#include "model.h"
+#include "tensorflow/lite/micro/micro_allocator.h"
+#include "tensorflow/lite/micro/micro_interpreter.h"
+#include "tensorflow/lite/schema/schema_generated.h"
+
+namespace {
+
+// Larger than any model that fits on the board
+constexpr size_t kMaxArenaSize = 16 * 1024 * 1024;
+// TFLM aligns its buffers to 16 bytes
+constexpr size_t kArenaAlignment = 16;
+
+size_t AlignUp(size_t size) {
+  return (size + kArenaAlignment - 1) / kArenaAlignment * kArenaAlignment;
+}
+
+size_t WithMargin(size_t size, int margin_percent) {
+  return AlignUp(size + size * margin_percent / 100);
+}
+
+// The bytes of a single arena the model's tensors take, 0 if they don't fit
+// in kMaxArenaSize.
+size_t MeasureArena(const tflite::Model* model, const tflite::MicroOpResolver& op_resolver,
+                    std::vector<uint8_t>* arena) {
+  tflite::MicroInterpreter interpreter(model, op_resolver, arena->data(), arena->size());
+  if (interpreter.AllocateTensors() != kTfLiteOk) {
+    return 0;
+  }
+  return interpreter.arena_used_bytes();
+}
+
+// Whether the non-persistent part of the model's tensors fits in
+// non_persistent_size bytes of a second arena, as in a hybrid TensorArena.
+bool FitsNonPersistent(const tflite::Model* model, const tflite::MicroOpResolver& op_resolver,
+                       std::vector<uint8_t>* persistent, std::vector<uint8_t>* non_persistent,
+                       size_t non_persistent_size) {
+  tflite::MicroAllocator* allocator = tflite::MicroAllocator::Create(
+      persistent->data(), persistent->size(), non_persistent->data(), non_persistent_size);
+  if (allocator == nullptr) {
+    return false;
+  }
+  tflite::MicroInterpreter interpreter(model, op_resolver, allocator);
+  return interpreter.AllocateTensors() == kTfLiteOk;
+}
+
+// The smallest non-persistent arena that the model's tensors fit in, by
+// bisection below used_bytes, which always fits. TFLM logs each allocation
+// that fails on the way.
+size_t MeasureNonPersistentArena(const tflite::Model* model,
+                                 const tflite::MicroOpResolver& op_resolver,
+                                 std::vector<uint8_t>* persistent, size_t used_bytes) {
+  std::vector<uint8_t> non_persistent(AlignUp(used_bytes));
+  size_t low = 0;  // doesn't fit
+  size_t high = non_persistent.size();
+  if (!FitsNonPersistent(model, op_resolver, persistent, &non_persistent, high)) {
+    return 0;
+  }
+  while (high - low > kArenaAlignment) {
+    const size_t size = AlignUp((low + high) / 2);
+    if (FitsNonPersistent(model, op_resolver, persistent, &non_persistent, size)) {
+      high = size;
+    } else {
+      low = size;
+    }
+  }
+  return high;
+}
+
+bool CheckSchema(const char* name, const tflite::Model* model) {
+  if (model->version() != TFLITE_SCHEMA_VERSION) {
+    fprintf(stderr, "The %s model is schema version %lu, not %d\n", name,
+            (unsigned long) model->version(), TFLITE_SCHEMA_VERSION);
+    return false;
+  }
+  return true;
+}
+
+void PrintUsage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [--margin PERCENT] [--json FILE]\n"
+          "  --margin PERCENT  added to the measured sizes (default 10)\n"
+          "  --json FILE       also write the template variables to FILE as JSON\n",
+          program);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int margin_percent = 10;
+  const char* json_path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--margin") == 0 && i + 1 < argc) {
+      margin_percent = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      json_path = argv[++i];
+    } else {
+      PrintUsage(argv[0]);
+      return 1;
+    }
+  }
+  if (margin_percent < 0) {
+    PrintUsage(argv[0]);
+    return 1;
+  }
+
+  const tflite::Model* classifier = tflite::GetModel(g_model);
+  const tflite::Model* preprocessor = GetAudioPreprocessorModel();
+  const tflite::MicroOpResolver* classifier_ops = classifier_op_resolver();
+  const tflite::MicroOpResolver* preprocessor_ops = GetAudioPreprocessorOpResolver();
+  if (!CheckSchema("classifier", classifier) || !CheckSchema("preprocessor", preprocessor)) {
+    return 1;
+  }
+  if (classifier_ops == nullptr || preprocessor_ops == nullptr) {
+    fprintf(stderr, "Can't register the models' ops\n");
+    return 1;
+  }
+
+  std::vector<uint8_t> arena(kMaxArenaSize);
+  const size_t classifier_used = MeasureArena(classifier, *classifier_ops, &arena);
+  if (classifier_used == 0) {
+    fprintf(stderr, "The classifier's tensors don't fit in %u bytes\n",
+            (unsigned) kMaxArenaSize);
+    return 1;
+  }
+  const size_t preprocessor_used = MeasureArena(preprocessor, *preprocessor_ops, &arena);
+  if (preprocessor_used == 0) {
+    fprintf(stderr, "The preprocessor's tensors don't fit in %u bytes\n",
+            (unsigned) kMaxArenaSize);
+    return 1;
+  }
+  const size_t classifier_non_persistent =
+      MeasureNonPersistentArena(classifier, *classifier_ops, &arena, classifier_used);
+  if (classifier_non_persistent == 0) {
+    fprintf(stderr, "The classifier's tensors don't fit in a hybrid arena\n");
+    return 1;
+  }
+
+  const size_t tensor_arena_size = WithMargin(classifier_used, margin_percent);
+  const size_t tensor_arena_internal_size = WithMargin(classifier_non_persistent, margin_percent);
+  const size_t preprocessor_arena_size = WithMargin(preprocessor_used, margin_percent);
+  printf("classifier: %u bytes, %u of them non-persistent\n", (unsigned) classifier_used,
+         (unsigned) classifier_non_persistent);
+  printf("preprocessor: %u bytes\n", (unsigned) preprocessor_used);
+  printf("with a %d%% margin:\n", margin_percent);
+  printf("tensor_arena_size = %u\n", (unsigned) tensor_arena_size);
+  printf("tensor_arena_internal_size = %u\n", (unsigned) tensor_arena_internal_size);
+  printf("preprocessor_arena_size = %u\n", (unsigned) preprocessor_arena_size);
+
+  if (json_path != nullptr) {
+    FILE* file = fopen(json_path, "w");
+    if (file == nullptr) {
+      fprintf(stderr, "Can't open %s\n", json_path);
+      return 1;
+    }
+    fprintf(file, "{\"tensor_arena_size\": %u, \"tensor_arena_internal_size\": %u, "
+            "\"preprocessor_arena_size\": %u}\n", (unsigned) tensor_arena_size,
+            (unsigned) tensor_arena_internal_size, (unsigned) preprocessor_arena_size);
+    fclose(file);
+  }
+  return 0;
+}
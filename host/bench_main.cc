@@ -0,0 +1,46 @@
+// Micro-benchmarks of the pipeline's hot paths on the host, with the same
+// JSON-lines output as the CONFIG_PIPELINE_BENCHMARK firmware.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "esp_log.h"
+#include "pipeline_benchmarks.h"
+#include "sd_card_host.h"
+
+namespace {
+void PrintUsage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [--iterations N] [--out FILE] [--sd DIR]\n"
+          "  --iterations N  timed runs per benchmark (default 1000)\n"
+          "  --out FILE      also append the results to FILE\n"
+          "  --sd DIR        directory standing in for the SD card (default ./sdcard)\n",
+          program);
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  int iterations = 1000;
+  const char* results_path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      results_path = argv[++i];
+    } else if (strcmp(argv[i], "--sd") == 0 && i + 1 < argc) {
+      sdcard::setMountPoint(argv[++i]);
+    } else {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  if (iterations <= 0) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  esp_log_level_set("*", ESP_LOG_WARN);
+
+  return RunPipelineBenchmarks(iterations, results_path) == kTfLiteOk
+             ? EXIT_SUCCESS
+             : EXIT_FAILURE;
+}
@@ -0,0 +1,105 @@
+// Host (Linux) entry point: runs setup()/loop() exactly like the tensorflow
+// task on the board does, with the microphone replaced by a WAV file or a
+// synthetic signal and the SD card by a local directory.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include "audio_provider.h"
+#include "audio_source.h"
+#include "main_functions.h"
+#include "sd_card.h"
+#include "sd_card_host.h"
+#include "synthetic_audio_source.h"
+#include "wav_audio_source.h"
+
+namespace {
+void PrintUsage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [--wav FILE | --tone HZ] [options]\n"
+          "  --wav FILE      stream a 16-bit PCM WAV file in real time\n"
+          "  --tone HZ       synthetic sine tone over white noise (default 1000)\n"
+          "  --noise AMP     synthetic noise amplitude, 0..1 (default 0.05)\n"
+          "  --seconds N     synthetic signal duration (default 10)\n"
+          "  --sd DIR        directory standing in for the SD card (default ./sdcard)\n"
+          "  --clips         record WAV clips of the detections to DIR/clips\n",
+          program);
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  const char* wav_path = nullptr;
+  float tone_hz = 1000.0f;
+  float noise_amplitude = 0.05f;
+  int seconds = 10;
+  for (int i = 1; i < argc; ++i) {
+    const bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--wav") == 0 && has_value) {
+      wav_path = argv[++i];
+    } else if (strcmp(argv[i], "--tone") == 0 && has_value) {
+      tone_hz = strtof(argv[++i], nullptr);
+    } else if (strcmp(argv[i], "--noise") == 0 && has_value) {
+      noise_amplitude = strtof(argv[++i], nullptr);
+    } else if (strcmp(argv[i], "--seconds") == 0 && has_value) {
+      seconds = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--sd") == 0 && has_value) {
+      sdcard::setMountPoint(argv[++i]);
+    } else if (strcmp(argv[i], "--clips") == 0) {
+      enable_clip_recording();
+    } else {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::unique_ptr<AudioSource> source;
+  if (wav_path != nullptr) {
+    source = std::make_unique<WavAudioSource>(wav_path, true);
+  } else {
+    source = std::make_unique<SyntheticAudioSource>(
+        tone_hz, 0.5f, noise_amplitude, seconds * 1000, true);
+  }
+  SetAudioSource(source.get());
+
+  setup();
+  if (classifier_interpreter() == nullptr) {
+    fprintf(stderr, "Couldn't set up the classifier\n");
+    return EXIT_FAILURE;
+  }
+  while (!AudioSourceExhausted()) {
+    loop();
+  }
+  const AudioRing::Stats ring = AudioCaptureStats();
+  printf("capture ring: %u overruns (%u samples dropped), %u underruns, "
+         "high water %u samples\n",
+         ring.overruns, ring.dropped_samples, ring.underruns, ring.high_water);
+  const FrameHandoff::Stats frames = feature_frame_stats();
+  printf("feature frames: %u published, %u classified, %u skipped\n",
+         frames.published, frames.consumed, frames.skipped);
+  const InferenceScheduler::Stats schedule = inference_schedule_stats();
+  printf("inference: %u runs, %u frames not due, %u hops missed, %u over "
+         "budget; latency mean %.1f ms, worst %.1f ms\n",
+         schedule.inferences, schedule.not_due, schedule.missed_hops,
+         schedule.overruns,
+         schedule.latency_count > 0
+             ? schedule.latency_sum_us / 1e3 / schedule.latency_count : 0.0,
+         schedule.latency_max_us / 1e3);
+  sdcard::flushPredictions();
+  const sdcard::PredictionLogger::Stats log = sdcard::predictionLogStats();
+  printf("prediction log: %u queued, %u dropped, queue high water %u; %u "
+         "commits, mean %.2f ms, worst %.2f ms\n",
+         log.queued, log.dropped, log.queue_high_water, log.commits,
+         log.commits > 0 ? log.commit_sum_us / 1e3 / log.commits : 0.0,
+         log.commit_max_us / 1e3);
+  flush_clip_recording();
+  const ClipRecorder::Stats clips = clip_recording_stats();
+  printf("clips: %u written (%u truncated) for %u detections, %u merged, %u "
+         "dropped; worst write %.2f ms\n",
+         clips.clips, clips.truncated, clips.triggers, clips.merged, clips.dropped,
+         clips.write_max_us / 1e3);
+  // The feature task never returns: leave without running the static
+  // destructors of the interpreters it may still be using.
+  fflush(nullptr);
+  std::_Exit(EXIT_SUCCESS);
+}
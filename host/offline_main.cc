@@ -0,0 +1,355 @@
+// Offline driver: pushes WAV recordings through the on-device pipeline
+// (FeatureProvider::PopulateFeatureData + the classifier of loop()) as fast
+// as the CPU allows, instead of at the pace of the feature task, and reports
+// how much faster than real time that is. With --gate-eval, it measures what
+// the activity gate saves and costs instead.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "audio_provider.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "main_functions.h"
+#include "micro_model_settings.h"
+#include "op_profiler.h"
+#include "pipeline_trace.h"
+#include "sd_card.h"
+#include "sd_card_host.h"
+#include "wav_audio_source.h"
+
+namespace {
+// Accounts the time spent decoding audio, which otherwise hides inside the
+// feature extraction stage.
+class TimedAudioSource : public AudioSource {
+ public:
+  explicit TimedAudioSource(AudioSource* source) : source_(source) {}
+
+  TfLiteStatus Start() override { return source_->Start(); }
+  TfLiteStatus Read(int* samples_size, int16_t** samples) override {
+    const int64_t start_us = esp_timer_get_time();
+    const TfLiteStatus status = source_->Read(samples_size, samples);
+    read_us_ += esp_timer_get_time() - start_us;
+    return status;
+  }
+  bool IsRealTime() const override { return source_->IsRealTime(); }
+
+  int64_t read_us() const { return read_us_; }
+
+ private:
+  AudioSource* source_;
+  int64_t read_us_ = 0;
+};
+
+// Plays WAV files back to back as one recording, the way the microphone would
+// hear the calls and the quiet stretches between them.
+class PlaylistAudioSource : public AudioSource {
+ public:
+  explicit PlaylistAudioSource(const std::vector<const char*>& paths) : paths_(paths) {}
+
+  TfLiteStatus Start() override { return OpenNext(); }
+  TfLiteStatus Read(int* samples_size, int16_t** samples) override {
+    *samples_size = 0;
+    while (current_ != nullptr) {
+      if (current_->Read(samples_size, samples) != kTfLiteOk) {
+        return kTfLiteError;
+      }
+      if (*samples_size > 0) {
+        return kTfLiteOk;
+      }
+      if (OpenNext() != kTfLiteOk) {
+        return kTfLiteError;
+      }
+    }
+    return kTfLiteOk;
+  }
+  bool IsRealTime() const override { return false; }
+
+ private:
+  TfLiteStatus OpenNext() {
+    current_.reset();
+    if (next_ == paths_.size()) {
+      return kTfLiteOk;
+    }
+    current_.reset(new WavAudioSource(paths_[next_++], false));
+    return current_->Start();
+  }
+
+  const std::vector<const char*> paths_;
+  size_t next_ = 0;
+  std::unique_ptr<WavAudioSource> current_;
+};
+
+struct RunStats {
+  offline_stats_t stages = {};
+  int64_t audio_read_us = 0;
+  int64_t wall_us = 0;
+};
+
+void Accumulate(RunStats* total, const RunStats& run) {
+  total->stages.windows += run.stages.windows;
+  total->stages.gated += run.stages.gated;
+  total->stages.audio_ms += run.stages.audio_ms;
+  total->stages.features_us += run.stages.features_us;
+  total->stages.inference_us += run.stages.inference_us;
+  total->stages.postprocess_us += run.stages.postprocess_us;
+  total->audio_read_us += run.audio_read_us;
+  total->wall_us += run.wall_us;
+}
+
+void PrintStats(const char* name, const RunStats& run) {
+  const double wall_s = run.wall_us / 1e6;
+  const double audio_s = run.stages.audio_ms / 1e3;
+  const int64_t windows = run.stages.windows > 0 ? run.stages.windows : 1;
+  // Gated windows still have their features computed and their result
+  // processed, only the inference is left out.
+  const int64_t results = run.stages.windows + run.stages.gated > 0
+      ? run.stages.windows + run.stages.gated : 1;
+  printf("%s: %lld windows (%lld more gated), %.2f s audio in %.3f s: "
+         "%.1fx real time, %.1f windows/s\n",
+         name, (long long) run.stages.windows, (long long) run.stages.gated, audio_s,
+         wall_s,
+         wall_s > 0 ? audio_s / wall_s : 0.0,
+         wall_s > 0 ? run.stages.windows / wall_s : 0.0);
+  printf("  per window: audio read %.1f us, features %.1f us, "
+         "inference %.1f us, postprocess %.1f us\n",
+         (double) run.audio_read_us / results,
+         (double) (run.stages.features_us - run.audio_read_us) / results,
+         (double) run.stages.inference_us / windows,
+         (double) run.stages.postprocess_us / results);
+}
+
+// The results of one pass over the recordings, with the category detected
+// for each of them (-1 for none).
+struct GateRun {
+  RunStats run;
+  std::vector<int> detections;
+};
+
+GateRun RunPlaylist(const std::vector<const char*>& paths, bool gate_enabled) {
+  set_activity_gate_enabled(gate_enabled);
+  PlaylistAudioSource playlist(paths);
+  TimedAudioSource source(&playlist);
+  SetAudioSource(&source);
+  reset_offline();
+
+  GateRun gate_run;
+  offline_stats_t& stages = gate_run.run.stages;
+  const int64_t start_us = esp_timer_get_time();
+  int64_t results = 0;
+  while (step_offline(&stages)) {
+    if (stages.windows + stages.gated > results) {
+      results = stages.windows + stages.gated;
+      gate_run.detections.push_back(last_detected_category());
+    }
+  }
+  gate_run.run.wall_us = esp_timer_get_time() - start_us;
+  gate_run.run.audio_read_us = source.read_us();
+  sdcard::flushPredictions();
+  return gate_run;
+}
+
+// Runs the recordings, played back to back, without and with the activity
+// gate, and reports the classifier time the gate saves against the detections
+// it loses: results above the threshold without the gate that the gate
+// carried forward as something else. Both passes produce a result for the
+// same frames, so they compare one to one.
+void EvaluateActivityGate(const std::vector<const char*>& paths) {
+  const GateRun ungated = RunPlaylist(paths, false);
+  const GateRun gated = RunPlaylist(paths, true);
+  PrintStats("without gate", ungated.run);
+  PrintStats("with gate", gated.run);
+
+  int detections = 0;
+  int lost = 0;
+  int added = 0;
+  const size_t results = std::min(ungated.detections.size(), gated.detections.size());
+  for (size_t i = 0; i < results; ++i) {
+    const int expected = ungated.detections[i];
+    const int got = gated.detections[i];
+    detections += expected >= 0;
+    lost += expected >= 0 && got != expected;
+    added += got >= 0 && got != expected;
+  }
+  const int64_t total_results = gated.run.stages.windows + gated.run.stages.gated;
+  printf("activity gate: %lld of %lld results carried forward (%.1f%%)\n",
+         (long long) gated.run.stages.gated, (long long) total_results,
+         total_results > 0 ? 100.0 * gated.run.stages.gated / total_results : 0.0);
+  printf("  inference %.3f s -> %.3f s, whole pipeline %.3f s -> %.3f s "
+         "(%.1f%% CPU saved)\n",
+         ungated.run.stages.inference_us / 1e6, gated.run.stages.inference_us / 1e6,
+         ungated.run.wall_us / 1e6, gated.run.wall_us / 1e6,
+         ungated.run.wall_us > 0
+             ? 100.0 * (ungated.run.wall_us - gated.run.wall_us) / ungated.run.wall_us
+             : 0.0);
+  printf("  detections: %d without the gate, %d lost, %d added\n", detections, lost,
+         added);
+  if (ungated.detections.size() != gated.detections.size()) {
+    printf("  (%zu results without the gate, %zu with it)\n",
+           ungated.detections.size(), gated.detections.size());
+  }
+}
+
+void PrintPredictionLogStats() {
+  const sdcard::PredictionLogger::Stats log = sdcard::predictionLogStats();
+  printf("prediction log: %u records, %llu bytes, in %u commits (mean %.2f ms, worst "
+         "%.2f ms), queue high water %u, %u dropped, %u write errors\n",
+         log.committed, (unsigned long long) log.bytes_written, log.commits,
+         log.commits > 0 ? log.commit_sum_us / 1e3 / log.commits : 0.0,
+         log.commit_max_us / 1e3, log.queue_high_water, log.dropped, log.write_errors);
+}
+
+void PrintClipStats() {
+  const ClipRecorder::Stats clips = clip_recording_stats();
+  printf("clips: %u written (%u truncated, %.1f s of audio) for %u detections, "
+         "%u merged, %u dropped, worst write %.2f ms, %u write errors\n",
+         clips.clips, clips.truncated,
+         clips.bytes_written / 2.0 / kAudioSampleFrequency, clips.triggers, clips.merged,
+         clips.dropped, clips.write_max_us / 1e3, clips.write_errors);
+}
+
+// Logs the per-stage trace of the whole run, also appending it to path if
+// it isn't null.
+void PrintTrace(const char* path) {
+#if CONFIG_PIPELINE_TRACE
+  esp_log_level_set("*", ESP_LOG_INFO);
+  ReportPipelineTrace(path);
+#else
+  fprintf(stderr, "--trace needs a build with -DPIPELINE_TRACE=ON\n");
+#endif
+}
+
+// Logs the time of each operator of the interpreters over the whole run,
+// also appending it to path if it isn't null.
+void PrintOpProfiles(const char* path) {
+#if CONFIG_OP_PROFILER
+  esp_log_level_set("*", ESP_LOG_INFO);
+  ReportOpProfiles(path);
+#else
+  fprintf(stderr, "--op-profile needs a build with -DOP_PROFILER=ON\n");
+#endif
+}
+
+void PrintUsage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [--sd DIR] [--binary-log] [--top-k N] [--smoothing MS] [--clips] "
+          "[--sd-model] [--trace FILE] [--op-profile FILE] [--verbose] [--gate-eval] "
+          "FILE.wav...\n"
+          "  --sd DIR        directory the prediction log goes to (default ./sdcard)\n"
+          "  --binary-log    log the predictions to N.bin rather than N.csv\n"
+          "  --top-k N       log only the N highest scores of each prediction that\n"
+          "                  reach their category's kCategoryLogMinScores (0: all)\n"
+          "  --smoothing MS  average the results over MS before detecting, and log\n"
+          "                  only new detections\n"
+          "  --clips         record WAV clips of the detections to DIR/clips\n"
+          "  --sd-model      classify with DIR/model.tflite rather than the rendered\n"
+          "                  model, as CONFIG_MODEL_SOURCE_SD does\n"
+          "  --trace FILE    log the latency of each pipeline stage at the end and\n"
+          "                  append it to FILE as JSON lines\n"
+          "  --op-profile FILE\n"
+          "                  log the time of each model operator at the end and\n"
+          "                  append it to FILE as JSON lines\n"
+          "  --verbose       keep the per-window log lines (slows things down)\n"
+          "  --gate-eval     play the files back to back, without and then with the\n"
+          "                  activity gate, and compare CPU time and detections\n",
+          program);
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::vector<const char*> wav_paths;
+  bool verbose = false;
+  bool gate_eval = false;
+  bool clips = false;
+  const char* trace_path = nullptr;
+  const char* op_profile_path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--sd") == 0 && i + 1 < argc) {
+      sdcard::setMountPoint(argv[++i]);
+    } else if (strcmp(argv[i], "--verbose") == 0) {
+      verbose = true;
+    } else if (strcmp(argv[i], "--gate-eval") == 0) {
+      gate_eval = true;
+    } else if (strcmp(argv[i], "--binary-log") == 0) {
+      sdcard::setPredictionLogFormat(sdcard::PredictionLogger::Format::kBinary);
+    } else if (strcmp(argv[i], "--top-k") == 0 && i + 1 < argc) {
+      sdcard::setPredictionLogSparse(true, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--smoothing") == 0 && i + 1 < argc) {
+      set_posterior_smoothing_window(atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--clips") == 0) {
+      clips = true;
+    } else if (strcmp(argv[i], "--sd-model") == 0) {
+      set_model_source(ModelLoader::Source::kSdCard);
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      trace_path = argv[++i];
+    } else if (strcmp(argv[i], "--op-profile") == 0 && i + 1 < argc) {
+      op_profile_path = argv[++i];
+    } else if (argv[i][0] == '-') {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    } else {
+      wav_paths.push_back(argv[i]);
+    }
+  }
+  if (wav_paths.empty()) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if (!verbose) {
+    esp_log_level_set("*", ESP_LOG_WARN);
+  }
+
+  if (clips) {
+    enable_clip_recording();
+  }
+  if (!setup_offline()) {
+    fprintf(stderr, "Couldn't set up the classifier\n");
+    return EXIT_FAILURE;
+  }
+  if (gate_eval) {
+    EvaluateActivityGate(wav_paths);
+    if (trace_path != nullptr) {
+      PrintTrace(trace_path);
+    }
+    if (op_profile_path != nullptr) {
+      PrintOpProfiles(op_profile_path);
+    }
+    return EXIT_SUCCESS;
+  }
+
+  RunStats total;
+  for (const char* path : wav_paths) {
+    WavAudioSource wav_source(path, false);
+    TimedAudioSource source(&wav_source);
+    SetAudioSource(&source);
+    reset_offline();
+
+    RunStats run;
+    const int64_t start_us = esp_timer_get_time();
+    while (step_offline(&run.stages)) {
+    }
+    run.wall_us = esp_timer_get_time() - start_us;
+    run.audio_read_us = source.read_us();
+    sdcard::flushPredictions();
+    flush_clip_recording();
+    PrintStats(path, run);
+    Accumulate(&total, run);
+  }
+  if (wav_paths.size() > 1) {
+    PrintStats("total", total);
+  }
+  PrintPredictionLogStats();
+  if (clips) {
+    PrintClipStats();
+  }
+  if (trace_path != nullptr) {
+    PrintTrace(trace_path);
+  }
+  if (op_profile_path != nullptr) {
+    PrintOpProfiles(op_profile_path);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,204 @@
+// Turns binary prediction logs (N.bin, see main/prediction_log_format.h) back
+// into the CSV layout the CSV logger writes: a timestamp,label... header and
+// one row of dequantized scores per record, or for sparse logs a
+// timestamp,label,score row per logged score, formatted the same way so that
+// both logs of the same run compare equal.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "prediction_log_format.h"
+
+namespace {
+struct LogHeader {
+  uint16_t flags;
+  uint32_t category_count;
+  float scale;
+  int32_t zero_point;
+  std::vector<std::string> labels;
+};
+
+bool ReadFile(const char* path, std::vector<uint8_t>* data) {
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr) {
+    fprintf(stderr, "Can't open %s\n", path);
+    return false;
+  }
+  uint8_t chunk[65536];
+  size_t read;
+  while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    data->insert(data->end(), chunk, chunk + read);
+  }
+  fclose(file);
+  return true;
+}
+
+// Returns the size of the header at the start of data, or 0 if it's not one.
+size_t ParseHeader(const std::vector<uint8_t>& data, LogHeader* header) {
+  if (data.size() < sdcard::kBinaryLogFixedHeaderSize ||
+      memcmp(data.data(), sdcard::kBinaryLogMagic, sizeof(sdcard::kBinaryLogMagic)) != 0) {
+    return 0;
+  }
+  const uint16_t version = data[4] | (data[5] << 8);
+  if (version != sdcard::kBinaryLogVersion) {
+    fprintf(stderr, "Unsupported log version %u\n", version);
+    return 0;
+  }
+  header->flags = data[6] | (data[7] << 8);
+  header->category_count = sdcard::GetLe32(&data[8]);
+  const uint32_t scale_bits = sdcard::GetLe32(&data[12]);
+  memcpy(&header->scale, &scale_bits, sizeof(header->scale));
+  header->zero_point = static_cast<int32_t>(sdcard::GetLe32(&data[16]));
+  const uint32_t labels_size = sdcard::GetLe32(&data[20]);
+  const size_t size = sdcard::kBinaryLogFixedHeaderSize + labels_size;
+  if (data.size() < size) {
+    return 0;
+  }
+  header->labels.clear();
+  const char* label = reinterpret_cast<const char*>(&data[sdcard::kBinaryLogFixedHeaderSize]);
+  const char* labels_end = label + labels_size;
+  while (label < labels_end && header->labels.size() < header->category_count) {
+    const size_t length = strnlen(label, labels_end - label);
+    header->labels.emplace_back(label, length);
+    label += length + 1;
+  }
+  return header->labels.size() == header->category_count ? size : 0;
+}
+
+// Same arithmetic as the CSV logger, in float
+float Dequantize(const LogHeader& header, uint8_t score) {
+  return (static_cast<int8_t>(score) - header.zero_point) * header.scale;
+}
+
+// Converts the record at *p, moving *p past it. Returns false if the record
+// doesn't end before end, or is not a valid one.
+bool ConvertRecord(const LogHeader& header, const uint8_t** p, const uint8_t* end,
+                   int64_t* timestamp_ms, FILE* out) {
+  const uint8_t* in = *p;
+  uint64_t delta;
+  size_t varint_size = sdcard::GetVarint(in, end, &delta);
+  if (varint_size == 0) {
+    return false;
+  }
+  in += varint_size;
+  const int64_t timestamp = *timestamp_ms + sdcard::UnZigZag(delta);
+  if (!(header.flags & sdcard::kBinaryLogSparse)) {
+    if (end - in < static_cast<ptrdiff_t>(header.category_count)) {
+      return false;
+    }
+    fprintf(out, "%lld", static_cast<long long>(timestamp));
+    for (uint32_t i = 0; i < header.category_count; ++i) {
+      fprintf(out, ",%.4f", Dequantize(header, in[i]));
+    }
+    fputs("\n", out);
+    in += header.category_count;
+  } else {
+    uint64_t count;
+    varint_size = sdcard::GetVarint(in, end, &count);
+    if (varint_size == 0 || count > header.category_count) {
+      return false;
+    }
+    in += varint_size;
+    // Checked in full before anything of the record is printed
+    const uint8_t* pairs = in;
+    for (uint64_t i = 0; i < count; ++i) {
+      uint64_t category;
+      varint_size = sdcard::GetVarint(in, end, &category);
+      if (varint_size == 0 || category >= header.category_count || in + varint_size >= end) {
+        return false;
+      }
+      in += varint_size + 1;
+    }
+    for (in = pairs; count > 0; --count) {
+      uint64_t category;
+      in += sdcard::GetVarint(in, end, &category);
+      fprintf(out, "%lld,%s,%.4f\n", static_cast<long long>(timestamp),
+              header.labels[category].c_str(), Dequantize(header, *in++));
+    }
+  }
+  *timestamp_ms = timestamp;
+  *p = in;
+  return true;
+}
+
+void PrintUsage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [-o OUT.csv] FILE.bin...\n"
+          "  -o OUT.csv  write the CSV there instead of to stdout\n"
+          "Files are converted in the order given, into one CSV.\n",
+          program);
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  const char* out_path = nullptr;
+  std::vector<const char*> paths;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      out_path = argv[++i];
+    } else if (argv[i][0] == '-') {
+      PrintUsage(argv[0]);
+      return EXIT_FAILURE;
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty()) {
+    PrintUsage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  FILE* out = out_path != nullptr ? fopen(out_path, "w") : stdout;
+  if (out == nullptr) {
+    fprintf(stderr, "Can't create %s\n", out_path);
+    return EXIT_FAILURE;
+  }
+
+  LogHeader first = {};
+  size_t records = 0;
+  for (size_t f = 0; f < paths.size(); ++f) {
+    std::vector<uint8_t> data;
+    if (!ReadFile(paths[f], &data)) {
+      return EXIT_FAILURE;
+    }
+    LogHeader header;
+    const size_t header_size = ParseHeader(data, &header);
+    if (header_size == 0) {
+      fprintf(stderr, "%s is not a prediction log\n", paths[f]);
+      return EXIT_FAILURE;
+    }
+    if (f == 0) {
+      first = header;
+      if (header.flags & sdcard::kBinaryLogSparse) {
+        fputs("timestamp,label,score\n", out);
+      } else {
+        fputs("timestamp", out);
+        for (const std::string& label : header.labels) {
+          fprintf(out, ",%s", label.c_str());
+        }
+        fputs("\n", out);
+      }
+    } else if (header.labels != first.labels || header.flags != first.flags) {
+      fprintf(stderr, "%s has different labels or layout than %s\n", paths[f], paths[0]);
+      return EXIT_FAILURE;
+    }
+
+    const uint8_t* p = data.data() + header_size;
+    const uint8_t* end = data.data() + data.size();
+    int64_t timestamp_ms = 0;
+    while (p < end) {
+      if (!ConvertRecord(header, &p, end, &timestamp_ms, out)) {
+        fprintf(stderr, "%s: incomplete last record, %zu bytes skipped\n", paths[f],
+                static_cast<size_t>(end - p));
+        break;
+      }
+      records++;
+    }
+  }
+  if (out != stdout) {
+    fclose(out);
+  }
+  fprintf(stderr, "%zu records from %zu files\n", records, paths.size());
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+namespace sdcard {
+// Host build only: local directory standing in for the card. Has to be set
+// before mount(), defaults to ./sdcard.
+void setMountPoint(const char* directory);
+}  // namespace sdcard
@@ -0,0 +1,36 @@
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include "esp_log.h"
+#include "sd_card.h"
+#include "sd_card_host.h"
+
+static const char *TAG = "sd";
+
+namespace {
+std::string g_mount_point = "sdcard";
+}  // namespace
+
+namespace sdcard {
+void setMountPoint(const char* directory) {
+  g_mount_point = directory;
+}
+
+esp_err_t mount() {
+  if (mkdir(g_mount_point.c_str(), 0755) != 0 && errno != EEXIST) {
+    ESP_LOGE(TAG, "Failed to create %s: %s", g_mount_point.c_str(), strerror(errno));
+    return ESP_FAIL;
+  }
+  ESP_LOGI(TAG, "SD card stand-in directory: %s", g_mount_point.c_str());
+  return ESP_OK;
+}
+
+void unmount() {
+  ESP_LOGI(TAG, "SD card unmounted");
+}
+
+const char* mountPoint() {
+  return g_mount_point.c_str();
+}
+}  // namespace sdcard
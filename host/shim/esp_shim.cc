@@ -0,0 +1,109 @@
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+
+namespace {
+const auto g_start_time = std::chrono::steady_clock::now();
+std::mutex g_log_mutex;
+
+esp_log_level_t LogLevelFromEnvironment() {
+  const char* level = std::getenv("ESP_LOG_LEVEL");
+  if (level == nullptr) {
+    return ESP_LOG_INFO;
+  }
+  switch (level[0]) {
+    case 'N': return ESP_LOG_NONE;
+    case 'E': return ESP_LOG_ERROR;
+    case 'W': return ESP_LOG_WARN;
+    case 'D': return ESP_LOG_DEBUG;
+    case 'V': return ESP_LOG_VERBOSE;
+    default: return ESP_LOG_INFO;
+  }
+}
+
+esp_log_level_t g_max_level = LogLevelFromEnvironment();
+}  // namespace
+
+extern "C" {
+
+int64_t esp_timer_get_time(void) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - g_start_time).count();
+}
+
+uint32_t esp_log_timestamp(void) {
+  return static_cast<uint32_t>(esp_timer_get_time() / 1000);
+}
+
+void esp_log_level_set(const char* tag, esp_log_level_t level) {
+  g_max_level = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...) {
+  static const char kLevelLetters[] = "NEWIDV";
+  if (level > g_max_level) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(g_log_mutex);
+  fprintf(stderr, "%c (%u) %s: ", kLevelLetters[level], esp_log_timestamp(), tag);
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+const char* esp_err_to_name(esp_err_t code) {
+  switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+    default: return "UNKNOWN ERROR";
+  }
+}
+
+void* heap_caps_malloc(size_t size, uint32_t caps) { return malloc(size); }
+
+void* heap_caps_calloc(size_t n, size_t size, uint32_t caps) { return calloc(n, size); }
+
+void* heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps) {
+  // aligned_alloc() wants a multiple of the alignment
+  return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void heap_caps_free(void* ptr) { free(ptr); }
+
+size_t heap_caps_get_free_size(uint32_t caps) { return SIZE_MAX; }
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) { return SIZE_MAX; }
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type,
+                                                esp_partition_subtype_t subtype,
+                                                const char* label) {
+  return nullptr;
+}
+
+esp_err_t esp_partition_mmap(const esp_partition_t* partition, size_t offset, size_t size,
+                             esp_partition_mmap_memory_t memory, const void** out_ptr,
+                             esp_partition_mmap_handle_t* out_handle) {
+  return ESP_ERR_NOT_SUPPORTED;
+}
+
+void esp_partition_munmap(esp_partition_mmap_handle_t handle) {}
+
+}  // extern "C"
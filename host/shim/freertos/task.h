@@ -0,0 +1,34 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*TaskFunction_t)(void*);
+typedef struct HostTask* TaskHandle_t;
+
+// Starts task_code on a new thread. Stack size, priority and core are
+// accepted for source compatibility but ignored.
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task_code, const char* name,
+                                   uint32_t stack_depth, void* parameters,
+                                   UBaseType_t priority,
+                                   TaskHandle_t* created_task,
+                                   BaseType_t core_id);
+// Only deleting the calling task (task == NULL) is supported.
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks_to_delay);
+TickType_t xTaskGetTickCount(void);
+BaseType_t xTaskDelayUntil(TickType_t* previous_wake_time,
+                           TickType_t time_increment);
+
+// Threads not started by xTaskCreatePinnedToCore() (e.g. main()) get a handle
+// of their own on first use, so they can wait on notifications too.
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+// The counting-semaphore flavour of direct-to-task notifications.
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait);
+
+#ifdef __cplusplus
+}
+#endif
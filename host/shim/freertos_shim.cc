@@ -0,0 +1,182 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+static const char *TAG = "freertos_shim";
+
+namespace {
+using Clock = std::chrono::steady_clock;
+const Clock::time_point g_start_time = Clock::now();
+
+// Thrown by vTaskDelete(nullptr) to unwind the calling task back to its
+// thread entry point.
+struct TaskDeleted {};
+
+std::chrono::milliseconds TicksToDuration(TickType_t ticks) {
+  return std::chrono::milliseconds(ticks * (1000 / configTICK_RATE_HZ));
+}
+}  // namespace
+
+struct HostTask {
+  std::string name;
+  TaskFunction_t task_code;
+  void* parameters;
+  // Threads that weren't created as tasks, see xTaskGetCurrentTaskHandle().
+  bool adopted = false;
+
+  std::mutex notify_mutex;
+  std::condition_variable notified;
+  uint32_t notify_count = 0;
+};
+
+namespace {
+thread_local HostTask* g_current_task = nullptr;
+thread_local std::unique_ptr<HostTask> g_adopted_task;
+
+void RunTask(HostTask* task) {
+  g_current_task = task;
+  try {
+    task->task_code(task->parameters);
+  } catch (const TaskDeleted&) {
+  }
+  ESP_LOGD(TAG, "Task %s finished", task->name.c_str());
+  delete task;
+}
+}  // namespace
+
+struct HostSemaphore {
+  std::mutex mutex;
+  std::condition_variable available;
+  int count;
+};
+
+extern "C" {
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task_code, const char* name,
+                                   uint32_t stack_depth, void* parameters,
+                                   UBaseType_t priority,
+                                   TaskHandle_t* created_task,
+                                   BaseType_t core_id) {
+  auto* task = new HostTask();
+  task->name = name != nullptr ? name : "";
+  task->task_code = task_code;
+  task->parameters = parameters;
+  if (created_task != nullptr) {
+    *created_task = task;
+  }
+  std::thread(RunTask, task).detach();
+  return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  if (task != nullptr || g_current_task == nullptr || g_current_task->adopted) {
+    ESP_LOGE(TAG, "vTaskDelete is only supported on the calling task");
+    std::abort();
+  }
+  throw TaskDeleted();
+}
+
+void vTaskDelay(TickType_t ticks_to_delay) {
+  std::this_thread::sleep_for(TicksToDuration(ticks_to_delay));
+}
+
+TickType_t xTaskGetTickCount(void) {
+  const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      Clock::now() - g_start_time);
+  return static_cast<TickType_t>(elapsed.count() * configTICK_RATE_HZ / 1000);
+}
+
+BaseType_t xTaskDelayUntil(TickType_t* previous_wake_time,
+                           TickType_t time_increment) {
+  *previous_wake_time += time_increment;
+  const auto wake_time = g_start_time + TicksToDuration(*previous_wake_time);
+  if (wake_time <= Clock::now()) {
+    return pdFALSE;
+  }
+  std::this_thread::sleep_until(wake_time);
+  return pdTRUE;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+  if (g_current_task == nullptr) {
+    g_adopted_task = std::make_unique<HostTask>();
+    g_adopted_task->name = "main";
+    g_adopted_task->adopted = true;
+    g_current_task = g_adopted_task.get();
+  }
+  return g_current_task;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+  {
+    std::lock_guard<std::mutex> lock(task->notify_mutex);
+    task->notify_count++;
+  }
+  task->notified.notify_one();
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait) {
+  HostTask* task = xTaskGetCurrentTaskHandle();
+  std::unique_lock<std::mutex> lock(task->notify_mutex);
+  auto is_notified = [task] { return task->notify_count > 0; };
+  if (ticks_to_wait == portMAX_DELAY) {
+    task->notified.wait(lock, is_notified);
+  } else if (!task->notified.wait_for(lock, TicksToDuration(ticks_to_wait),
+                                      is_notified)) {
+    return 0;
+  }
+  const uint32_t count = task->notify_count;
+  task->notify_count = clear_count_on_exit ? 0 : count - 1;
+  return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+  auto* semaphore = new HostSemaphore();
+  semaphore->count = 0;
+  return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+  auto* semaphore = new HostSemaphore();
+  semaphore->count = 1;
+  return semaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks_to_wait) {
+  std::unique_lock<std::mutex> lock(semaphore->mutex);
+  auto is_available = [semaphore] { return semaphore->count > 0; };
+  if (ticks_to_wait == portMAX_DELAY) {
+    semaphore->available.wait(lock, is_available);
+  } else if (!semaphore->available.wait_for(lock, TicksToDuration(ticks_to_wait),
+                                            is_available)) {
+    return pdFALSE;
+  }
+  semaphore->count--;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+  {
+    std::lock_guard<std::mutex> lock(semaphore->mutex);
+    if (semaphore->count > 0) {
+      return pdFALSE;
+    }
+    semaphore->count = 1;
+  }
+  semaphore->available.notify_one();
+  return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) { delete semaphore; }
+
+}  // extern "C"
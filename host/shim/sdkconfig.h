@@ -0,0 +1,5 @@
+#pragma once
+// Host build configuration. Nothing from the board's sdkconfig applies here:
+// in particular there is no CONFIG_SPIRAM_SUPPORT, so PSRAM allocations fall
+// back to the regular heap.
+#define CONFIG_IDF_TARGET_LINUX 1
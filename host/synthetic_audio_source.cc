@@ -0,0 +1,50 @@
+#include "synthetic_audio_source.h"
+
+#include <algorithm>
+#include <cmath>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+SyntheticAudioSource::SyntheticAudioSource(float tone_hz, float tone_amplitude,
+                                           float noise_amplitude, int duration_ms,
+                                           bool real_time)
+    : tone_hz_(tone_hz),
+      tone_amplitude_(tone_amplitude),
+      noise_amplitude_(noise_amplitude),
+      total_samples_(static_cast<int64_t>(duration_ms) * kAudioSampleFrequency / 1000),
+      real_time_(real_time) {}
+
+TfLiteStatus SyntheticAudioSource::Start() {
+  start_time_us_ = esp_timer_get_time();
+  return kTfLiteOk;
+}
+
+TfLiteStatus SyntheticAudioSource::Read(int* samples_size, int16_t** samples) {
+  int64_t block_samples = kBlockSamples;
+  if (total_samples_ > 0) {
+    block_samples = std::min(block_samples, total_samples_ - samples_generated_);
+  }
+  for (int i = 0; i < block_samples; ++i) {
+    const double t = static_cast<double>(samples_generated_ + i) / kAudioSampleFrequency;
+    noise_state_ = noise_state_ * 1664525u + 1013904223u;
+    const float noise = (static_cast<int32_t>(noise_state_) / 2147483648.0f) * noise_amplitude_;
+    const float tone = tone_amplitude_ * std::sin(2.0 * M_PI * tone_hz_ * t);
+    const float value = std::max(-1.0f, std::min(1.0f, tone + noise));
+    block_[i] = static_cast<int16_t>(value * 32767.0f);
+  }
+
+  if (real_time_ && block_samples > 0) {
+    const int64_t due_us = start_time_us_ +
+        (samples_generated_ + block_samples) * 1000000 / kAudioSampleFrequency;
+    const int64_t wait_us = due_us - esp_timer_get_time();
+    if (wait_us > 0) {
+      vTaskDelay(pdMS_TO_TICKS(wait_us / 1000));
+    }
+  }
+  samples_generated_ += block_samples;
+
+  *samples_size = static_cast<int>(block_samples);
+  *samples = block_;
+  return kTfLiteOk;
+}
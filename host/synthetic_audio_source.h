@@ -0,0 +1,29 @@
+#pragma once
+#include "audio_source.h"
+#include "micro_model_settings.h"
+
+// Generates a sine tone over white noise, for running the pipeline without
+// any recordings at hand. Deterministic: the noise uses a fixed seed.
+class SyntheticAudioSource : public AudioSource {
+ public:
+  // Amplitudes are in full-scale units (0..1). A duration_ms of 0 never ends.
+  SyntheticAudioSource(float tone_hz, float tone_amplitude,
+                       float noise_amplitude, int duration_ms, bool real_time);
+
+  TfLiteStatus Start() override;
+  TfLiteStatus Read(int* samples_size, int16_t** samples) override;
+  bool IsRealTime() const override { return real_time_; }
+
+  static constexpr int kBlockSamples = kAudioSampleFrequency / 10;
+
+ private:
+  float tone_hz_;
+  float tone_amplitude_;
+  float noise_amplitude_;
+  int64_t total_samples_;
+  bool real_time_;
+  int64_t start_time_us_ = 0;
+  int64_t samples_generated_ = 0;
+  uint32_t noise_state_ = 0x12345678;
+  int16_t block_[kBlockSamples] = {};
+};
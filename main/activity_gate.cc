@@ -0,0 +1,50 @@
+#include "activity_gate.h"
+
+#include <algorithm>
+#include "micro_model_settings.h"
+
+ActivityGate::ActivityGate(const Config& config)
+    : open_margin_(config.open_margin * kFeatureSize),
+      close_margin_(std::min(config.close_margin, config.open_margin) * kFeatureSize),
+      hold_slices_(std::max(config.hold_slices, 0)) {}
+
+void ActivityGate::Reset() {
+  open_ = false;
+  hold_left_ = 0;
+  level_ = 0;
+  floor_ = -1;
+  last_active_end_ms_ = -1;
+}
+
+bool ActivityGate::Update(const int8_t* features, int32_t slice_end_ms) {
+  int32_t level = 0;
+  for (int i = 0; i < kFeatureSize; ++i) {
+    level += features[i] - INT8_MIN;
+  }
+  level_ = level;
+
+  const int32_t level_q = level << kFloorFractionBits;
+  if (floor_ < 0 || level_q < floor_) {
+    floor_ = level_q;
+  }
+  const int32_t above_floor = level - noise_floor();
+
+  if (above_floor >= open_margin_) {
+    open_ = true;
+    hold_left_ = hold_slices_;
+  } else if (open_ && above_floor >= close_margin_) {
+    hold_left_ = hold_slices_;
+  } else if (open_ && hold_left_ > 0) {
+    hold_left_--;
+  } else {
+    open_ = false;
+  }
+  if (open_) {
+    last_active_end_ms_ = slice_end_ms;
+  }
+  // Much slower while the gate is open, so that calls aren't taken for
+  // background but a lasting change of background doesn't keep it open.
+  const int rise_shift = open_ ? kOpenFloorRiseShift : kFloorRiseShift;
+  floor_ = std::min(floor_ + ((level_q - floor_) >> rise_shift) + 1, level_q);
+  return open_;
+}
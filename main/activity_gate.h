@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+
+// Cheap activity detector that the feature task runs on every new spectrogram
+// slice, so that the classifier can be left out on stretches where nothing
+// happens. A slice's level is the sum of its features, which the frontend has
+// already noise-reduced and log-compressed, and it's compared against an
+// adaptive noise floor: the floor follows the level down at once and creeps
+// up towards it by 1/2^kFloorRiseShift of the gap per slice, so that steady
+// background is absorbed within a few seconds (within tens of seconds while
+// the gate is open).
+//
+// With hysteresis: the gate opens on a slice open_margin above the floor, and
+// closes once the level has stayed less than close_margin above it for
+// hold_slices slices. Margins are in feature steps per channel.
+//
+// Not thread-safe: meant to be used by the feature task alone. Its verdict
+// reaches the classifier through FrameHandoff::FrameInfo::active_end_ms.
+class ActivityGate {
+ public:
+  struct Config {
+    int open_margin;
+    int close_margin;
+    int hold_slices;
+  };
+
+  explicit ActivityGate(const Config& config);
+
+  // Forgets the noise floor and closes the gate, e.g. for a new audio stream.
+  void Reset();
+
+  // Takes the kFeatureSize features of the slice whose window ends at audio
+  // time slice_end_ms. Returns whether the gate is open after it.
+  bool Update(const int8_t* features, int32_t slice_end_ms);
+
+  bool is_open() const { return open_; }
+  // Where the newest slice that found the gate open ends, or -1 if none did
+  int32_t last_active_end_ms() const { return last_active_end_ms_; }
+  int32_t level() const { return level_; }
+  int32_t noise_floor() const { return floor_ >> kFloorFractionBits; }
+
+ private:
+  // About 2.5 s for the floor to settle on a new background with 20 ms
+  // slices, and 20 s while the gate is open
+  static constexpr int kFloorRiseShift = 7;
+  static constexpr int kOpenFloorRiseShift = 10;
+  static constexpr int kFloorFractionBits = 8;
+
+  const int32_t open_margin_;
+  const int32_t close_margin_;
+  const int hold_slices_;
+
+  bool open_ = false;
+  // Slices left before an open gate closes
+  int hold_left_ = 0;
+  int32_t level_ = 0;
+  // With kFloorFractionBits fractional bits; negative until the first slice
+  int32_t floor_ = -1;
+  int32_t last_active_end_ms_ = -1;
+};
@@ -0,0 +1,364 @@
+#include "audio_frontend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "signal/src/rfft.h"
+
+static const char* TAG = "audio_frontend";
+
+// The constants and the integer arithmetic below are those of the TFLM signal
+// library ops the preprocessor model is made of (and of the microfrontend
+// library before them): any difference shows up in the bit-exactness check of
+// the pipeline benchmarks.
+namespace {
+constexpr int kWindowBits = 12;
+constexpr int kFilterbankBits = 12;
+constexpr int kNoiseReductionBits = 14;
+constexpr int kPcanSnrBits = 12;
+constexpr int kPcanOutputBits = 6;
+constexpr int kWideDynamicFunctionBits = 32;
+constexpr int kLogSegmentsLog2 = 7;
+constexpr int kLogScaleLog2 = 16;
+constexpr uint32_t kLogScale = 1 << kLogScaleLog2;
+constexpr uint32_t kLogCoeff = 45426;  // ln(2) * kLogScale
+// The legacy scaling of the log features to int8: feature * 256 / (25.6 * 26)
+constexpr int32_t kFeatureValueScale = 256;
+constexpr int32_t kFeatureValueDiv = 666;
+
+static_assert(kFeatureSize < 255, "filterbank slots are indexed with a uint8_t");
+static_assert(AudioFrontend::kGainLutSize == 4 * kWideDynamicFunctionBits - 3,
+              "one gain segment per input bit");
+
+// (log2(1 + x) - x) * kLogScale at x = i / 128, for interpolation
+constexpr uint16_t kLogLut[(1 << kLogSegmentsLog2) + 1] = {
+    0,    224,  442,  654,  861,  1063, 1259, 1450, 1636, 1817, 1992, 2163,
+    2329, 2490, 2646, 2797, 2944, 3087, 3224, 3358, 3487, 3611, 3732, 3848,
+    3960, 4068, 4172, 4272, 4368, 4460, 4549, 4633, 4714, 4791, 4864, 4934,
+    5001, 5063, 5123, 5178, 5231, 5280, 5326, 5368, 5408, 5444, 5477, 5507,
+    5533, 5557, 5578, 5595, 5610, 5622, 5631, 5637, 5640, 5641, 5638, 5633,
+    5626, 5615, 5602, 5586, 5568, 5547, 5524, 5498, 5470, 5439, 5406, 5370,
+    5332, 5291, 5249, 5203, 5156, 5106, 5054, 5000, 4944, 4885, 4825, 4762,
+    4697, 4630, 4561, 4490, 4416, 4341, 4264, 4184, 4103, 4020, 3935, 3848,
+    3759, 3668, 3575, 3481, 3384, 3286, 3186, 3084, 2981, 2875, 2768, 2659,
+    2549, 2437, 2323, 2207, 2090, 1971, 1851, 1729, 1605, 1480, 1353, 1224,
+    1094, 963,  830,  695,  559,  421,  282,  142,  0};
+
+int MostSignificantBit32(uint32_t x) { return x != 0 ? 32 - __builtin_clz(x) : 0; }
+
+int MostSignificantBit64(uint64_t x) { return x != 0 ? 64 - __builtin_clzll(x) : 0; }
+
+float FreqToMel(float freq) { return 1127.0 * std::log1p(freq / 700.0); }
+
+uint16_t Sqrt32(uint32_t num) {
+  if (num == 0) {
+    return 0;
+  }
+  uint32_t res = 0;
+  int max_bit_number = 32 - MostSignificantBit32(num);
+  max_bit_number |= 1;
+  uint32_t bit = 1U << (31 - max_bit_number);
+  int iterations = (31 - max_bit_number) / 2 + 1;
+  while (iterations--) {
+    if (num >= res + bit) {
+      num -= res + bit;
+      res = (res >> 1) + bit;
+    } else {
+      res >>= 1;
+    }
+    bit >>= 2;
+  }
+  // Round, if there are bits left for it.
+  if (num > res && res != 0xFFFF) {
+    ++res;
+  }
+  return res;
+}
+
+uint32_t Sqrt64(uint64_t num) {
+  // 32-bit arithmetic whenever the upper word is clear, like the library:
+  // slightly off next to 2^32, but much faster.
+  if ((num >> 32) == 0) {
+    return Sqrt32(static_cast<uint32_t>(num));
+  }
+  uint64_t res = 0;
+  int max_bit_number = 64 - MostSignificantBit64(num);
+  max_bit_number |= 1;
+  uint64_t bit = 1ULL << (63 - max_bit_number);
+  int iterations = (63 - max_bit_number) / 2 + 1;
+  while (iterations--) {
+    if (num >= res + bit) {
+      num -= res + bit;
+      res = (res >> 1) + bit;
+    } else {
+      res >>= 1;
+    }
+    bit >>= 2;
+  }
+  if (num > res && res != 0xFFFFFFFFLL) {
+    ++res;
+  }
+  return res;
+}
+
+// Piecewise quadratic interpolation of the PCAN gain table.
+int16_t WideDynamicFunction(uint32_t x, const int16_t* lut) {
+  if (x <= 2) {
+    return lut[x];
+  }
+  const int16_t interval = MostSignificantBit32(x);
+  lut += 4 * interval - 6;
+  const int16_t frac =
+      ((interval < 11) ? (x << (11 - interval)) : (x >> (interval - 11))) & 0x3FF;
+  int32_t result = (static_cast<int32_t>(lut[2]) * frac) >> 5;
+  result += static_cast<int32_t>(static_cast<uint32_t>(lut[1]) << 5);
+  result *= frac;
+  result = (result + (1 << 14)) >> 15;
+  result += lut[0];
+  return static_cast<int16_t>(result);
+}
+
+uint32_t PcanShrink(uint32_t x) {
+  if (x < (2 << kPcanSnrBits)) {
+    return (x * x) >> (2 + 2 * kPcanSnrBits - kPcanOutputBits);
+  }
+  return (x >> (kPcanSnrBits - kPcanOutputBits)) - (1 << kPcanOutputBits);
+}
+
+uint32_t Log2FractionPart(uint32_t x, uint32_t log2x) {
+  int32_t frac = x - (1LL << log2x);
+  if (log2x < kLogScaleLog2) {
+    frac <<= kLogScaleLog2 - log2x;
+  } else {
+    frac >>= log2x - kLogScaleLog2;
+  }
+  const uint32_t base_seg = frac >> (kLogScaleLog2 - kLogSegmentsLog2);
+  const uint32_t seg_unit = kLogScale >> kLogSegmentsLog2;
+  const int32_t c0 = kLogLut[base_seg];
+  const int32_t c1 = kLogLut[base_seg + 1];
+  const int32_t seg_base = seg_unit * base_seg;
+  const int32_t rel_pos = ((c1 - c0) * (frac - seg_base)) >> kLogScaleLog2;
+  return frac + c0 + rel_pos;
+}
+
+// ln(x) * out_scale, from a fixed-point log2
+uint32_t Log32(uint32_t x, uint32_t out_scale) {
+  const uint32_t integer = MostSignificantBit32(x) - 1;
+  const uint32_t fraction = Log2FractionPart(x, integer);
+  const uint32_t log2 = (integer << kLogScaleLog2) + fraction;
+  const uint32_t round = kLogScale / 2;
+  const uint32_t loge =
+      (static_cast<uint64_t>(kLogCoeff) * log2 + round) >> kLogScaleLog2;
+  return (out_scale * loge + round) >> kLogScaleLog2;
+}
+
+int16_t PcanGainLookup(int32_t input_bits, uint32_t x) {
+  const float x_as_float = static_cast<float>(x) / (static_cast<uint32_t>(1) << input_bits);
+  const float gain_as_float = (static_cast<uint32_t>(1) << kPcanGainBits) *
+                              powf(x_as_float + kPcanOffset, -kPcanStrength);
+  if (gain_as_float > INT16_MAX) {
+    return INT16_MAX;
+  }
+  return static_cast<int16_t>(gain_as_float + 0.5f);
+}
+}  // namespace
+
+AudioFrontend::~AudioFrontend() {
+  heap_caps_free(fft_memory_);
+}
+
+TfLiteStatus AudioFrontend::Init() {
+  if (fft_state_ == nullptr) {
+    const size_t fft_state_size = tflm_signal::RfftInt16GetNeededMemory(kFftSize);
+    fft_memory_ = heap_caps_malloc(fft_state_size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (fft_memory_ == nullptr) {
+      ESP_LOGE(TAG, "Can't allocate %u bytes of FFT state", (unsigned) fft_state_size);
+      return kTfLiteError;
+    }
+    fft_state_ = tflm_signal::RfftInt16Init(kFftSize, fft_memory_, fft_state_size);
+    if (fft_state_ == nullptr) {
+      ESP_LOGE(TAG, "FFT setup failed");
+      return kTfLiteError;
+    }
+
+    // Hann window, in kWindowBits fixed point
+    constexpr double kPi = 3.14159265358979323846;
+    const float arg = kPi * 2.0 / static_cast<float>(kWindowSamples);
+    for (int i = 0; i < kWindowSamples; ++i) {
+      const float value = 0.5 - (0.5 * std::cos(arg * (i + 0.5)));
+      window_table_[i] = std::floor(value * (1 << kWindowBits) + 0.5);
+    }
+
+    input_correction_bits_ = MostSignificantBit32(kFftSize) - 1 - (kFilterbankBits / 2);
+    if (InitFilterbank() != kTfLiteOk) {
+      return kTfLiteError;
+    }
+    even_smoothing_ = kNoiseReductionEvenSmoothing * (1 << kNoiseReductionBits);
+    odd_smoothing_ = kNoiseReductionOddSmoothing * (1 << kNoiseReductionBits);
+    min_signal_remaining_ =
+        kNoiseReductionMinSignalRemaining * (1 << kNoiseReductionBits);
+    InitPcanGainLut();
+  }
+  Reset();
+  return kTfLiteOk;
+}
+
+TfLiteStatus AudioFrontend::InitFilterbank() {
+  // kFeatureSize triangular filters evenly spaced on the mel scale, each from
+  // the previous center to the next one. Every bin in the band is shared by
+  // two filters: the one whose center comes next (weight) and the one after
+  // that (unweight = 1 - weight).
+  constexpr int kChannelsPlus1 = kFeatureSize + 1;
+  float center_mel_freqs[kChannelsPlus1];
+  const float mel_low = FreqToMel(kFilterbankLowerBandLimitHz);
+  const float mel_hi = FreqToMel(kFilterbankUpperBandLimitHz);
+  const float mel_span = mel_hi - mel_low;
+  const float mel_spacing = mel_span / static_cast<float>(kChannelsPlus1);
+  for (int i = 0; i < kChannelsPlus1; ++i) {
+    center_mel_freqs[i] = mel_low + (mel_spacing * (i + 1));
+  }
+
+  // Always exclude DC.
+  const float hz_per_sbin =
+      0.5 * kAudioSampleFrequency / (static_cast<float>(kSpectrumSize) - 1);
+  first_bin_ = 1.5 + kFilterbankLowerBandLimitHz / hz_per_sbin;
+  int bin = first_bin_;
+  for (int chan = 0; chan < kChannelsPlus1; ++chan) {
+    const int chan_start = bin;
+    while (bin < kSpectrumSize &&
+           FreqToMel(bin * hz_per_sbin) <= center_mel_freqs[chan]) {
+      ++bin;
+    }
+    if (bin == kSpectrumSize) {
+      ESP_LOGE(TAG, "Filterbank upper band limit %.0f Hz is past the Nyquist "
+               "frequency", static_cast<double>(kFilterbankUpperBandLimitHz));
+      return kTfLiteError;
+    }
+    const float denom_val = (chan == 0) ? mel_low : center_mel_freqs[chan - 1];
+    for (int i = chan_start; i < bin; ++i) {
+      const float weight = (center_mel_freqs[chan] - FreqToMel(i * hz_per_sbin)) /
+                           (center_mel_freqs[chan] - denom_val);
+      bin_channel_[i] = chan;
+      bin_weight_[i] = std::floor(weight * (1 << kFilterbankBits) + 0.5);
+      bin_unweight_[i] = std::floor((1.0 - weight) * (1 << kFilterbankBits) + 0.5);
+    }
+  }
+  end_bin_ = bin;
+  return kTfLiteOk;
+}
+
+void AudioFrontend::InitPcanGainLut() {
+  const int32_t input_bits = kNoiseReductionSmoothingBits - input_correction_bits_;
+  pcan_snr_shift_ = kPcanGainBits - input_correction_bits_ - kPcanSnrBits;
+  pcan_gain_lut_[0] = PcanGainLookup(input_bits, 0);
+  pcan_gain_lut_[1] = PcanGainLookup(input_bits, 1);
+  // Segment i covers [2^(i-1), 2^i) with a quadratic through its start,
+  // middle and end, stored from index 4 * i - 6.
+  for (int interval = 2; interval <= kWideDynamicFunctionBits; ++interval) {
+    const uint32_t x0 = static_cast<uint32_t>(1) << (interval - 1);
+    const uint32_t x1 = x0 + (x0 >> 1);
+    const uint32_t x2 = (interval == kWideDynamicFunctionBits) ? x0 + (x0 - 1) : 2 * x0;
+
+    const int16_t y0 = PcanGainLookup(input_bits, x0);
+    const int16_t y1 = PcanGainLookup(input_bits, x1);
+    const int16_t y2 = PcanGainLookup(input_bits, x2);
+
+    const int32_t diff1 = static_cast<int32_t>(y1) - y0;
+    const int32_t diff2 = static_cast<int32_t>(y2) - y0;
+    const int32_t a1 = 4 * diff1 - diff2;
+    const int32_t a2 = diff2 - a1;
+
+    int16_t* segment = pcan_gain_lut_ + 4 * interval - 6;
+    segment[0] = y0;
+    segment[1] = static_cast<int16_t>(a1);
+    segment[2] = static_cast<int16_t>(a2);
+  }
+}
+
+void AudioFrontend::Reset() {
+  memset(noise_estimate_, 0, sizeof(noise_estimate_));
+}
+
+void AudioFrontend::AccumulateFilterbank() {
+  memset(filterbank_, 0, sizeof(filterbank_));
+  for (int bin = first_bin_; bin < end_bin_; ++bin) {
+    const int32_t real = spectrum_[bin].real;
+    const int32_t imag = spectrum_[bin].imag;
+    const uint64_t energy = static_cast<uint32_t>(real * real) +
+                            static_cast<uint32_t>(imag * imag);
+    uint64_t* slot = filterbank_ + bin_channel_[bin];
+    slot[0] += static_cast<uint64_t>(bin_weight_[bin]) * energy;
+    slot[1] += static_cast<uint64_t>(bin_unweight_[bin]) * energy;
+  }
+}
+
+void AudioFrontend::Process(const int16_t* window, int8_t* features) {
+  // Window the samples, keeping track of their largest magnitude to scale
+  // them up to the full int16 range before the FFT.
+  int16_t max_abs = 0;
+  for (int i = 0; i < kWindowSamples; ++i) {
+    const int16_t value =
+        (static_cast<int32_t>(window[i]) * window_table_[i]) >> kWindowBits;
+    fft_input_[i] = value;
+    if (value > max_abs) {
+      max_abs = value;
+    } else if (-value > max_abs) {
+      max_abs = static_cast<int16_t>(-value);
+    }
+  }
+  const int scale_bits = std::max(15 - MostSignificantBit32(max_abs), 0);
+  if (scale_bits > 0) {
+    for (int i = 0; i < kWindowSamples; ++i) {
+      fft_input_[i] = fft_input_[i] * (1 << scale_bits);
+    }
+  }
+
+  tflm_signal::RfftInt16Apply(fft_state_, fft_input_, spectrum_);
+  AccumulateFilterbank();
+
+  const uint32_t log_scale = 1 << kLogScaleShift;
+  for (int i = 0; i < kFeatureSize; ++i) {
+    // Filterbank magnitude, with the FFT scaling undone
+    const uint32_t signal = Sqrt64(filterbank_[i + 1]) >> scale_bits;
+
+    // Noise reduction: subtract a running estimate of the noise, smoothed
+    // differently on odd and even channels, keeping at least a fraction of
+    // the signal.
+    const uint32_t smoothing = ((i & 1) == 0) ? even_smoothing_ : odd_smoothing_;
+    const uint32_t one_minus_smoothing = (1 << kNoiseReductionBits) - smoothing;
+    const uint32_t signal_scaled_up = signal << kNoiseReductionSmoothingBits;
+    uint32_t estimate = ((static_cast<uint64_t>(signal_scaled_up) * smoothing) +
+                         (static_cast<uint64_t>(noise_estimate_[i]) * one_minus_smoothing)) >>
+                        kNoiseReductionBits;
+    noise_estimate_[i] = estimate;
+    if (estimate > signal_scaled_up) {
+      estimate = signal_scaled_up;
+    }
+    const uint32_t floor =
+        (static_cast<uint64_t>(signal) * min_signal_remaining_) >> kNoiseReductionBits;
+    const uint32_t subtracted = (signal_scaled_up - estimate) >> kNoiseReductionSmoothingBits;
+    uint32_t value = subtracted > floor ? subtracted : floor;
+
+    // Per-channel automatic gain control against the noise estimate
+    if (kPcanEnabled) {
+      const uint32_t gain = WideDynamicFunction(noise_estimate_[i], pcan_gain_lut_);
+      const uint32_t snr = (static_cast<uint64_t>(value) * gain) >> pcan_snr_shift_;
+      value = PcanShrink(snr);
+    }
+
+    // Log, saturated to int16
+    const uint32_t scaled = value << input_correction_bits_;
+    int32_t log_value = 0;
+    if (scaled > 1) {
+      log_value = std::min(Log32(scaled, log_scale), static_cast<uint32_t>(INT16_MAX));
+    }
+
+    // And the int8 range the classifier was trained with
+    int32_t feature =
+        ((log_value * kFeatureValueScale) + (kFeatureValueDiv / 2)) / kFeatureValueDiv;
+    feature -= 128;
+    features[i] = std::min(std::max(feature, int32_t{-128}), int32_t{127});
+  }
+}
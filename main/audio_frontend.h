@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include "micro_model_settings.h"
+#include "signal/src/complex.h"
+#include "tensorflow/lite/c/common.h"
+
+// Native fixed-point implementation of the audio preprocessor model's
+// frontend: Hann window, FFT auto-scaling, real FFT, energy, mel filterbank,
+// square root, noise reduction, PCAN, log and the int8 feature scaling. It
+// follows the model's integer arithmetic so as to compute the same
+// kFeatureSize features per window, which the pipeline benchmarks check
+// (audio_frontend_vs_preprocessor), but without the interpreter and its tensor
+// copies between ops.
+//
+// Everything that depends only on the parameters is computed once by Init():
+// the window table, the FFT twiddles (TFLM's kissfft, as used by the model's
+// Rfft op), the PCAN gain table and the filterbank weights. The filterbank is
+// stored sparsely, one weight pair per FFT bin it uses, and the energy of each
+// bin is computed where it's accumulated.
+class AudioFrontend {
+ public:
+  static constexpr int kWindowSamples = kFeatureDurationMs * kAudioSampleFrequency / 1000;
+  // The smallest power of two that holds a window
+  static constexpr int kFftSize = 1 << (32 - __builtin_clz(kWindowSamples - 1));
+  static constexpr int kSpectrumSize = kFftSize / 2 + 1;
+  static constexpr int kGainLutSize = 4 * 32 - 3;
+
+  AudioFrontend() = default;
+  ~AudioFrontend();
+  AudioFrontend(const AudioFrontend&) = delete;
+  AudioFrontend& operator=(const AudioFrontend&) = delete;
+
+  // Builds the tables and the FFT state. Calling it again only resets.
+  TfLiteStatus Init();
+  // Forgets the noise estimates, for starting over on a new audio stream.
+  void Reset();
+
+  // Computes the features of one kWindowSamples window, updating the noise
+  // estimates like the model's stateful ops do.
+  void Process(const int16_t* window, int8_t* features);
+
+ private:
+  TfLiteStatus InitFilterbank();
+  void InitPcanGainLut();
+
+  // Spectrum -> kFeatureSize filterbank channels, in filterbank_
+  void AccumulateFilterbank();
+
+  void* fft_memory_ = nullptr;
+  void* fft_state_ = nullptr;
+  int16_t window_table_[kWindowSamples] = {};
+  // Windowed and auto-scaled samples, zero-padded to kFftSize
+  int16_t fft_input_[kFftSize] = {};
+  tflm_signal::Complex<int16_t> spectrum_[kSpectrumSize] = {};
+
+  // FFT bins [first_bin_, end_bin_) contribute to the filterbank: bin b
+  // adds bin_weight_[b] times its energy to filterbank_[bin_channel_[b]] and
+  // bin_unweight_[b] times it to the next slot. Channel c ends up in slot
+  // c + 1; the first and last slots only collect the edges of the band.
+  int first_bin_ = 0;
+  int end_bin_ = 0;
+  uint8_t bin_channel_[kSpectrumSize] = {};
+  int16_t bin_weight_[kSpectrumSize] = {};
+  int16_t bin_unweight_[kSpectrumSize] = {};
+  uint64_t filterbank_[kFeatureSize + 2] = {};
+
+  // Scale of the filterbank output relative to the noise reduction's input
+  int input_correction_bits_ = 0;
+  uint32_t even_smoothing_ = 0;
+  uint32_t odd_smoothing_ = 0;
+  uint32_t min_signal_remaining_ = 0;
+  uint32_t noise_estimate_[kFeatureSize] = {};
+  int16_t pcan_gain_lut_[kGainLutSize] = {};
+  int pcan_snr_shift_ = 0;
+};
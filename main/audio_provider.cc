@@ -17,10 +17,21 @@ NOTICE: This file has been modified from the original version:
 - More recent i2s API from idf
 - Use ES7210 ADC chip
 - Remove unneeded code
+- Capture goes through a pluggable AudioSource, the I2S/ES7210 code now
+  lives in i2s_audio_source.cc
+- Lock-free AudioRing in place of ringbuf.c between capture and features
+- Windows are handed out straight from the ring, without the history copies
+- Capture times are tracked to measure end-to-end latency
+- Several consecutive windows can be read as one span, or skipped
+- Captured blocks can also go to a tap, e.g. the clip recorder's history
+- Ring writes, fill levels and overruns are traced
 ==============================================================================*/
 
 #include "audio_provider.h"
 
+#include <algorithm>
+#include <atomic>
+#include <climits>
 #include <cstring>
 
 // FreeRTOS.h must be included before some of the following dependencies.
@@ -29,202 +40,173 @@ NOTICE: This file has been modified from the original version:
 #include "freertos/FreeRTOS.h"
 // clang-format on
 
-#include <esp_check.h>
-#include "es7210.h"
-#include "driver/i2s_std.h"
 #include "esp_log.h"
-#include "esp_spi_flash.h"
-#include "esp_system.h"
 #include "esp_timer.h"
 #include "freertos/task.h"
-#include "ringbuf.h"
+#include "audio_ring.h"
+#include "audio_source.h"
 #include "micro_model_settings.h"
+#include "pipeline_trace.h"
 
 using namespace std;
 
-// for c2 and c3, I2S support was added from IDF v4.4 onwards
-#define NO_I2S_SUPPORT CONFIG_IDF_TARGET_ESP32C2 || \
-                          (CONFIG_IDF_TARGET_ESP32C3 \
-                          && (ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(4, 4, 0)))
-
 static const char* TAG = "TF_LITE_AUDIO_PROVIDER";
 /* ringbuffer to hold the incoming audio data */
-ringbuf_t* g_audio_capture_buffer;
+AudioRing g_audio_capture_buffer;
 volatile int32_t g_latest_audio_timestamp = 0;
 /* model requires 20ms new data from g_audio_capture_buffer and 10ms old data
- * each time , storing old data in the histrory buffer , {
- * history_samples_to_keep = 10 * 16 } */
-constexpr int32_t history_samples_to_keep =
-    ((kFeatureDurationMs - kFeatureStrideMs) *
-     (kAudioSampleFrequency / 1000));
+ * each time, the ring keeps the old data around for the next window, {
+ * window_samples = 30 * 16 } */
+constexpr int32_t window_samples =
+    (kFeatureDurationMs * (kAudioSampleFrequency / 1000));
 /* new samples to get each time from ringbuffer, { new_samples_to_get =  20 * 16
  * } */
 constexpr int32_t new_samples_to_get =
     (kFeatureStrideMs * (kAudioSampleFrequency / 1000));
 
-const int32_t kAudioCaptureBufferSize = 40000;
-const int32_t i2s_bytes_to_read = 6400;  // 4 bytes per sample: 1600 samples
+/* one second of audio: AudioRing::Init() rounds the ring's capacity up to the
+ * next power of two, which its index masking relies on */
+const int32_t kAudioCaptureBufferSamples = kAudioSampleFrequency;
+/* catch-up spans are read in one piece: as many windows as the ring can
+ * mirror, up to a whole spectrogram. Half of the unrounded size is always
+ * within what the ring allows. */
+constexpr int kAudioSpanMaxWindows =
+    std::min<int>(kFeatureCount,
+                  (kAudioCaptureBufferSamples / 2 - window_samples) / new_samples_to_get + 1);
 
 namespace {
-int16_t g_audio_output_buffer[kMaxAudioSampleSize * 32];
 bool g_is_audio_initialized = false;
-int16_t g_history_buffer[history_samples_to_keep];
-
-#if !NO_I2S_SUPPORT
-uint8_t g_i2s_read_buffer[i2s_bytes_to_read] = {};
-#if CONFIG_IDF_TARGET_ESP32
-i2s_port_t i2s_port = I2S_NUM_1; // for esp32-eye
-#else
-i2s_port_t i2s_port = I2S_NUM_0; // for esp32-s3-eye
-#endif
-#endif
+bool g_is_capture_buffer_allocated = false;
+AudioSource* g_audio_source = nullptr;
+volatile bool g_audio_source_finished = false;
+AudioCaptureTap g_capture_tap = nullptr;
+// esp_timer time at which audio time zero was captured: the earliest block
+// arrival time minus the audio captured up to that block
+std::atomic<int64_t> g_capture_origin_us{INT64_MAX};
 }  // namespace
 
 
-static int es7210_codec_init() {
-    ESP_LOGI(TAG, "Init I2C used to configure ES7210");
-    i2c_config_t i2c_conf = {
-        .mode = I2C_MODE_MASTER,
-        .sda_io_num = GPIO_NUM_17,
-        .scl_io_num = GPIO_NUM_18,
-        .sda_pullup_en = GPIO_PULLUP_ENABLE,
-        .scl_pullup_en = GPIO_PULLUP_ENABLE,
-        .master = {
-            .clk_speed = 100000,
-        }
-    };
-    ESP_RETURN_ON_ERROR(i2c_param_config(I2C_NUM_0, &i2c_conf), TAG, "Failed to configure I2C parameters");
-    ESP_RETURN_ON_ERROR(i2c_driver_install(I2C_NUM_0, i2c_conf.mode, 0, 0, 0), TAG, "Failed to install I2C driver");
-
-    /* Create ES7210 device handle */
-    es7210_dev_handle_t es7210_handle = nullptr;
-    es7210_i2c_config_t es7210_i2c_conf = {
-        .i2c_port = I2C_NUM_0,
-        .i2c_addr = 0x40
-    };
-    ESP_RETURN_ON_ERROR(es7210_new_codec(&es7210_i2c_conf, &es7210_handle), TAG, "Failed to instantiate codec.");
+// Moves one block of audio from the source into the ring buffer. Returns false
+// once the source is exhausted. A read error is retried with the next block
+// on a real-time source, and ends the audio of an offline one, which would
+// otherwise be read again and again for nothing.
+static bool CaptureBlock() {
+  int samples_read = 0;
+  int16_t* samples = nullptr;
+  const TfLiteStatus read_status = g_audio_source->Read(&samples_read, &samples);
+  if (read_status != kTfLiteOk && g_audio_source->IsRealTime()) {
+    return true;
+  }
+  if (read_status != kTfLiteOk || samples_read == 0) {
+    if (read_status != kTfLiteOk) {
+      ESP_LOGE(TAG, "Audio source read failed, ending the audio here");
+    } else {
+      ESP_LOGI(TAG, "Audio source exhausted");
+    }
+    g_audio_source_finished = true;
+    g_audio_capture_buffer.SignalWriterFinished();
+    return false;
+  }
 
-    ESP_LOGI(TAG, "Configure ES7210 codec parameters");
-    es7210_codec_config_t codec_conf = {
-        .sample_rate_hz = 16000,
-        .mclk_ratio = I2S_MCLK_MULTIPLE_256,
-        .i2s_format = ES7210_I2S_FMT_I2S,
-        .bit_width = (es7210_i2s_bits_t)(I2S_DATA_BIT_WIDTH_32BIT),
-        .mic_bias = ES7210_MIC_BIAS_2V87,
-        .mic_gain = ES7210_MIC_GAIN_33DB,
-        .flags = {
-            .tdm_enable = true
-        }
-    };
-    ESP_RETURN_ON_ERROR(es7210_config_codec(es7210_handle, &codec_conf), TAG, "Failed to config codec");
-    ESP_RETURN_ON_ERROR(es7210_config_volume(es7210_handle, 0), TAG, "Failed to config volume");
-    return ESP_OK;
+  /* write samples read from the source into ring buffer */
+  int samples_written = 0;
+  {
+    TRACE_STAGE(kRingWrite);
+    samples_written = g_audio_capture_buffer.Write(samples, samples_read,
+                                                   pdMS_TO_TICKS(100));
+  }
+  TraceRingFill(TraceRing::kCapture, g_audio_capture_buffer.Filled(),
+                g_audio_capture_buffer.Capacity());
+  if (samples_written < samples_read) {
+    TraceRingOverrun(TraceRing::kCapture, samples_read - std::max(samples_written, 0));
+  }
+  /* update the timestamp (in ms) to let the model know that new data has
+   * arrived */
+  g_latest_audio_timestamp = g_latest_audio_timestamp +
+      ((1000 * samples_written) / kAudioSampleFrequency);
+  if (g_capture_tap != nullptr && samples_written > 0) {
+    g_capture_tap(samples, samples_written);
+  }
+  const int64_t origin_us = esp_timer_get_time() -
+      int64_t{g_latest_audio_timestamp} * 1000;
+  if (origin_us < g_capture_origin_us.load(std::memory_order_relaxed)) {
+    g_capture_origin_us.store(origin_us, std::memory_order_relaxed);
+  }
+  if (samples_written <= 0) {
+    ESP_LOGE(TAG, "Ring Buffer full, dropped %d samples", samples_read);
+  } else if (samples_written < samples_read) {
+    ESP_LOGW(TAG, "Partial Write: dropped %d samples", samples_read - samples_written);
+  }
+  return true;
 }
 
-static int i2s_init(i2s_chan_handle_t &rx_handle) {
-  // Start listening for audio: MONO @ 16KHz
-  i2s_std_config_t std_config = {
-    .clk_cfg = {
-      .sample_rate_hz = 16000,
-        .clk_src = I2S_CLK_SRC_DEFAULT,
-      .mclk_multiple = I2S_MCLK_MULTIPLE_256,
-    },
-    .slot_cfg = {
-      .data_bit_width = I2S_DATA_BIT_WIDTH_32BIT,
-      .slot_bit_width = I2S_SLOT_BIT_WIDTH_AUTO,
-      .slot_mode = I2S_SLOT_MODE_MONO,
-      .slot_mask = I2S_STD_SLOT_LEFT,
-      .ws_width = I2S_DATA_BIT_WIDTH_32BIT,  // TODO: THIS MUST BE THE SAME AS DATA BIT WIDTH
-      .ws_pol = false,
-      .bit_shift = true,
-      .left_align = true,
-      .big_endian = false,
-      .bit_order_lsb = false
-    },
-    .gpio_cfg = {
-        .mclk = GPIO_NUM_16,
-        .bclk = GPIO_NUM_9,
-        .ws = GPIO_NUM_45,
-        .dout = I2S_GPIO_UNUSED,
-        .din = GPIO_NUM_10,
-        .invert_flags = {
-          .mclk_inv = false,
-          .bclk_inv = false,
-          .ws_inv = false,
-        }
-    }
-  };
-  i2s_chan_config_t chan_config = {
-      .id = i2s_port,
-      .role = I2S_ROLE_MASTER,
-      .dma_desc_num = 512,
-      .dma_frame_num = 8,
-      .auto_clear = false
-  };
-  ESP_RETURN_ON_ERROR(i2s_new_channel(&chan_config, nullptr, &rx_handle), TAG, "Couldn't create new channel");
-  ESP_RETURN_ON_ERROR(i2s_channel_init_std_mode(rx_handle, &std_config), TAG, "Couldn't init i2s mode");
-  ESP_RETURN_ON_ERROR(i2s_channel_enable(rx_handle), TAG, "Couldn't enable channel");
-  ESP_LOGI(TAG, "I2S initialized");
-  return ESP_OK;
+// Offline sources have no capture task: make sure samples are buffered by
+// reading them on the calling thread, as fast as they go.
+static void TopUpFromOfflineSource(size_t samples) {
+  while (!g_audio_source_finished &&
+         g_audio_capture_buffer.Filled() < samples) {
+    CaptureBlock();
+  }
 }
 
-
 static void CaptureSamples(void* arg) {
-  if (es7210_codec_init() != ESP_OK) {
-    ESP_LOGE(TAG, "Can't configure ADC");
+  if (g_audio_source->Start() != kTfLiteOk) {
+    ESP_LOGE(TAG, "Can't start audio source");
     return;
   }
-
-  size_t bytes_read = i2s_bytes_to_read;
-  i2s_chan_handle_t rx_handle;
-  if (i2s_init(rx_handle) != ESP_OK) {
-    ESP_LOGE(TAG, "No i2s RX handle");
-    return;
+  while (CaptureBlock()) {
   }
-  while (true) {
-    /* read 100ms data at once from i2s */
-    i2s_channel_read(rx_handle, (void*)g_i2s_read_buffer, i2s_bytes_to_read,
-             &bytes_read, 100);
+  vTaskDelete(nullptr);
+}
 
-    if (bytes_read <= 0) {
-      ESP_LOGE(TAG, "Error in I2S read : %d", bytes_read);
-    } else {
-      if (bytes_read < i2s_bytes_to_read) {
-        ESP_LOGW(TAG, "Partial I2S read");
-      }
-      // rescale the data
-      for (int i = 0; i < bytes_read / 4; ++i) {
-        ((int16_t *) g_i2s_read_buffer)[i] = ((int32_t *) g_i2s_read_buffer)[i] >> 16;
-      }
+void SetAudioSource(AudioSource* source) {
+  g_audio_source = source;
+  if (g_is_audio_initialized) {
+    // Only offline sources can be swapped: start over on the new one.
+    g_audio_capture_buffer.Reset();
+    g_latest_audio_timestamp = 0;
+    g_capture_origin_us = INT64_MAX;
+    g_audio_source_finished = false;
+    g_is_audio_initialized = false;
+  }
+}
 
-      bytes_read = bytes_read / 2;
+void SetAudioCaptureTap(AudioCaptureTap tap) { g_capture_tap = tap; }
 
-      /* write bytes read by i2s into ring buffer */
-      int bytes_written = rb_write(g_audio_capture_buffer,
-                                   (uint8_t*)g_i2s_read_buffer, bytes_read, pdMS_TO_TICKS(100));
-      if (bytes_written != bytes_read) {
-        ESP_LOGI(TAG, "Could only write %d bytes out of %d", bytes_written, bytes_read);
-      }
-      /* update the timestamp (in ms) to let the model know that new data has
-       * arrived */
-      g_latest_audio_timestamp = g_latest_audio_timestamp +
-          ((1000 * (bytes_written / 2)) / kAudioSampleFrequency);
-      if (bytes_written <= 0) {
-        ESP_LOGE(TAG, "Could Not Write in Ring Buffer: %d ", bytes_written);
-      } else if (bytes_written < bytes_read) {
-        ESP_LOGW(TAG, "Partial Write");
-      }
-    }
+bool AudioSourceExhausted() {
+  if (g_is_audio_initialized && !g_audio_source->IsRealTime()) {
+    TopUpFromOfflineSource(window_samples);
   }
-  vTaskDelete(nullptr);
+  // Filled() counts the overlap with the last window read, so this is true
+  // exactly when GetAudioSpan() has no complete window left to hand out.
+  return g_audio_source_finished &&
+      g_audio_capture_buffer.Filled() < window_samples;
+}
+
+int64_t AudioCaptureTimeUs(int32_t audio_ms) {
+  const int64_t origin_us = g_capture_origin_us.load(std::memory_order_relaxed);
+  return origin_us == INT64_MAX ? -1 : origin_us + int64_t{audio_ms} * 1000;
 }
 
+AudioRing::Stats AudioCaptureStats() { return g_audio_capture_buffer.GetStats(); }
+
 TfLiteStatus InitAudioRecording() {
-  g_audio_capture_buffer = rb_init("tf_ringbuffer", kAudioCaptureBufferSize);
-  if (!g_audio_capture_buffer) {
-    ESP_LOGE(TAG, "Error creating ring buffer");
+  if (g_audio_source == nullptr) {
+    ESP_LOGE(TAG, "No audio source set");
     return kTfLiteError;
   }
+  if (!g_is_capture_buffer_allocated) {
+    if (g_audio_capture_buffer.Init(kAudioCaptureBufferSamples, window_samples,
+                                    new_samples_to_get, kAudioSpanMaxWindows) != kTfLiteOk) {
+      ESP_LOGE(TAG, "Error creating ring buffer");
+      return kTfLiteError;
+    }
+    g_is_capture_buffer_allocated = true;
+  }
+  if (!g_audio_source->IsRealTime()) {
+    // Offline sources are pulled by GetAudioSpan() itself, no capture task.
+    return g_audio_source->Start();
+  }
   /* create CaptureSamples Task which will get the i2s_data from mic and fill it
    * in the ring buffer */
   xTaskCreatePinnedToCore(CaptureSamples, "CaptureSamples", 1024 * 4, nullptr, 23, nullptr, 0);
@@ -236,7 +218,7 @@ TfLiteStatus InitAudioRecording() {
 }
 
 
-TfLiteStatus GetAudioSamples(int* audio_samples_size, int16_t** audio_samples) {
+TfLiteStatus StartAudioRecording() {
   if (!g_is_audio_initialized) {
     TfLiteStatus init_status = InitAudioRecording();
     if (init_status != kTfLiteOk) {
@@ -244,35 +226,39 @@ TfLiteStatus GetAudioSamples(int* audio_samples_size, int16_t** audio_samples) {
     }
     g_is_audio_initialized = true;
   }
+  return kTfLiteOk;
+}
 
-  // We're doing sliding windows, so read one stride worth of samples and get
-  // the rest of the window from history.
-  // History first
-  memcpy((void*)(g_audio_output_buffer), (void*)(g_history_buffer),
-         history_samples_to_keep * sizeof(int16_t));
-  // Then new samples
-  int bytes_read =
-      rb_read(g_audio_capture_buffer,
-              ((uint8_t*)(g_audio_output_buffer + history_samples_to_keep)),
-              new_samples_to_get * sizeof(int16_t), pdMS_TO_TICKS(200));
-  if (bytes_read < 0) {
-    ESP_LOGE(TAG, " Model Could not read data from Ring Buffer");
-  } else if (bytes_read < new_samples_to_get * sizeof(int16_t)) {
-    ESP_LOGD(TAG, "RB FILLED RIGHT NOW IS %d",
-             rb_filled(g_audio_capture_buffer));
-    ESP_LOGD(TAG, " Partial Read of Data by Model ");
-    ESP_LOGV(TAG, " Could only read %d bytes when required %d bytes ",
-             bytes_read, (int) (new_samples_to_get * sizeof(int16_t)));
+TfLiteStatus GetAudioSpan(int max_windows, int* windows, const int16_t** audio_samples) {
+  TF_LITE_ENSURE_STATUS(StartAudioRecording());
+
+  const int windows_wanted = std::min(max_windows, kAudioSpanMaxWindows);
+  if (!g_audio_source->IsRealTime()) {
+    TopUpFromOfflineSource(window_samples + (windows_wanted - 1) * new_samples_to_get);
   }
 
-  // update history with the new samples we read
-  memcpy((void*)(g_history_buffer),
-         (void*)(g_audio_output_buffer + new_samples_to_get),
-         history_samples_to_keep * sizeof(int16_t));
+  // We're doing sliding windows: the ring hands out the next windows in
+  // place, each one stride of new samples after the overlap with the previous.
+  int windows_read = g_audio_capture_buffer.ReadSpan(audio_samples, windows_wanted,
+                                                     pdMS_TO_TICKS(200));
+  if (windows_read == AudioRing::kWriterFinished) {
+    ESP_LOGD(TAG, " Audio source exhausted, no more data in Ring Buffer");
+    windows_read = 0;
+  } else if (windows_read < windows_wanted) {
+    ESP_LOGD(TAG, " Partial Read of Data by Model ");
+    ESP_LOGV(TAG, " Could only read %d windows when required %d windows ",
+             windows_read, windows_wanted);
+  }
 
-  *audio_samples_size = kMaxAudioSampleSize;
-  *audio_samples = g_audio_output_buffer;
+  *windows = windows_read;
   return kTfLiteOk;
 }
 
+int SkipAudioWindows(int n) {
+  if (!g_is_audio_initialized) {
+    return 0;
+  }
+  return g_audio_capture_buffer.SkipWindows(n);
+}
+
 int32_t LatestAudioTimestamp() { return g_latest_audio_timestamp; }
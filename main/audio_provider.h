@@ -17,6 +17,34 @@ limitations under the License.
 #define TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_AUDIO_PROVIDER_H_
 
 #include "tensorflow/lite/c/common.h"
+#include "audio_ring.h"
+
+class AudioSource;
+
+// Selects where the capture task takes its audio from: the board's
+// microphones, or a file or generator on the host build. Must be called
+// before the first GetAudioSpan() call.
+void SetAudioSource(AudioSource* source);
+
+// Gets every block of samples the capture task puts in the ring buffer, in
+// order and on the capture task, right after it's written: it must not block.
+// Meant to keep a longer history of the audio (see ClipRecorder). Set it
+// before recording starts; null turns it off.
+typedef void (*AudioCaptureTap)(const int16_t* samples, int n);
+void SetAudioCaptureTap(AudioCaptureTap tap);
+
+// True once the audio source has run out and GetAudioSpan() has handed out
+// every complete window of what it produced. The microphone never runs out.
+bool AudioSourceExhausted();
+
+// esp_timer time, in microseconds, at which the audio at audio_ms (as counted
+// by LatestAudioTimestamp()) was captured, estimated from the arrival times of
+// the capture blocks. -1 before the first block.
+int64_t AudioCaptureTimeUs(int32_t audio_ms);
+
+// Overrun/underrun counters and high-water mark of the ring buffer between
+// the capture task and GetAudioSpan().
+AudioRing::Stats AudioCaptureStats();
 
 // This is an abstraction around an audio source like a microphone, and is
 // expected to return 16-bit PCM sample data for a given point in time. The
@@ -25,10 +53,22 @@ limitations under the License.
 // be overwritten by new data in the future. In practice, implementations should
 // ensure that there's a reasonable time allowed for clients to access the data
 // before any reuse.
-// The reference implementation can have no platform-specific dependencies, so
-// it just returns an array filled with zeros. For real applications, you should
-// ensure there's a specialized implementation that accesses hardware APIs.
-TfLiteStatus GetAudioSamples(int* audio_samples_size, int16_t** audio_samples);
+// Starts capturing from the audio source, if that hasn't happened yet. The
+// first GetAudioSpan() call does it otherwise.
+TfLiteStatus StartAudioRecording();
+
+// Each call returns up to max_windows consecutive kFeatureDurationMs windows,
+// the first one kFeatureStrideMs stride after the last window of the previous
+// call, as one contiguous span of (*windows - 1) strides plus a window. It
+// points into the capture ring buffer and stays valid until the next call.
+// Fewer windows come back when the ring can't hold that many in one piece, on
+// timeout, or at the end of the audio (none once it's exhausted). Windows
+// are always complete: the end of the audio short of one is dropped.
+TfLiteStatus GetAudioSpan(int max_windows, int* windows, const int16_t** audio_samples);
+
+// Drops up to n windows' worth of buffered audio, without waiting, as if they
+// had been read by GetAudioSpan(). Returns how many were dropped.
+int SkipAudioWindows(int n);
 
 // Returns the time that audio data was last captured in milliseconds. There's
 // no contract about what time zero represents, the accuracy, or the granularity
@@ -0,0 +1,240 @@
+#include "audio_ring.h"
+
+#include <algorithm>
+#include <cstring>
+#include "esp_heap_caps.h"
+#include "sdkconfig.h"
+
+AudioRing::~AudioRing() {
+  heap_caps_free(buffer_);
+}
+
+TfLiteStatus AudioRing::Init(size_t min_capacity, int window_samples, int window_stride,
+                             int max_span_windows) {
+  uint32_t capacity = 1;
+  while (capacity < min_capacity) {
+    capacity <<= 1;
+  }
+  if (window_samples < 0 || window_stride < 0 || window_stride > window_samples ||
+      max_span_windows < 1) {
+    return kTfLiteError;
+  }
+  const uint32_t mirror = window_samples + (max_span_windows - 1) * window_stride;
+  if (mirror > capacity / 2) {
+    return kTfLiteError;
+  }
+  window_ = window_samples;
+  stride_ = window_stride;
+  mirror_ = mirror;
+  max_span_windows_ = max_span_windows;
+#if (CONFIG_SPIRAM_SUPPORT && \
+     (CONFIG_SPIRAM_USE_CAPS_ALLOC || CONFIG_SPIRAM_USE_MALLOC))
+  buffer_ = (int16_t*)heap_caps_calloc(capacity + mirror_, sizeof(int16_t),
+                                       MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#else
+  buffer_ = (int16_t*)heap_caps_calloc(capacity + mirror_, sizeof(int16_t),
+                                       MALLOC_CAP_8BIT);
+#endif
+  if (buffer_ == nullptr) {
+    return kTfLiteError;
+  }
+  mask_ = capacity - 1;
+  Reset();
+  return kTfLiteOk;
+}
+
+void AudioRing::CopyIn(uint32_t head, const int16_t* samples, uint32_t count) {
+  const uint32_t start = head & mask_;
+  const uint32_t first = std::min<uint32_t>(count, Capacity() - start);
+  memcpy(buffer_ + start, samples, first * sizeof(int16_t));
+  memcpy(buffer_, samples + first, (count - first) * sizeof(int16_t));
+  if (mirror_ == 0) {
+    return;
+  }
+  // Whatever landed in the first mirror_ samples also goes to the mirror.
+  if (start < mirror_) {
+    memcpy(buffer_ + Capacity() + start, samples,
+           std::min(first, mirror_ - start) * sizeof(int16_t));
+  }
+  if (first < count) {
+    memcpy(buffer_ + Capacity(), samples + first,
+           std::min(count - first, mirror_) * sizeof(int16_t));
+  }
+}
+
+int AudioRing::Write(const int16_t* samples, int n, TickType_t ticks_to_wait) {
+  const uint32_t head = head_.load(std::memory_order_relaxed);
+  // The strides ReadWindow() or ReadSpan() released last are still part of
+  // what they handed out, keep off them. held_ is stored before tail_, so
+  // it's at least as recent as the tail loaded first.
+  auto space = [this, head] {
+    const uint32_t tail = tail_.load(std::memory_order_acquire);
+    return Capacity() - held_.load(std::memory_order_relaxed) - (head - tail);
+  };
+  if (space() < static_cast<size_t>(n)) {
+    writer_waits_.fetch_add(1, std::memory_order_relaxed);
+    writer_waiter_.Wait([&] { return space() >= static_cast<size_t>(n); },
+                        ticks_to_wait);
+  }
+  const uint32_t count = std::min<size_t>(space(), n);
+  CopyIn(head, samples, count);
+  head_.store(head + count, std::memory_order_release);
+  reader_waiter_.Wake();
+
+  const uint32_t filled = head + count - tail_.load(std::memory_order_relaxed);
+  if (filled > high_water_.load(std::memory_order_relaxed)) {
+    high_water_.store(filled, std::memory_order_relaxed);
+  }
+  if (count < static_cast<uint32_t>(n)) {
+    overruns_.fetch_add(1, std::memory_order_relaxed);
+    dropped_samples_.fetch_add(n - count, std::memory_order_relaxed);
+  }
+  return count;
+}
+
+void AudioRing::SignalWriterFinished() {
+  writer_finished_.store(true, std::memory_order_release);
+  reader_waiter_.Wake();
+}
+
+int AudioRing::Read(int16_t* samples, int n, TickType_t ticks_to_wait) {
+  const uint32_t tail = tail_.load(std::memory_order_relaxed);
+  auto available = [this, tail] {
+    return head_.load(std::memory_order_acquire) - tail;
+  };
+  if (available() < static_cast<uint32_t>(n) && !IsWriterFinished()) {
+    reader_waits_.fetch_add(1, std::memory_order_relaxed);
+    reader_waiter_.Wait([&] {
+      return available() >= static_cast<uint32_t>(n) || IsWriterFinished();
+    }, ticks_to_wait);
+  }
+  // Everything written before the writer finished is visible once we've seen
+  // the flag, so check it first.
+  const bool finished = IsWriterFinished();
+  const uint32_t count = std::min<uint32_t>(available(), n);
+  if (count == 0 && finished) {
+    return kWriterFinished;
+  }
+  const uint32_t start = tail & mask_;
+  const uint32_t first = std::min<uint32_t>(count, Capacity() - start);
+  memcpy(samples, buffer_ + start, first * sizeof(int16_t));
+  memcpy(samples + first, buffer_, (count - first) * sizeof(int16_t));
+  tail_.store(tail + count, std::memory_order_release);
+  writer_waiter_.Wake();
+
+  if (count < static_cast<uint32_t>(n) && !finished) {
+    underruns_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return count;
+}
+
+void AudioRing::WaitForSamples(uint32_t tail, uint32_t n, TickType_t ticks_to_wait) {
+  auto available = [this, tail] {
+    return head_.load(std::memory_order_acquire) - tail;
+  };
+  if (available() < n && !IsWriterFinished()) {
+    reader_waits_.fetch_add(1, std::memory_order_relaxed);
+    reader_waiter_.Wait([&] {
+      return available() >= n || IsWriterFinished();
+    }, ticks_to_wait);
+  }
+}
+
+void AudioRing::Release(uint32_t tail, uint32_t advance, uint32_t held) {
+  held_.store(held, std::memory_order_relaxed);
+  tail_.store(tail + advance, std::memory_order_release);
+  writer_waiter_.Wake();
+}
+
+int AudioRing::ReadWindow(const int16_t** window, TickType_t ticks_to_wait) {
+  const uint32_t tail = tail_.load(std::memory_order_relaxed);
+  WaitForSamples(tail, window_, ticks_to_wait);
+  const bool finished = IsWriterFinished();
+  const uint32_t count = std::min<uint32_t>(head_.load(std::memory_order_acquire) - tail,
+                                            window_);
+  const uint32_t overlap = window_ - stride_;
+  *window = buffer_ + (tail & mask_);
+  if (count <= overlap && finished) {
+    return kWriterFinished;
+  }
+  // Only slide past new samples: after a short read the overlap the next
+  // window needs is still in place.
+  const uint32_t advance = count > overlap ? std::min(count - overlap, stride_) : 0;
+  Release(tail, advance, advance);
+
+  if (count < window_ && !finished) {
+    underruns_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return count;
+}
+
+int AudioRing::ReadSpan(const int16_t** span, int max_windows, TickType_t ticks_to_wait) {
+  const uint32_t tail = tail_.load(std::memory_order_relaxed);
+  const uint32_t windows_wanted = std::clamp(max_windows, 1, max_span_windows_);
+  const uint32_t overlap = window_ - stride_;
+  const uint32_t wanted = overlap + windows_wanted * stride_;
+  WaitForSamples(tail, wanted, ticks_to_wait);
+  const bool finished = IsWriterFinished();
+  const uint32_t count = std::min<uint32_t>(head_.load(std::memory_order_acquire) - tail,
+                                            wanted);
+  *span = buffer_ + (tail & mask_);
+  // Complete windows only: at the end of the audio, the samples short of
+  // one more window are dropped.
+  const uint32_t new_samples = count > overlap ? count - overlap : 0;
+  const uint32_t windows = new_samples / stride_;
+  if (windows == 0 && finished) {
+    return kWriterFinished;
+  }
+  Release(tail, windows * stride_, windows * stride_);
+
+  if (windows < windows_wanted && !finished) {
+    underruns_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return windows;
+}
+
+int AudioRing::SkipWindows(int n) {
+  const uint32_t tail = tail_.load(std::memory_order_relaxed);
+  const uint32_t available = head_.load(std::memory_order_acquire) - tail;
+  const uint32_t overlap = window_ - stride_;
+  if (n <= 0 || available <= overlap) {
+    return 0;
+  }
+  const uint32_t windows = std::min<uint32_t>(n, (available - overlap) / stride_);
+  Release(tail, windows * stride_, 0);
+  return windows;
+}
+
+size_t AudioRing::Filled() const {
+  const uint32_t tail = tail_.load(std::memory_order_acquire);
+  return head_.load(std::memory_order_acquire) - tail;
+}
+
+void AudioRing::Reset() {
+  const uint32_t overlap = window_ - stride_;
+  memset(buffer_, 0, overlap * sizeof(int16_t));
+  memset(buffer_ + Capacity(), 0, overlap * sizeof(int16_t));
+  head_.store(overlap, std::memory_order_relaxed);
+  tail_.store(0, std::memory_order_relaxed);
+  held_.store(0, std::memory_order_relaxed);
+  reader_waiter_.Reset();
+  writer_waiter_.Reset();
+  writer_finished_.store(false, std::memory_order_relaxed);
+  overruns_.store(0, std::memory_order_relaxed);
+  dropped_samples_.store(0, std::memory_order_relaxed);
+  underruns_.store(0, std::memory_order_relaxed);
+  writer_waits_.store(0, std::memory_order_relaxed);
+  reader_waits_.store(0, std::memory_order_relaxed);
+  high_water_.store(0, std::memory_order_release);
+}
+
+AudioRing::Stats AudioRing::GetStats() const {
+  return {
+      overruns_.load(std::memory_order_relaxed),
+      dropped_samples_.load(std::memory_order_relaxed),
+      underruns_.load(std::memory_order_relaxed),
+      writer_waits_.load(std::memory_order_relaxed),
+      reader_waits_.load(std::memory_order_relaxed),
+      high_water_.load(std::memory_order_relaxed),
+  };
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "freertos/FreeRTOS.h"
+#include "task_waiter.h"
+#include "tensorflow/lite/c/common.h"
+
+// Lock-free ring of 16-bit samples between exactly one producer task (the
+// capture task) and one consumer task (the feature task). Each side owns one
+// free-running index; the capacity is a power of two so that positions are
+// just masked. A task only blocks, on its task notification, when the ring is
+// too empty to read from or too full to write to.
+//
+// The consumer either copies samples out with Read(), or, for a ring set up
+// with a window, gets sliding windows over the ring itself with
+// ReadWindow(), or several consecutive windows at once with ReadSpan(). For
+// that the start of the buffer, as long as the longest span, is mirrored past
+// its end, so that any window or span is contiguous in memory.
+class AudioRing {
+ public:
+  // Returned by Read() once SignalWriterFinished() was called and everything
+  // written before has been read.
+  static constexpr int kWriterFinished = -2;
+
+  struct Stats {
+    uint32_t overruns;         // Write() calls that had to drop samples
+    uint32_t dropped_samples;  // samples dropped by those calls
+    uint32_t underruns;        // Read() calls that returned short
+    uint32_t writer_waits;     // times the producer blocked on a full ring
+    uint32_t reader_waits;     // times the consumer blocked on an empty ring
+    uint32_t high_water;       // most samples ever buffered at once
+  };
+
+  AudioRing() = default;
+  ~AudioRing();
+
+  // Allocates room for at least min_capacity samples (in PSRAM when there is
+  // some), rounded up to a power of two. ReadWindow() needs window_samples
+  // and window_stride, the window length and how far it slides per call;
+  // ReadSpan() can return up to max_span_windows of them at once.
+  TfLiteStatus Init(size_t min_capacity, int window_samples = 0, int window_stride = 0,
+                    int max_span_windows = 1);
+
+  // Producer side. Copies up to n samples in, waiting up to ticks_to_wait for
+  // room, and returns how many were written; the rest are dropped and counted
+  // as an overrun.
+  int Write(const int16_t* samples, int n, TickType_t ticks_to_wait);
+  // No more writes will come: wakes the consumer up so it drains the ring.
+  void SignalWriterFinished();
+
+  // Consumer side. Waits up to ticks_to_wait for n samples and copies them
+  // out. Returns the number of samples read, fewer on timeout or once the
+  // writer is finished, or kWriterFinished when there's nothing left at all.
+  int Read(int16_t* samples, int n, TickType_t ticks_to_wait);
+  // Consumer side, for rings with a window. Waits up to ticks_to_wait for a
+  // full window past the read position, points window at it (in the ring, no
+  // copy) and slides the read position one stride forward. The window stays
+  // valid until the next call: the producer never writes over the stride
+  // released last. Returns the number of valid samples in the window, fewer
+  // on timeout, or kWriterFinished when the writer is done and there's no
+  // new sample left. Don't mix with Read().
+  int ReadWindow(const int16_t** window, TickType_t ticks_to_wait);
+  // Like ReadWindow(), for up to max_windows consecutive windows at once:
+  // waits up to ticks_to_wait for them, points span at the samples they cover,
+  // (windows - 1) strides plus a window, and slides the read position past
+  // all of them. Returns the number of windows in the span, fewer on timeout
+  // or at the end of the audio, or kWriterFinished once the writer is done
+  // and there isn't a complete window left: the samples short of one are
+  // never handed out. The span stays valid until the next call.
+  int ReadSpan(const int16_t** span, int max_windows, TickType_t ticks_to_wait);
+  // Drops up to n windows' strides of buffered samples without waiting, as if
+  // they had been read, and returns how many were dropped.
+  int SkipWindows(int n);
+  int MaxSpanWindows() const { return max_span_windows_; }
+
+  // Samples currently buffered, including the overlap a window keeps from the
+  // previous one. Exact from either side, a snapshot otherwise.
+  size_t Filled() const;
+  size_t Capacity() const { return mask_ + 1; }
+  bool IsWriterFinished() const { return writer_finished_.load(std::memory_order_acquire); }
+
+  // Empties the ring and clears the counters. A ring with a window starts
+  // over with window_samples - window_stride samples of silence, so the first
+  // window is complete after a single stride. Only safe while neither side is
+  // using it.
+  void Reset();
+
+  Stats GetStats() const;
+
+ private:
+  // Copies count samples in at position head, wrapping around and keeping the
+  // mirror in sync.
+  void CopyIn(uint32_t head, const int16_t* samples, uint32_t count);
+  // Waits up to ticks_to_wait for at least n samples past tail, or the end of
+  // the audio.
+  void WaitForSamples(uint32_t tail, uint32_t n, TickType_t ticks_to_wait);
+  // Moves the read position to tail + advance, keeping the held samples
+  // before it off limits to the producer.
+  void Release(uint32_t tail, uint32_t advance, uint32_t held);
+
+  int16_t* buffer_ = nullptr;  // Capacity() + mirror_ samples
+  uint32_t mask_ = 0;
+  uint32_t window_ = 0;
+  uint32_t stride_ = 0;
+  uint32_t mirror_ = 0;
+  int max_span_windows_ = 1;
+  // Written by the producer only. On its own cache line so the consumer's
+  // index updates don't keep invalidating it.
+  alignas(64) std::atomic<uint32_t> head_{0};
+  alignas(64) std::atomic<uint32_t> tail_{0};  // written by the consumer only
+  // Samples right before tail_ that the last window or span handed out still
+  // covers. Written by the consumer, before tail_.
+  std::atomic<uint32_t> held_{0};
+  alignas(64) TaskWaiter reader_waiter_;
+  TaskWaiter writer_waiter_;
+  std::atomic<bool> writer_finished_{false};
+
+  // Each counter has a single writer; relaxed atomics keep snapshots from
+  // other tasks well defined.
+  std::atomic<uint32_t> overruns_{0};
+  std::atomic<uint32_t> dropped_samples_{0};
+  std::atomic<uint32_t> underruns_{0};
+  std::atomic<uint32_t> writer_waits_{0};
+  std::atomic<uint32_t> reader_waits_{0};
+  std::atomic<uint32_t> high_water_{0};
+};
@@ -0,0 +1,24 @@
+#pragma once
+#include "tensorflow/lite/c/common.h"
+
+// Where CaptureSamples() takes its audio from: the board's microphones, a WAV
+// file, or a synthetic generator on the host build. Sources hand out 16-bit
+// mono PCM at kAudioSampleFrequency, in blocks of whatever size suits them.
+class AudioSource {
+ public:
+  virtual ~AudioSource() = default;
+
+  // Prepares the source (hardware setup, opening files, ...). Called once,
+  // before the first Read().
+  virtual TfLiteStatus Start() = 0;
+
+  // Blocks until the next block of samples is available and points samples
+  // at it. The block is owned by the source and stays valid until the next
+  // call. An exhausted source returns kTfLiteOk with a samples_size of 0.
+  virtual TfLiteStatus Read(int* samples_size, int16_t** samples) = 0;
+
+  // Real-time sources deliver audio at the wall-clock rate and get their own
+  // capture task. The others (e.g. files processed offline) are read on
+  // demand by GetAudioSpan(), as fast as they can be decoded.
+  virtual bool IsRealTime() const { return true; }
+};
@@ -0,0 +1,75 @@
+#include "benchmark.h"
+
+#include <algorithm>
+
+#if defined(ESP_PLATFORM)
+#include "sdkconfig.h"
+static const char* kPlatform = CONFIG_IDF_TARGET;
+#else
+static const char* kPlatform = "host";
+#endif
+
+const char* BenchmarkPlatform() { return kPlatform; }
+
+BenchmarkResult SummarizeBenchmark(const char* name, std::vector<uint32_t>& cycles) {
+  BenchmarkResult result = {name, static_cast<int>(cycles.size()), 0, 0, 0, 0, 0};
+  if (cycles.empty()) {
+    return result;
+  }
+  std::sort(cycles.begin(), cycles.end());
+  const float us_per_count = 1.0f / CycleCountsPerUs();
+  uint64_t total = 0;
+  for (uint32_t count : cycles) {
+    total += count;
+  }
+  const size_t n = cycles.size();
+  result.mean_us = (static_cast<float>(total) / n) * us_per_count;
+  result.p50_us = cycles[n / 2] * us_per_count;
+  result.p99_us = cycles[std::min(n - 1, n * 99 / 100)] * us_per_count;
+  result.min_us = cycles.front() * us_per_count;
+  result.max_us = cycles.back() * us_per_count;
+  return result;
+}
+
+void ReportBenchmark(const BenchmarkResult& result, FILE* file) {
+  char line[256];
+  snprintf(line, sizeof(line),
+           "{\"benchmark\": \"%s\", \"platform\": \"%s\", \"iterations\": %d, "
+           "\"mean_us\": %.2f, \"p50_us\": %.2f, \"p99_us\": %.2f, "
+           "\"min_us\": %.2f, \"max_us\": %.2f}\n",
+           result.name, kPlatform, result.iterations,
+           static_cast<double>(result.mean_us), static_cast<double>(result.p50_us),
+           static_cast<double>(result.p99_us), static_cast<double>(result.min_us),
+           static_cast<double>(result.max_us));
+  fputs(line, stdout);
+  if (file != nullptr) {
+    fputs(line, file);
+  }
+}
+
+void ReportThroughput(const char* name, uint64_t bytes, int64_t elapsed_us, FILE* file) {
+  char line[256];
+  snprintf(line, sizeof(line),
+           "{\"benchmark\": \"%s\", \"platform\": \"%s\", \"bytes\": %llu, "
+           "\"seconds\": %.3f, \"mb_per_s\": %.3f}\n",
+           name, kPlatform, (unsigned long long) bytes, elapsed_us / 1e6,
+           elapsed_us > 0 ? static_cast<double>(bytes) / elapsed_us : 0.0);
+  fputs(line, stdout);
+  if (file != nullptr) {
+    fputs(line, file);
+  }
+}
+
+bool ReportEquivalence(const char* name, int compared, int mismatches,
+                       int max_abs_diff, FILE* file) {
+  char line[256];
+  snprintf(line, sizeof(line),
+           "{\"check\": \"%s\", \"platform\": \"%s\", \"compared\": %d, "
+           "\"mismatches\": %d, \"max_abs_diff\": %d}\n",
+           name, kPlatform, compared, mismatches, max_abs_diff);
+  fputs(line, stdout);
+  if (file != nullptr) {
+    fputs(line, file);
+  }
+  return mismatches == 0;
+}
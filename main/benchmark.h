@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "cycle_counter.h"
+
+// Latency summary of one benchmark, in microseconds per iteration.
+struct BenchmarkResult {
+  const char* name;
+  int iterations;
+  float mean_us;
+  float p50_us;
+  float p99_us;
+  float min_us;
+  float max_us;
+};
+
+// What the results are from: the IDF target on the board, "host" otherwise.
+const char* BenchmarkPlatform();
+
+// Summarizes per-iteration cycle counts (reordering them in the process).
+BenchmarkResult SummarizeBenchmark(const char* name, std::vector<uint32_t>& cycles);
+
+// Prints the result as one JSON object per line, to stdout and to file when
+// it's not null, so runs can be collected and compared between releases.
+void ReportBenchmark(const BenchmarkResult& result, FILE* file);
+
+// Reports a comparison of two implementations of the same computation on
+// one JSON line, like ReportBenchmark(): how many of the values compared
+// differed, and by how much at most. Returns whether none did.
+bool ReportEquivalence(const char* name, int compared, int mismatches,
+                       int max_abs_diff, FILE* file);
+
+// Reports a sustained transfer rate on one JSON line, like ReportBenchmark():
+// bytes moved in elapsed_us of wall-clock time.
+void ReportThroughput(const char* name, uint64_t bytes, int64_t elapsed_us, FILE* file);
+
+// Times body() on every iteration, after a few untimed warm-up runs.
+template <typename Body>
+BenchmarkResult RunBenchmark(const char* name, int iterations, Body&& body) {
+  constexpr int kWarmupIterations = 3;
+  for (int i = 0; i < kWarmupIterations; ++i) {
+    body();
+  }
+  std::vector<uint32_t> cycles(iterations);
+  for (int i = 0; i < iterations; ++i) {
+    const uint32_t start = CycleCount();
+    body();
+    cycles[i] = CycleCount() - start;
+  }
+  return SummarizeBenchmark(name, cycles);
+}
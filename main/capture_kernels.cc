@@ -0,0 +1,549 @@
+#include "capture_kernels.h"
+
+#include <algorithm>
+#include <climits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CAPTURE_KERNELS_AVX2 1
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+inline int32_t Saturate16(int32_t x) {
+  return std::min<int32_t>(std::max<int32_t>(x, INT16_MIN), INT16_MAX);
+}
+
+inline int16_t ConditionSample(int32_t sample, int16_t dc, int16_t gain,
+                               uint32_t* clipped) {
+  constexpr int32_t kRounding = 1 << (kCaptureGainBits - 1);
+  const int32_t centered = Saturate16(sample - dc);
+  const int32_t scaled = Saturate16((centered * gain + kRounding) >> kCaptureGainBits);
+  *clipped += scaled == INT16_MAX || scaled == INT16_MIN;
+  return scaled;
+}
+
+// Samples [begin, n) one at a time; the vectorized kernels finish with it.
+int32_t ConvertScalar(const int32_t* input, int16_t* output, int begin, int n,
+                      int16_t dc, int16_t gain, uint32_t* clipped) {
+  int32_t sum = 0;
+  for (int i = begin; i < n; ++i) {
+    const int32_t sample = input[i] >> 16;
+    sum += sample;
+    output[i] = ConditionSample(sample, dc, gain, clipped);
+  }
+  return sum;
+}
+
+int32_t ConvertReference(const int32_t* input, int16_t* output, int n,
+                         int16_t dc, int16_t gain, uint32_t* clipped) {
+  return ConvertScalar(input, output, 0, n, dc, gain, clipped);
+}
+
+inline int32_t AbsSaturated(int32_t x) {
+  return std::min<int32_t>(x < 0 ? -x : x, INT16_MAX);
+}
+
+// Frames [begin, n) one at a time, for any channel count.
+void DeinterleaveScalar(const int32_t* input, int num_channels, int begin, int n,
+                        int16_t* const* outputs, uint32_t* levels) {
+  for (int c = 0; c < num_channels; ++c) {
+    const int32_t* slot = input + c;
+    int16_t* output = outputs[c];
+    uint32_t level = 0;
+    for (int i = begin; i < n; ++i) {
+      const int32_t sample = slot[i * num_channels] >> 16;
+      level += AbsSaturated(sample);
+      output[i] = sample;
+    }
+    levels[c] += level;
+  }
+}
+
+void DeinterleaveReference(const int32_t* input, int num_channels, int n,
+                           int16_t* const* outputs, uint32_t* levels) {
+  DeinterleaveScalar(input, num_channels, 0, n, outputs, levels);
+}
+
+void MixScalar(const int16_t* const* inputs, const int16_t* weights, int num_channels,
+               int begin, int n, int16_t* output) {
+  for (int i = begin; i < n; ++i) {
+    int32_t mixed = 1 << 14;
+    for (int c = 0; c < num_channels; ++c) {
+      mixed += inputs[c][i] * weights[c];
+    }
+    output[i] = Saturate16(mixed >> 15);
+  }
+}
+
+void MixReference(const int16_t* const* inputs, const int16_t* weights, int num_channels,
+                  int n, int16_t* output) {
+  MixScalar(inputs, weights, num_channels, 0, n, output);
+}
+
+int64_t CorrelateScalar(const int16_t* a, const int16_t* b, int begin, int n) {
+  int64_t sum = 0;
+  for (int i = begin; i < n; ++i) {
+    sum += std::max<int32_t>(a[i], -INT16_MAX) * std::max<int32_t>(b[i], -INT16_MAX);
+  }
+  return sum;
+}
+
+int64_t CorrelateReference(const int16_t* a, const int16_t* b, int n) {
+  return CorrelateScalar(a, b, 0, n);
+}
+
+#if defined(__XTENSA__)
+// No SIMD worth having for this on the Xtensa cores, but loading four words
+// before storing keeps the in-place conversion free to pipeline, and the
+// compiler turns the saturation into clamps/min/max.
+int32_t ConvertUnrolled(const int32_t* input, int16_t* output, int n,
+                        int16_t dc, int16_t gain, uint32_t* clipped) {
+  int32_t sum = 0;
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const int32_t s0 = input[i] >> 16;
+    const int32_t s1 = input[i + 1] >> 16;
+    const int32_t s2 = input[i + 2] >> 16;
+    const int32_t s3 = input[i + 3] >> 16;
+    sum += s0 + s1 + s2 + s3;
+    output[i] = ConditionSample(s0, dc, gain, clipped);
+    output[i + 1] = ConditionSample(s1, dc, gain, clipped);
+    output[i + 2] = ConditionSample(s2, dc, gain, clipped);
+    output[i + 3] = ConditionSample(s3, dc, gain, clipped);
+  }
+  return sum + ConvertScalar(input, output, i, n, dc, gain, clipped);
+}
+#endif
+
+#if defined(__SSE2__)
+inline int32_t HorizontalSum(__m128i v) {
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+  v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(v);
+}
+
+// 8 samples per iteration. Every store lands on words that have been loaded
+// already, so the conversion can be in place.
+int32_t ConvertSse2(const int32_t* input, int16_t* output, int n,
+                    int16_t dc, int16_t gain, uint32_t* clipped) {
+  const __m128i dc_v = _mm_set1_epi16(dc);
+  const __m128i gain_v = _mm_set1_epi16(gain);
+  const __m128i rounding = _mm_set1_epi32(1 << (kCaptureGainBits - 1));
+  const __m128i ones = _mm_set1_epi16(1);
+  const __m128i max_v = _mm_set1_epi16(INT16_MAX);
+  const __m128i min_v = _mm_set1_epi16(INT16_MIN);
+  __m128i sums = _mm_setzero_si128();
+  __m128i clips = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i lo = _mm_srai_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i)), 16);
+    const __m128i hi = _mm_srai_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i + 4)), 16);
+    const __m128i samples = _mm_packs_epi32(lo, hi);
+    sums = _mm_add_epi32(sums, _mm_madd_epi16(samples, ones));
+    const __m128i centered = _mm_subs_epi16(samples, dc_v);
+    const __m128i product_lo = _mm_mullo_epi16(centered, gain_v);
+    const __m128i product_hi = _mm_mulhi_epi16(centered, gain_v);
+    __m128i p0 = _mm_unpacklo_epi16(product_lo, product_hi);
+    __m128i p1 = _mm_unpackhi_epi16(product_lo, product_hi);
+    p0 = _mm_srai_epi32(_mm_add_epi32(p0, rounding), kCaptureGainBits);
+    p1 = _mm_srai_epi32(_mm_add_epi32(p1, rounding), kCaptureGainBits);
+    const __m128i scaled = _mm_packs_epi32(p0, p1);
+    // The comparisons are -1 where true
+    clips = _mm_sub_epi16(clips, _mm_or_si128(_mm_cmpeq_epi16(scaled, max_v),
+                                              _mm_cmpeq_epi16(scaled, min_v)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), scaled);
+  }
+  *clipped += HorizontalSum(_mm_madd_epi16(clips, ones));
+  return HorizontalSum(sums) + ConvertScalar(input, output, i, n, dc, gain, clipped);
+}
+
+// Transposes four vectors of four 32-bit values: afterwards a holds the
+// first value of each, b the second and so on.
+inline void Transpose4x32(__m128i& a, __m128i& b, __m128i& c, __m128i& d) {
+  const __m128i ab_lo = _mm_unpacklo_epi32(a, b);
+  const __m128i cd_lo = _mm_unpacklo_epi32(c, d);
+  const __m128i ab_hi = _mm_unpackhi_epi32(a, b);
+  const __m128i cd_hi = _mm_unpackhi_epi32(c, d);
+  a = _mm_unpacklo_epi64(ab_lo, cd_lo);
+  b = _mm_unpackhi_epi64(ab_lo, cd_lo);
+  c = _mm_unpacklo_epi64(ab_hi, cd_hi);
+  d = _mm_unpackhi_epi64(ab_hi, cd_hi);
+}
+
+inline __m128i LoadTopHalves(const int32_t* words) {
+  return _mm_srai_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(words)), 16);
+}
+
+// Stores 8 samples of a channel and adds their absolute values to its level
+// lanes. Negating saturates, so -32768 counts as INT16_MAX.
+inline void StoreChannel(__m128i samples, int16_t* output, __m128i* level) {
+  const __m128i magnitude = _mm_max_epi16(samples, _mm_subs_epi16(_mm_setzero_si128(), samples));
+  *level = _mm_add_epi32(*level, _mm_madd_epi16(magnitude, _mm_set1_epi16(1)));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(output), samples);
+}
+
+// 8 frames per iteration for two or four channels: the words are shifted
+// while still 32-bit, regrouped per channel and then packed to 16 bits.
+void DeinterleaveSse2(const int32_t* input, int num_channels, int n,
+                      int16_t* const* outputs, uint32_t* levels) {
+  if (num_channels != 2 && num_channels != 4) {
+    DeinterleaveScalar(input, num_channels, 0, n, outputs, levels);
+    return;
+  }
+  __m128i level_v[kMaxCaptureChannels] = {};
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const int32_t* frames = input + i * num_channels;
+    if (num_channels == 4) {
+      __m128i a0 = LoadTopHalves(frames), b0 = LoadTopHalves(frames + 4);
+      __m128i c0 = LoadTopHalves(frames + 8), d0 = LoadTopHalves(frames + 12);
+      __m128i a1 = LoadTopHalves(frames + 16), b1 = LoadTopHalves(frames + 20);
+      __m128i c1 = LoadTopHalves(frames + 24), d1 = LoadTopHalves(frames + 28);
+      Transpose4x32(a0, b0, c0, d0);
+      Transpose4x32(a1, b1, c1, d1);
+      StoreChannel(_mm_packs_epi32(a0, a1), outputs[0] + i, &level_v[0]);
+      StoreChannel(_mm_packs_epi32(b0, b1), outputs[1] + i, &level_v[1]);
+      StoreChannel(_mm_packs_epi32(c0, c1), outputs[2] + i, &level_v[2]);
+      StoreChannel(_mm_packs_epi32(d0, d1), outputs[3] + i, &level_v[3]);
+    } else {
+      // Each vector holds two frames: put the left slots first
+      __m128i first[2];
+      __m128i second[2];
+      for (int half = 0; half < 2; ++half) {
+        const __m128i a = _mm_shuffle_epi32(LoadTopHalves(frames + 8 * half),
+                                            _MM_SHUFFLE(3, 1, 2, 0));
+        const __m128i b = _mm_shuffle_epi32(LoadTopHalves(frames + 8 * half + 4),
+                                            _MM_SHUFFLE(3, 1, 2, 0));
+        first[half] = _mm_unpacklo_epi64(a, b);
+        second[half] = _mm_unpackhi_epi64(a, b);
+      }
+      StoreChannel(_mm_packs_epi32(first[0], first[1]), outputs[0] + i, &level_v[0]);
+      StoreChannel(_mm_packs_epi32(second[0], second[1]), outputs[1] + i, &level_v[1]);
+    }
+  }
+  for (int c = 0; c < num_channels; ++c) {
+    levels[c] += HorizontalSum(level_v[c]);
+  }
+  DeinterleaveScalar(input, num_channels, i, n, outputs, levels);
+}
+
+// 8 samples per iteration, the products accumulated in 32 bits.
+void MixSse2(const int16_t* const* inputs, const int16_t* weights, int num_channels,
+             int n, int16_t* output) {
+  __m128i weight_v[kMaxCaptureChannels];
+  for (int c = 0; c < num_channels; ++c) {
+    weight_v[c] = _mm_set1_epi16(weights[c]);
+  }
+  const __m128i rounding = _mm_set1_epi32(1 << 14);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128i mixed_lo = rounding;
+    __m128i mixed_hi = rounding;
+    for (int c = 0; c < num_channels; ++c) {
+      const __m128i samples = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inputs[c] + i));
+      const __m128i product_lo = _mm_mullo_epi16(samples, weight_v[c]);
+      const __m128i product_hi = _mm_mulhi_epi16(samples, weight_v[c]);
+      mixed_lo = _mm_add_epi32(mixed_lo, _mm_unpacklo_epi16(product_lo, product_hi));
+      mixed_hi = _mm_add_epi32(mixed_hi, _mm_unpackhi_epi16(product_lo, product_hi));
+    }
+    const __m128i mixed = _mm_packs_epi32(_mm_srai_epi32(mixed_lo, 15),
+                                          _mm_srai_epi32(mixed_hi, 15));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), mixed);
+  }
+  MixScalar(inputs, weights, num_channels, i, n, output);
+}
+
+// 8 samples per iteration: each multiply-add of two product pairs fits 32
+// bits once -32768 is out of the way, and is widened to 64 bits right away.
+int64_t CorrelateSse2(const int16_t* a, const int16_t* b, int n) {
+  const __m128i floor_v = _mm_set1_epi16(-INT16_MAX);
+  __m128i sums = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i a_v = _mm_max_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)), floor_v);
+    const __m128i b_v = _mm_max_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)), floor_v);
+    const __m128i pairs = _mm_madd_epi16(a_v, b_v);
+    const __m128i signs = _mm_srai_epi32(pairs, 31);
+    sums = _mm_add_epi64(sums, _mm_unpacklo_epi32(pairs, signs));
+    sums = _mm_add_epi64(sums, _mm_unpackhi_epi32(pairs, signs));
+  }
+  int64_t lanes[2];
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sums);
+  return lanes[0] + lanes[1] + CorrelateScalar(a, b, i, n);
+}
+#endif
+
+#if CAPTURE_KERNELS_AVX2
+// Like ConvertSse2(), 16 samples per iteration. The packs and unpacks work
+// within each 128-bit lane: one permute puts the samples back in order after
+// the first pack, and the unpack/pack pair around the multiplication undo
+// each other.
+__attribute__((target("avx2")))
+int32_t ConvertAvx2(const int32_t* input, int16_t* output, int n,
+                    int16_t dc, int16_t gain, uint32_t* clipped) {
+  const __m256i dc_v = _mm256_set1_epi16(dc);
+  const __m256i gain_v = _mm256_set1_epi16(gain);
+  const __m256i rounding = _mm256_set1_epi32(1 << (kCaptureGainBits - 1));
+  const __m256i ones = _mm256_set1_epi16(1);
+  const __m256i max_v = _mm256_set1_epi16(INT16_MAX);
+  const __m256i min_v = _mm256_set1_epi16(INT16_MIN);
+  __m256i sums = _mm256_setzero_si256();
+  __m256i clips = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m256i lo = _mm256_srai_epi32(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i)), 16);
+    const __m256i hi = _mm256_srai_epi32(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i + 8)), 16);
+    const __m256i samples = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi),
+                                                     _MM_SHUFFLE(3, 1, 2, 0));
+    sums = _mm256_add_epi32(sums, _mm256_madd_epi16(samples, ones));
+    const __m256i centered = _mm256_subs_epi16(samples, dc_v);
+    const __m256i product_lo = _mm256_mullo_epi16(centered, gain_v);
+    const __m256i product_hi = _mm256_mulhi_epi16(centered, gain_v);
+    __m256i p0 = _mm256_unpacklo_epi16(product_lo, product_hi);
+    __m256i p1 = _mm256_unpackhi_epi16(product_lo, product_hi);
+    p0 = _mm256_srai_epi32(_mm256_add_epi32(p0, rounding), kCaptureGainBits);
+    p1 = _mm256_srai_epi32(_mm256_add_epi32(p1, rounding), kCaptureGainBits);
+    const __m256i scaled = _mm256_packs_epi32(p0, p1);
+    clips = _mm256_sub_epi16(clips, _mm256_or_si256(_mm256_cmpeq_epi16(scaled, max_v),
+                                                    _mm256_cmpeq_epi16(scaled, min_v)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), scaled);
+  }
+  const __m256i clip_sums = _mm256_madd_epi16(clips, ones);
+  *clipped += HorizontalSum(_mm_add_epi32(_mm256_castsi256_si128(clip_sums),
+                                          _mm256_extracti128_si256(clip_sums, 1)));
+  const int32_t sum = HorizontalSum(_mm_add_epi32(_mm256_castsi256_si128(sums),
+                                                  _mm256_extracti128_si256(sums, 1)));
+  return sum + ConvertScalar(input, output, i, n, dc, gain, clipped);
+}
+#endif
+
+#if defined(__ARM_NEON)
+inline uint32_t HorizontalSum(uint32x4_t v) {
+  const uint32x2_t halves = vadd_u32(vget_low_u32(v), vget_high_u32(v));
+  return vget_lane_u32(vpadd_u32(halves, halves), 0);
+}
+
+// 8 samples per iteration; the narrowing shift does the conversion and the
+// rounding shift the gain's rounding.
+int32_t ConvertNeon(const int32_t* input, int16_t* output, int n,
+                    int16_t dc, int16_t gain, uint32_t* clipped) {
+  const int16x8_t dc_v = vdupq_n_s16(dc);
+  const int16x4_t gain_v = vdup_n_s16(gain);
+  const int16x8_t max_v = vdupq_n_s16(INT16_MAX);
+  const int16x8_t min_v = vdupq_n_s16(INT16_MIN);
+  int32x4_t sums = vdupq_n_s32(0);
+  uint16x8_t clips = vdupq_n_u16(0);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const int16x8_t samples = vcombine_s16(vshrn_n_s32(vld1q_s32(input + i), 16),
+                                           vshrn_n_s32(vld1q_s32(input + i + 4), 16));
+    sums = vpadalq_s16(sums, samples);
+    const int16x8_t centered = vqsubq_s16(samples, dc_v);
+    const int32x4_t p0 = vrshrq_n_s32(vmull_s16(vget_low_s16(centered), gain_v),
+                                      kCaptureGainBits);
+    const int32x4_t p1 = vrshrq_n_s32(vmull_s16(vget_high_s16(centered), gain_v),
+                                      kCaptureGainBits);
+    const int16x8_t scaled = vcombine_s16(vqmovn_s32(p0), vqmovn_s32(p1));
+    const uint16x8_t at_full_scale = vorrq_u16(vceqq_s16(scaled, max_v),
+                                               vceqq_s16(scaled, min_v));
+    clips = vaddq_u16(clips, vshrq_n_u16(at_full_scale, 15));
+    vst1q_s16(output + i, scaled);
+  }
+  *clipped += HorizontalSum(vpaddlq_u16(clips));
+  const int32x2_t sum_halves = vadd_s32(vget_low_s32(sums), vget_high_s32(sums));
+  const int32_t sum = vget_lane_s32(vpadd_s32(sum_halves, sum_halves), 0);
+  return sum + ConvertScalar(input, output, i, n, dc, gain, clipped);
+}
+
+inline void StoreChannel(int32x4_t first, int32x4_t second, int16_t* output,
+                         uint32x4_t* level) {
+  const int16x8_t samples = vcombine_s16(vshrn_n_s32(first, 16), vshrn_n_s32(second, 16));
+  *level = vpadalq_u16(*level, vreinterpretq_u16_s16(vqabsq_s16(samples)));
+  vst1q_s16(output, samples);
+}
+
+// 8 frames per iteration for two or four channels, the structured loads doing
+// the de-interleaving.
+void DeinterleaveNeon(const int32_t* input, int num_channels, int n,
+                      int16_t* const* outputs, uint32_t* levels) {
+  if (num_channels != 2 && num_channels != 4) {
+    DeinterleaveScalar(input, num_channels, 0, n, outputs, levels);
+    return;
+  }
+  uint32x4_t level_v[kMaxCaptureChannels];
+  for (uint32x4_t& level : level_v) {
+    level = vdupq_n_u32(0);
+  }
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const int32_t* frames = input + i * num_channels;
+    if (num_channels == 4) {
+      const int32x4x4_t first = vld4q_s32(frames);
+      const int32x4x4_t second = vld4q_s32(frames + 16);
+      for (int c = 0; c < 4; ++c) {
+        StoreChannel(first.val[c], second.val[c], outputs[c] + i, &level_v[c]);
+      }
+    } else {
+      const int32x4x2_t first = vld2q_s32(frames);
+      const int32x4x2_t second = vld2q_s32(frames + 8);
+      for (int c = 0; c < 2; ++c) {
+        StoreChannel(first.val[c], second.val[c], outputs[c] + i, &level_v[c]);
+      }
+    }
+  }
+  for (int c = 0; c < num_channels; ++c) {
+    levels[c] += HorizontalSum(level_v[c]);
+  }
+  DeinterleaveScalar(input, num_channels, i, n, outputs, levels);
+}
+
+// 8 samples per iteration; the rounding narrow does the final shift.
+void MixNeon(const int16_t* const* inputs, const int16_t* weights, int num_channels,
+             int n, int16_t* output) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    int32x4_t mixed_lo = vdupq_n_s32(0);
+    int32x4_t mixed_hi = vdupq_n_s32(0);
+    for (int c = 0; c < num_channels; ++c) {
+      const int16x8_t samples = vld1q_s16(inputs[c] + i);
+      const int16x4_t weight = vdup_n_s16(weights[c]);
+      mixed_lo = vmlal_s16(mixed_lo, vget_low_s16(samples), weight);
+      mixed_hi = vmlal_s16(mixed_hi, vget_high_s16(samples), weight);
+    }
+    vst1q_s16(output + i, vcombine_s16(vqrshrn_n_s32(mixed_lo, 15),
+                                       vqrshrn_n_s32(mixed_hi, 15)));
+  }
+  MixScalar(inputs, weights, num_channels, i, n, output);
+}
+
+// 8 samples per iteration, the products widened pairwise into 64 bits.
+int64_t CorrelateNeon(const int16_t* a, const int16_t* b, int n) {
+  const int16x8_t floor_v = vdupq_n_s16(-INT16_MAX);
+  int64x2_t sums = vdupq_n_s64(0);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const int16x8_t a_v = vmaxq_s16(vld1q_s16(a + i), floor_v);
+    const int16x8_t b_v = vmaxq_s16(vld1q_s16(b + i), floor_v);
+    sums = vpadalq_s32(sums, vmull_s16(vget_low_s16(a_v), vget_low_s16(b_v)));
+    sums = vpadalq_s32(sums, vmull_s16(vget_high_s16(a_v), vget_high_s16(b_v)));
+  }
+  return vgetq_lane_s64(sums, 0) + vgetq_lane_s64(sums, 1) + CorrelateScalar(a, b, i, n);
+}
+#endif
+
+struct KernelTable {
+  CaptureKernel kernels[4];
+  int count;
+};
+
+KernelTable BuildKernelTable() {
+  KernelTable table = {};
+  table.kernels[table.count++] = {"scalar_reference", ConvertReference};
+#if defined(__XTENSA__)
+  table.kernels[table.count++] = {"xtensa_unrolled", ConvertUnrolled};
+#endif
+#if defined(__SSE2__)
+  table.kernels[table.count++] = {"sse2", ConvertSse2};
+#endif
+#if CAPTURE_KERNELS_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    table.kernels[table.count++] = {"avx2", ConvertAvx2};
+  }
+#endif
+#if defined(__ARM_NEON)
+  table.kernels[table.count++] = {"neon", ConvertNeon};
+#endif
+  return table;
+}
+
+struct ChannelKernelTable {
+  ChannelKernel kernels[2];
+  int count;
+};
+
+ChannelKernelTable BuildChannelKernelTable() {
+  ChannelKernelTable table = {};
+  table.kernels[table.count++] = {"scalar_reference", DeinterleaveReference, MixReference,
+                                   CorrelateReference};
+#if defined(__SSE2__)
+  table.kernels[table.count++] = {"sse2", DeinterleaveSse2, MixSse2, CorrelateSse2};
+#endif
+#if defined(__ARM_NEON)
+  table.kernels[table.count++] = {"neon", DeinterleaveNeon, MixNeon, CorrelateNeon};
+#endif
+  return table;
+}
+
+}  // namespace
+
+const CaptureKernel* CaptureKernels(int* count) {
+  static const KernelTable table = BuildKernelTable();
+  *count = table.count;
+  return table.kernels;
+}
+
+const ChannelKernel* ChannelKernels(int* count) {
+  static const ChannelKernelTable table = BuildChannelKernelTable();
+  *count = table.count;
+  return table.kernels;
+}
+
+CaptureConditioner::CaptureConditioner() {
+  int count = 0;
+  const CaptureKernel* kernels = CaptureKernels(&count);
+  convert_ = kernels[count - 1].convert;
+}
+
+void CaptureConditioner::Configure(bool remove_dc, int16_t gain) {
+  remove_dc_ = remove_dc;
+  gain_ = gain;
+}
+
+void CaptureConditioner::Reset() {
+  dc_estimate_ = 0;
+  clipped_samples_ = 0;
+}
+
+int16_t* CaptureConditioner::Process(int32_t* words, int n) {
+  int16_t* samples = reinterpret_cast<int16_t*>(words);
+  for (int start = 0; start < n; start += kCaptureKernelMaxSamples) {
+    const int count = std::min(n - start, kCaptureKernelMaxSamples);
+    const int16_t dc = remove_dc_ ? dc_offset() : 0;
+    const int32_t sum = convert_(words + start, samples + start, count, dc, gain_,
+                                 &clipped_samples_);
+    if (remove_dc_) {
+      const int64_t mean = (int64_t{sum} << 16) / count;
+      dc_estimate_ += static_cast<int32_t>((mean - dc_estimate_) >> kDcShift);
+    }
+  }
+  return samples;
+}
+
+void CaptureConditioner::Process(int16_t* samples, int n) {
+  for (int start = 0; start < n; start += kCaptureKernelMaxSamples) {
+    const int count = std::min(n - start, kCaptureKernelMaxSamples);
+    const int16_t dc = remove_dc_ ? dc_offset() : 0;
+    int32_t sum = 0;
+    for (int i = start; i < start + count; ++i) {
+      sum += samples[i];
+      samples[i] = ConditionSample(samples[i], dc, gain_, &clipped_samples_);
+    }
+    if (remove_dc_) {
+      const int64_t mean = (int64_t{sum} << 16) / count;
+      dc_estimate_ += static_cast<int32_t>((mean - dc_estimate_) >> kDcShift);
+    }
+  }
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <cstdint>
+
+// Fractional bits of the capture gain: kCaptureUnityGain leaves the level as
+// it is, and the largest gain is just under 8x.
+constexpr int kCaptureGainBits = 12;
+constexpr int16_t kCaptureUnityGain = 1 << kCaptureGainBits;
+
+// Most words a CaptureKernelFunc takes per call, so that its sums and
+// counters can't overflow.
+constexpr int kCaptureKernelMaxSamples = 1 << 14;
+
+// One implementation of the capture conversion. Converts n left-aligned 32-bit
+// words read from I2S to 16-bit PCM in a single pass: for each sample s, the
+// top half of its word,
+//   output = saturate(saturate(s - dc) * gain / 2^kCaptureGainBits)
+// rounded to nearest. output may start at input, for an in-place conversion.
+// Adds the number of outputs at full scale (clipped) to *clipped and returns
+// the sum of the s, for tracking the DC offset.
+typedef int32_t (*CaptureKernelFunc)(const int32_t* input, int16_t* output, int n,
+                                     int16_t dc, int16_t gain, uint32_t* clipped);
+
+struct CaptureKernel {
+  const char* name;
+  CaptureKernelFunc convert;
+};
+
+// The implementations this build can run on this CPU: the portable scalar
+// reference first, the one CaptureConditioner uses last. All of them give
+// exactly the same results.
+const CaptureKernel* CaptureKernels(int* count);
+
+// Multi-channel (TDM) capture: the ES7210 sends up to four microphone slots
+// per frame.
+constexpr int kMaxCaptureChannels = 4;
+
+// De-interleaves n frames of num_channels 32-bit TDM slots into one 16-bit
+// PCM array per channel in a single pass, keeping the top half of each word
+// like the mono conversion. Adds the sum of each channel's absolute sample
+// values (saturated to INT16_MAX) to levels[c]. n <= kCaptureKernelMaxSamples.
+typedef void (*DeinterleaveKernelFunc)(const int32_t* input, int num_channels, int n,
+                                       int16_t* const* outputs, uint32_t* levels);
+// Mixes num_channels arrays of n samples into output:
+//   output[i] = saturate(sum over c of inputs[c][i] * weights[c] / 2^15)
+// rounded to nearest. The absolute weights must add up to at most 2^15.
+typedef void (*MixKernelFunc)(const int16_t* const* inputs, const int16_t* weights,
+                              int num_channels, int n, int16_t* output);
+// Sum of a[i] * b[i] over n samples, for cross-correlating channels, with
+// -32768 taken as -32767 so that pairs of products fit 32 bits.
+typedef int64_t (*CorrelateKernelFunc)(const int16_t* a, const int16_t* b, int n);
+
+struct ChannelKernel {
+  const char* name;
+  DeinterleaveKernelFunc deinterleave;
+  MixKernelFunc mix;
+  CorrelateKernelFunc correlate;
+};
+
+// Like CaptureKernels(): the scalar reference first, the fastest last. The
+// vector kernels de-interleave two or four channels, other counts take the
+// scalar path.
+const ChannelKernel* ChannelKernels(int* count);
+
+// Turns the I2S DMA buffer into the 16-bit PCM the rest of the pipeline works
+// on, in place, with the fastest capture kernel. Optionally removes the ADC's
+// DC offset, tracked across calls from the mean of each block, and applies a
+// fixed-point gain. Counts the clipped samples on the way.
+class CaptureConditioner {
+ public:
+  CaptureConditioner();
+
+  // gain has kCaptureGainBits fractional bits
+  void Configure(bool remove_dc, int16_t gain);
+  // Forgets the DC estimate and the clipping count.
+  void Reset();
+
+  // Converts n words in place and returns the n samples, which now fill the
+  // first half of the buffer.
+  int16_t* Process(int32_t* words, int n);
+  // The same on n samples that are already 16-bit PCM, such as the combined
+  // microphones of a multi-channel capture, in place and with scalar code.
+  void Process(int16_t* samples, int n);
+
+  uint32_t clipped_samples() const { return clipped_samples_; }
+  int16_t dc_offset() const { return dc_estimate_ >> 16; }
+
+ private:
+  // The DC estimate moves 1/2^kDcShift of the way to each block's mean: about
+  // 1.6s to settle with 100ms blocks.
+  static constexpr int kDcShift = 4;
+
+  CaptureKernelFunc convert_;
+  bool remove_dc_ = false;
+  int16_t gain_ = kCaptureUnityGain;
+  // Mean of the samples, with 16 fractional bits
+  int32_t dc_estimate_ = 0;
+  uint32_t clipped_samples_ = 0;
+};
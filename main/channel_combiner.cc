@@ -0,0 +1,151 @@
+#include "channel_combiner.h"
+
+#include <algorithm>
+#include <cstring>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+static const char* TAG = "channel_combiner";
+
+ChannelCombiner::~ChannelCombiner() {
+  for (int16_t* channel : channels_) {
+    heap_caps_free(channel);
+  }
+}
+
+TfLiteStatus ChannelCombiner::Init(int num_channels, int max_frames,
+                                   ChannelCombineMode mode) {
+  if (num_channels < 1 || num_channels > kMaxCaptureChannels || max_frames < 1) {
+    ESP_LOGE(TAG, "Can't combine %d channels in blocks of %d", num_channels, max_frames);
+    return kTfLiteError;
+  }
+  if (channels_[0] != nullptr && (num_channels != num_channels_ || max_frames != max_frames_)) {
+    ESP_LOGE(TAG, "Already set up for %d channels in blocks of %d", num_channels_,
+             max_frames_);
+    return kTfLiteError;
+  }
+  int count = 0;
+  const ChannelKernel* kernels = ChannelKernels(&count);
+  kernel_ = &kernels[count - 1];
+  num_channels_ = num_channels;
+  max_frames_ = std::min(max_frames, kCaptureKernelMaxSamples);
+  mode_ = mode;
+  for (int c = 0; c < num_channels_; ++c) {
+    if (channels_[c] == nullptr) {
+      channels_[c] = static_cast<int16_t*>(
+          heap_caps_malloc((kHistorySamples + max_frames_) * sizeof(int16_t),
+                           MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT));
+    }
+    if (channels_[c] == nullptr) {
+      ESP_LOGE(TAG, "Can't allocate the buffer of channel %d", c);
+      return kTfLiteError;
+    }
+    // Each channel counts for 1/num_channels in the sums
+    weights_[c] = std::min((1 << 15) / num_channels_, int{INT16_MAX});
+  }
+  Reset();
+  ESP_LOGI(TAG, "Combining %d channels with the %s kernels", num_channels_, kernel_->name);
+  return kTfLiteOk;
+}
+
+void ChannelCombiner::Reset() {
+  for (int c = 0; c < num_channels_; ++c) {
+    memset(channels_[c], 0, kHistorySamples * sizeof(int16_t));
+    noise_floors_[c] = 0;
+    delays_[c] = 0;
+  }
+  selected_ = 0;
+}
+
+void ChannelCombiner::Process(const int32_t* words, int n_frames, int16_t* output) {
+  for (int start = 0; start < n_frames; start += max_frames_) {
+    const int n = std::min(n_frames - start, max_frames_);
+    CombineBlock(words + start * num_channels_, n, output + start);
+  }
+}
+
+void ChannelCombiner::CombineBlock(const int32_t* words, int n, int16_t* output) {
+  int16_t* blocks[kMaxCaptureChannels];
+  uint32_t levels[kMaxCaptureChannels] = {};
+  for (int c = 0; c < num_channels_; ++c) {
+    blocks[c] = channels_[c] + kHistorySamples;
+  }
+  kernel_->deinterleave(words, num_channels_, n, blocks, levels);
+
+  switch (mode_) {
+    case ChannelCombineMode::kSelectBest:
+      UpdateSelection(levels, n);
+      memcpy(output, blocks[selected_], n * sizeof(int16_t));
+      break;
+    case ChannelCombineMode::kSum:
+      kernel_->mix(blocks, weights_, num_channels_, n, output);
+      break;
+    case ChannelCombineMode::kDelayAndSum: {
+      UpdateDelays(n);
+      const int16_t* aligned[kMaxCaptureChannels];
+      for (int c = 0; c < num_channels_; ++c) {
+        aligned[c] = blocks[c] - kMaxDelaySamples + delays_[c];
+      }
+      kernel_->mix(aligned, weights_, num_channels_, n, output);
+      break;
+    }
+  }
+
+  // The end of this block is the history of the next one.
+  for (int c = 0; c < num_channels_; ++c) {
+    memmove(channels_[c], channels_[c] + n, kHistorySamples * sizeof(int16_t));
+  }
+}
+
+void ChannelCombiner::UpdateSelection(const uint32_t* levels, int n) {
+  uint32_t mean_levels[kMaxCaptureChannels];
+  for (int c = 0; c < num_channels_; ++c) {
+    mean_levels[c] = levels[c] / n + 1;
+    uint32_t& floor = noise_floors_[c];
+    if (floor == 0 || mean_levels[c] < floor) {
+      floor = mean_levels[c];
+    } else {
+      floor += (floor >> kNoiseFloorRiseShift) + 1;
+    }
+  }
+  // Switch only to a channel with a clearly better SNR (by a quarter), so that
+  // two similar microphones don't keep trading places.
+  int best = selected_;
+  for (int c = 0; c < num_channels_; ++c) {
+    const uint64_t snr_c = uint64_t{mean_levels[c]} * noise_floors_[best];
+    const uint64_t snr_best = uint64_t{mean_levels[best]} * noise_floors_[c];
+    if (4 * snr_c > 5 * snr_best) {
+      best = c;
+    }
+  }
+  selected_ = best;
+}
+
+int64_t ChannelCombiner::Correlation(int c, int lag, int n) const {
+  // Stay clear of the samples that haven't arrived yet for positive lags.
+  return kernel_->correlate(channel_samples(0), channel_samples(c) + lag,
+                            n - kMaxDelaySamples);
+}
+
+void ChannelCombiner::UpdateDelays(int n) {
+  if (n <= 2 * kMaxDelaySamples) {
+    return;
+  }
+  for (int c = 1; c < num_channels_; ++c) {
+    int best_lag = delays_[c];
+    int64_t best = Correlation(c, best_lag, n);
+    const int64_t current = best;
+    for (int lag = -kMaxDelaySamples; lag <= kMaxDelaySamples; ++lag) {
+      const int64_t correlation = Correlation(c, lag, n);
+      if (correlation > best) {
+        best = correlation;
+        best_lag = lag;
+      }
+    }
+    // Keep the current delay unless another one is clearly better, so that
+    // the output doesn't jump between lags on noise.
+    if (best - current > (current < 0 ? -current : current) / 8) {
+      delays_[c] = best_lag;
+    }
+  }
+}
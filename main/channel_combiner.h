@@ -0,0 +1,76 @@
+#pragma once
+#include <cstdint>
+#include "capture_kernels.h"
+#include "tensorflow/lite/c/common.h"
+
+// How ChannelCombiner turns the microphones into the one channel the feature
+// path works on.
+enum class ChannelCombineMode {
+  // The channel with the best signal to noise ratio, each block
+  kSelectBest,
+  // The average of all channels
+  kSum,
+  // The average of all channels, each delayed to line up with the first
+  kDelayAndSum,
+};
+
+// Multi-channel capture: takes the interleaved 32-bit TDM frames read from
+// I2S, de-interleaves all slots into per-channel buffers in one pass, and
+// combines them into mono PCM, with the fastest channel kernels.
+//
+// Each channel's buffer keeps the last kHistorySamples of the previous block
+// in front of the new one, so delay-and-sum can reach back across blocks. Its
+// delays are estimated on every block, by cross-correlating each channel with
+// the first one over +-kMaxDelaySamples (enough for the few centimeters
+// between the board's microphones), and its output lags the input by
+// kMaxDelaySamples. Best-SNR selection compares each channel's mean level
+// against its own noise floor, a slowly rising minimum of that level.
+class ChannelCombiner {
+ public:
+  static constexpr int kMaxDelaySamples = 4;
+
+  ChannelCombiner() = default;
+  ~ChannelCombiner();
+  ChannelCombiner(const ChannelCombiner&) = delete;
+  ChannelCombiner& operator=(const ChannelCombiner&) = delete;
+
+  // Allocates the channel buffers, for blocks of up to max_frames frames.
+  TfLiteStatus Init(int num_channels, int max_frames, ChannelCombineMode mode);
+  // Forgets the history, the noise floors and the delays.
+  void Reset();
+
+  // De-interleaves n_frames frames of num_channels words and writes the
+  // combined samples to output, which may be the start of words.
+  void Process(const int32_t* words, int n_frames, int16_t* output);
+
+  int num_channels() const { return num_channels_; }
+  ChannelCombineMode mode() const { return mode_; }
+  // The channel kSelectBest used for the last block
+  int selected_channel() const { return selected_; }
+  // Samples channel c is taken ahead of the first by kDelayAndSum
+  int delay(int c) const { return delays_[c]; }
+  // The samples of channel c in the last block
+  const int16_t* channel_samples(int c) const { return channels_[c] + kHistorySamples; }
+
+ private:
+  static constexpr int kHistorySamples = 2 * kMaxDelaySamples;
+  // The noise floors rise by 1/2^kNoiseFloorRiseShift per block.
+  static constexpr int kNoiseFloorRiseShift = 6;
+
+  void CombineBlock(const int32_t* words, int n, int16_t* output);
+  void UpdateSelection(const uint32_t* levels, int n);
+  void UpdateDelays(int n);
+  // Sum over the block of channel 0 times channel c shifted by lag
+  int64_t Correlation(int c, int lag, int n) const;
+
+  const ChannelKernel* kernel_ = nullptr;
+  ChannelCombineMode mode_ = ChannelCombineMode::kSelectBest;
+  int num_channels_ = 0;
+  int max_frames_ = 0;
+  // kHistorySamples + max_frames_ samples each
+  int16_t* channels_[kMaxCaptureChannels] = {};
+  int16_t weights_[kMaxCaptureChannels] = {};
+  uint32_t noise_floors_[kMaxCaptureChannels] = {};
+  int selected_ = 0;
+  int delays_[kMaxCaptureChannels] = {};
+};
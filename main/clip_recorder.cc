@@ -0,0 +1,443 @@
+#include "clip_recorder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "micro_model_settings.h"
+
+static const char* TAG = "clip_recorder";
+
+namespace {
+constexpr uint32_t kSamplesPerMs = kAudioSampleFrequency / 1000;
+// The writer waits for this much audio of an open clip before writing it
+// out, so that the card gets a few large writes rather than many small ones.
+constexpr uint32_t kWriteChunkSamples = 8192;
+constexpr size_t kWavHeaderSize = 44;
+// How much history the ring keeps past the pre-trigger audio: the time from
+// the end of a detected spectrogram to its Trigger(), and the card stalls
+// the writer rides out.
+constexpr uint32_t kWriterSlackSamples = 2 * kAudioSampleFrequency;
+
+void PutLe16(uint8_t* out, uint16_t value) {
+  out[0] = value & 0xff;
+  out[1] = value >> 8;
+}
+
+void PutLe32(uint8_t* out, uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    out[i] = (value >> (8 * i)) & 0xff;
+  }
+}
+
+// Canonical 16-bit mono PCM header for data_bytes bytes of samples
+void MakeWavHeader(uint32_t data_bytes, uint8_t* header) {
+  memcpy(header, "RIFF", 4);
+  PutLe32(header + 4, 36 + data_bytes);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  PutLe32(header + 16, 16);
+  PutLe16(header + 20, 1);  // PCM
+  PutLe16(header + 22, 1);  // channels
+  PutLe32(header + 24, kAudioSampleFrequency);
+  PutLe32(header + 28, kAudioSampleFrequency * sizeof(int16_t));
+  PutLe16(header + 32, sizeof(int16_t));
+  PutLe16(header + 34, 16);
+  memcpy(header + 36, "data", 4);
+  PutLe32(header + 40, data_bytes);
+}
+
+// Whether sample position a comes after b, across the wrap of the counters
+bool After(uint32_t a, uint32_t b) {
+  return static_cast<int32_t>(a - b) > 0;
+}
+}  // namespace
+
+ClipRecorder::Config ClipRecorder::DefaultConfig() {
+  // The host build has no sdkconfig of its own.
+#ifdef CONFIG_CLIP_PRE_TRIGGER_MS
+  return {CONFIG_CLIP_PRE_TRIGGER_MS, CONFIG_CLIP_POST_TRIGGER_MS, CONFIG_CLIP_MAX_MS,
+          CONFIG_CLIP_MEMORY_KB};
+#else
+  return {3000, 2000, 30000, 512};
+#endif
+}
+
+esp_err_t ClipRecorder::Start(const char* directory, const Config& config) {
+  if (task_started_) {
+    return ESP_OK;
+  }
+  directory_ = directory;
+
+  // The largest power of two that fits in the budget
+  uint32_t budget = 1;
+  while (budget * 2 <= config.memory_kb * 1024u / sizeof(int16_t)) {
+    budget *= 2;
+  }
+  if (budget < 4 * kWriteChunkSamples) {
+    ESP_LOGE(TAG, "%d KB is too little for clip recording", config.memory_kb);
+    return ESP_ERR_INVALID_ARG;
+  }
+  // Only as much of it as the pre-trigger audio and the writer's slack take
+  const uint32_t needed = std::max(config.pre_trigger_ms, 0) * kSamplesPerMs +
+                          kWriterSlackSamples;
+  uint32_t capacity = 4 * kWriteChunkSamples;
+  while (capacity < needed && capacity < budget) {
+    capacity *= 2;
+  }
+  if (history_ == nullptr) {
+    history_ = static_cast<int16_t*>(
+        heap_caps_malloc(capacity * sizeof(int16_t), MALLOC_CAP_SPIRAM));
+  }
+  if (history_ == nullptr) {
+    history_ = static_cast<int16_t*>(
+        heap_caps_malloc(capacity * sizeof(int16_t), MALLOC_CAP_DEFAULT));
+  }
+  if (history_ == nullptr) {
+    ESP_LOGE(TAG, "Can't allocate the %lu byte clip history",
+             (unsigned long) (capacity * sizeof(int16_t)));
+    return ESP_ERR_NO_MEM;
+  }
+  mask_ = capacity - 1;
+  // The capture task keeps writing while a write goes on: the writer leaves
+  // an eighth of the ring for it.
+  reach_ = capacity - capacity / 8;
+
+  // A clip's start must still be in the ring when the writer gets to it: the
+  // pre-trigger time gets at most half of it, the rest is the writer's slack.
+  pre_samples_ = std::min<uint32_t>(std::max(config.pre_trigger_ms, 0) * kSamplesPerMs,
+                                    capacity / 2);
+  if (pre_samples_ < static_cast<uint32_t>(std::max(config.pre_trigger_ms, 0)) * kSamplesPerMs) {
+    ESP_LOGW(TAG, "Pre-trigger time cut to %lu ms to fit in %d KB",
+             (unsigned long) (pre_samples_ / kSamplesPerMs), config.memory_kb);
+  }
+  post_samples_ = std::max(config.post_trigger_ms, 0) * kSamplesPerMs;
+  max_clip_samples_ = std::max<uint32_t>(std::max(config.max_clip_ms, 0) * kSamplesPerMs,
+                                         pre_samples_ + post_samples_);
+
+  if (mkdir(directory_, 0755) != 0 && errno != EEXIST) {
+    ESP_LOGE(TAG, "Can't create %s: %s", directory_, strerror(errno));
+    return ESP_FAIL;
+  }
+  if (xTaskCreatePinnedToCore(TaskEntry, "ClipWriter", 4096, this, 4, nullptr, 0)
+      != pdPASS) {
+    ESP_LOGE(TAG, "Can't start the clip writer");
+    return ESP_FAIL;
+  }
+  task_started_ = true;
+  ESP_LOGI(TAG, "Recording clips to %s: %lu ms before and %d ms after each "
+           "detection, up to %d ms, %lu ms of history",
+           directory_, (unsigned long) (pre_samples_ / kSamplesPerMs),
+           config.post_trigger_ms, config.max_clip_ms,
+           (unsigned long) (capacity / kSamplesPerMs));
+  return ESP_OK;
+}
+
+void ClipRecorder::Append(const int16_t* samples, int n) {
+  if (history_ == nullptr || n <= 0) {
+    return;
+  }
+  const uint32_t capacity = mask_ + 1;
+  uint32_t head = head_.load(std::memory_order_relaxed);
+  if (backpressure_) {
+    // The oldest sample a clip still needs: that of the first queued trigger
+    // when the writer has yet to take it, or the writer's own.
+    while (true) {
+      uint32_t pinned;
+      const uint32_t trigger_head = trigger_head_.load(std::memory_order_acquire);
+      if (trigger_head != trigger_tail_.load(std::memory_order_relaxed)) {
+        pinned = triggers_[trigger_head % kTriggerQueueSize].start;
+      } else if (clip_open_.load(std::memory_order_acquire)) {
+        pinned = pinned_.load(std::memory_order_acquire);
+      } else {
+        break;
+      }
+      if (head + n - pinned <= reach_) {
+        break;
+      }
+      writer_waiter_.Wake();
+      vTaskDelay(1);
+    }
+  }
+
+  while (n > 0) {
+    const uint32_t offset = head & mask_;
+    const uint32_t piece = std::min<uint32_t>(n, capacity - offset);
+    memcpy(history_ + offset, samples, piece * sizeof(int16_t));
+    samples += piece;
+    n -= piece;
+    head += piece;
+  }
+  head_.store(head, std::memory_order_release);
+}
+
+void ClipRecorder::Trigger(int32_t audio_ms, int category) {
+  if (!task_started_ || audio_ms < 0) {
+    return;
+  }
+  triggers_count_.fetch_add(1, std::memory_order_relaxed);
+  const uint32_t tail = trigger_tail_.load(std::memory_order_relaxed);
+  if (tail - trigger_head_.load(std::memory_order_acquire) >= kTriggerQueueSize) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  const uint32_t at = static_cast<uint32_t>(audio_ms) * kSamplesPerMs;
+  Clip& trigger = triggers_[tail % kTriggerQueueSize];
+  trigger.start = at > pre_samples_ ? at - pre_samples_ : 0;
+  trigger.end = at + post_samples_;
+  trigger.category = category;
+  trigger_tail_.store(tail + 1, std::memory_order_release);
+  writer_waiter_.Wake();
+}
+
+void ClipRecorder::Flush() {
+  if (!task_started_) {
+    return;
+  }
+  flush_requested_.store(true, std::memory_order_release);
+  writer_waiter_.Wake();
+  while (flush_requested_.load(std::memory_order_acquire)) {
+    vTaskDelay(1);
+  }
+}
+
+void ClipRecorder::Reset() {
+  head_.store(0, std::memory_order_release);
+}
+
+ClipRecorder::Stats ClipRecorder::GetStats() const {
+  Stats stats;
+  stats.triggers = triggers_count_.load(std::memory_order_relaxed);
+  stats.merged = merged_.load(std::memory_order_relaxed);
+  stats.dropped = dropped_.load(std::memory_order_relaxed);
+  stats.clips = clips_.load(std::memory_order_relaxed);
+  stats.truncated = truncated_.load(std::memory_order_relaxed);
+  stats.write_errors = write_errors_.load(std::memory_order_relaxed);
+  stats.bytes_written = bytes_written_.load(std::memory_order_relaxed);
+  stats.write_max_us = write_max_us_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void ClipRecorder::TaskEntry(void* recorder) {
+  static_cast<ClipRecorder*>(recorder)->Run();
+}
+
+void ClipRecorder::Run() {
+  FindFileIndex();
+  while (true) {
+    // Sleep until a detection comes in, or, with a clip to write, until more
+    // of its audio did.
+    writer_waiter_.Wait([this] {
+      return trigger_tail_.load(std::memory_order_acquire) !=
+                 trigger_head_.load(std::memory_order_relaxed) ||
+             flush_requested_.load(std::memory_order_acquire);
+    }, pending_count_ > 0 ? pdMS_TO_TICKS(kPollMs) : portMAX_DELAY);
+    // Whatever was triggered before a flush request is in the queue by now.
+    const bool flush = flush_requested_.load(std::memory_order_acquire);
+    TakeTriggers();
+    int pending_before;
+    do {
+      pending_before = pending_count_;
+      WriteClip(flush);
+    } while (pending_count_ > 0 && pending_count_ < pending_before);
+    if (flush) {
+      flush_requested_.store(false, std::memory_order_release);
+    }
+  }
+}
+
+void ClipRecorder::TakeTriggers() {
+  uint32_t head = trigger_head_.load(std::memory_order_relaxed);
+  const uint32_t tail = trigger_tail_.load(std::memory_order_acquire);
+  for (; head != tail; ++head) {
+    const Clip& trigger = triggers_[head % kTriggerQueueSize];
+    Clip clip = trigger;
+    Clip* last = pending_count_ > 0 ? &pending_[pending_count_ - 1] : nullptr;
+    if (last != nullptr && !After(trigger.start, last->end)) {
+      // Overlaps the last clip: make that one longer instead, and carry on
+      // in a new clip what doesn't fit.
+      const uint32_t limit = last->start + max_clip_samples_;
+      if (After(trigger.end, last->end)) {
+        last->end = After(trigger.end, limit) ? limit : trigger.end;
+      }
+      clip.start = last->end;
+      if (!After(trigger.end, limit)) {
+        merged_.fetch_add(1, std::memory_order_relaxed);
+        trigger_head_.store(head + 1, std::memory_order_release);
+        continue;
+      }
+    }
+    if (pending_count_ < kMaxPendingClips) {
+      if (pending_count_ == 0) {
+        // Append() must not overwrite it once the trigger leaves the queue.
+        pinned_.store(clip.start, std::memory_order_relaxed);
+        clip_open_.store(true, std::memory_order_release);
+      }
+      pending_[pending_count_++] = clip;
+    } else {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+    trigger_head_.store(head + 1, std::memory_order_release);
+  }
+}
+
+void ClipRecorder::WriteClip(bool cut) {
+  if (pending_count_ == 0) {
+    return;
+  }
+  Clip& clip = pending_[0];
+  const uint32_t capacity = mask_ + 1;
+  uint32_t head = head_.load(std::memory_order_acquire);
+  if (!clip_started_) {
+    if (After(clip.start, head) && !cut) {
+      return;
+    }
+    // Without a file, the clip's audio is just skipped over below.
+    if (!OpenClipFile(clip)) {
+      write_errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+    clip_started_ = true;
+    write_pos_ = clip.start;
+  }
+  if (cut && After(clip.end, head)) {
+    clip.end = head;
+  }
+  if (After(head - reach_, write_pos_)) {
+    // The capture task has overwritten it, or is about to: leave it out.
+    write_pos_ = head - reach_;
+    clip_truncated_ = true;
+  }
+  if (After(write_pos_, clip.end)) {
+    write_pos_ = clip.end;
+  }
+
+  const uint32_t until = After(clip.end, head) ? head : clip.end;
+  const uint32_t available = After(until, write_pos_) ? until - write_pos_ : 0;
+  if (until != clip.end && available < kWriteChunkSamples) {
+    return;
+  }
+
+  // Straight from the history ring, in at most two pieces across its end
+  const int64_t start_us = esp_timer_get_time();
+  uint32_t left = available;
+  while (left > 0 && fd_ >= 0) {
+    const uint32_t offset = write_pos_ & mask_;
+    const size_t bytes = std::min(left, capacity - offset) * sizeof(int16_t);
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(history_ + offset);
+    size_t done = 0;
+    while (done < bytes) {
+      const ssize_t written = write(fd_, data + done, bytes - done);
+      if (written <= 0) {
+        ESP_LOGE(TAG, "Failed to write to %u.wav: %s", file_index_, strerror(errno));
+        write_errors_.fetch_add(1, std::memory_order_relaxed);
+        close(fd_);
+        fd_ = -1;
+        break;
+      }
+      done += written;
+    }
+    clip_bytes_ += done;
+    bytes_written_.fetch_add(done, std::memory_order_relaxed);
+    write_pos_ += bytes / sizeof(int16_t);
+    left -= bytes / sizeof(int16_t);
+  }
+  write_pos_ += left;
+  const int64_t write_us = esp_timer_get_time() - start_us;
+  if (write_us > write_max_us_.load(std::memory_order_relaxed)) {
+    write_max_us_.store(write_us, std::memory_order_relaxed);
+  }
+  // If the capture task lapped the writer meanwhile, some of what went out
+  // was newer audio.
+  if (After(head_.load(std::memory_order_acquire) - capacity, write_pos_ - available)) {
+    clip_truncated_ = true;
+  }
+  pinned_.store(write_pos_, std::memory_order_release);
+
+  if (write_pos_ == clip.end) {
+    FinishClipFile();
+    for (int i = 1; i < pending_count_; ++i) {
+      pending_[i - 1] = pending_[i];
+    }
+    pending_count_--;
+    if (pending_count_ > 0) {
+      pinned_.store(pending_[0].start, std::memory_order_release);
+    } else {
+      clip_open_.store(false, std::memory_order_release);
+    }
+  }
+}
+
+bool ClipRecorder::OpenClipFile(const Clip& clip) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%u.wav", directory_, file_index_);
+  fd_ = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    ESP_LOGE(TAG, "Failed to open clip file %s: %s", path, strerror(errno));
+    return false;
+  }
+  // Sizes are filled in once the clip is complete
+  uint8_t header[kWavHeaderSize];
+  MakeWavHeader(0, header);
+  if (write(fd_, header, sizeof(header)) != static_cast<ssize_t>(sizeof(header))) {
+    ESP_LOGE(TAG, "Failed to write to %s: %s", path, strerror(errno));
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  clip_bytes_ = 0;
+  clip_truncated_ = false;
+  ESP_LOGI(TAG, "Recording %s: %s, from %.2f s", path, kCategoryLabels[clip.category],
+           static_cast<double>(clip.start) / kAudioSampleFrequency);
+  return true;
+}
+
+void ClipRecorder::FinishClipFile() {
+  if (clip_truncated_) {
+    truncated_.fetch_add(1, std::memory_order_relaxed);
+  }
+  clip_started_ = false;
+  if (fd_ < 0) {
+    return;
+  }
+  uint8_t header[kWavHeaderSize];
+  MakeWavHeader(clip_bytes_, header);
+  if (lseek(fd_, 0, SEEK_SET) != 0 ||
+      write(fd_, header, sizeof(header)) != static_cast<ssize_t>(sizeof(header)) ||
+      fsync(fd_) != 0) {
+    ESP_LOGE(TAG, "Failed to finish %u.wav: %s", file_index_, strerror(errno));
+    write_errors_.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    clips_.fetch_add(1, std::memory_order_relaxed);
+    ESP_LOGI(TAG, "Wrote %u.wav: %.2f s%s", file_index_,
+             static_cast<double>(clip_bytes_) / sizeof(int16_t) / kAudioSampleFrequency,
+             clip_truncated_ ? ", truncated" : "");
+  }
+  close(fd_);
+  fd_ = -1;
+  file_index_++;
+}
+
+void ClipRecorder::FindFileIndex() {
+  // Continue after the highest numbered clip on the card
+  DIR* dir = opendir(directory_);
+  if (dir == nullptr) {
+    ESP_LOGE(TAG, "Failed to open %s directory: %s", directory_, strerror(errno));
+    return;
+  }
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    unsigned int index;
+    if (sscanf(entry->d_name, "%u.wav", &index) == 1) {
+      file_index_ = std::max(file_index_, index + 1);
+    }
+  }
+  closedir(dir);
+}
@@ -0,0 +1,147 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "esp_err.h"
+#include "task_waiter.h"
+
+// Records the audio around detections as WAV clips on the SD card.
+//
+// The capture task copies every block it captures into a history ring in
+// PSRAM with Append(), which never waits: the ring just overwrites its oldest
+// samples. The capture ring only keeps about a second of audio, less than a
+// clip reaches back, so the history is separate. It holds the pre-trigger
+// audio plus a couple of seconds for the detection to come in and for card
+// stalls, at most memory_kb. That is all the memory clips take: a clip is
+// streamed to the card from the ring itself, a piece at a time as the audio
+// comes in, without being copied anywhere else, so the audio still waiting to
+// be written always fits in it.
+//
+// A detection at audio time t (Trigger()) asks for the audio from
+// t - pre_trigger_ms to t + post_trigger_ms. Triggers go through a lock-free
+// queue to a background writer task, which merges each one that overlaps the
+// last clip into it, up to max_clip_ms, and writes the clips one after the
+// other. If the writer falls a whole ring behind, the audio it missed is left
+// out and the clip counted as truncated.
+class ClipRecorder {
+ public:
+  struct Config {
+    int pre_trigger_ms;
+    int post_trigger_ms;
+    int max_clip_ms;
+    int memory_kb;
+  };
+
+  // Counters since Start()
+  struct Stats {
+    uint32_t triggers;
+    // Triggers merged into the clip before them
+    uint32_t merged;
+    // Triggers lost because too many clips were waiting
+    uint32_t dropped;
+    uint32_t clips;
+    // Clips missing some of their audio, because it was overwritten first
+    uint32_t truncated;
+    uint32_t write_errors;
+    uint32_t bytes_written;
+    int64_t write_max_us;
+  };
+
+  // The CONFIG_CLIP_* settings, or their defaults on the host build
+  static Config DefaultConfig();
+
+  ClipRecorder() = default;
+  ClipRecorder(const ClipRecorder&) = delete;
+  ClipRecorder& operator=(const ClipRecorder&) = delete;
+
+  // Allocates the history ring and starts the writer task, which writes N.wav
+  // files to directory (created if needed). Calling it again does nothing.
+  esp_err_t Start(const char* directory, const Config& config);
+
+  // Capture side: adds the next n samples to the history. They're counted
+  // from audio time zero, like LatestAudioTimestamp().
+  void Append(const int16_t* samples, int n);
+  // Offline capture has no deadline: with wait set, Append() waits for the
+  // writer instead of overwriting audio a clip still needs.
+  void SetBackpressure(bool wait) { backpressure_ = wait; }
+
+  // Detection side, for one task only: records a clip around audio time
+  // audio_ms, where category was detected. Never blocks.
+  void Trigger(int32_t audio_ms, int category);
+
+  // Blocks until every clip triggered so far is written, cutting the ones
+  // that would go on past the audio appended so far.
+  void Flush();
+  // Starts the history over at audio time zero, for a new audio stream.
+  // Only safe after Flush(), while nothing is appended.
+  void Reset();
+
+  Stats GetStats() const;
+
+ private:
+  struct Clip {
+    uint32_t start;  // sample positions in the history
+    uint32_t end;
+    int category;
+  };
+
+  static constexpr int kTriggerQueueSize = 8;
+  static constexpr int kMaxPendingClips = 4;
+  // How often the writer looks for more audio while a clip is open
+  static constexpr int kPollMs = 100;
+
+  static void TaskEntry(void* recorder);
+  void Run();
+  // Merges the queued triggers into the pending clips.
+  void TakeTriggers();
+  // Writes as much of the first pending clip as has been captured, and
+  // finishes it once it's complete. With cut set, it's complete at the
+  // newest sample appended.
+  void WriteClip(bool cut);
+  bool OpenClipFile(const Clip& clip);
+  void FinishClipFile();
+  void FindFileIndex();
+
+  const char* directory_ = nullptr;
+  uint32_t pre_samples_ = 0;
+  uint32_t post_samples_ = 0;
+  uint32_t max_clip_samples_ = 0;
+  bool task_started_ = false;
+  bool backpressure_ = false;
+
+  int16_t* history_ = nullptr;
+  uint32_t mask_ = 0;
+  // How far behind the newest sample the writer still reads from the ring
+  uint32_t reach_ = 0;
+  // Samples appended since audio time zero: written by the capture task only
+  std::atomic<uint32_t> head_{0};
+  // Oldest sample the writer still needs, while clip_open_ is set
+  std::atomic<uint32_t> pinned_{0};
+  std::atomic<bool> clip_open_{false};
+
+  // Trigger queue: the detection side owns trigger_tail_, the writer
+  // trigger_head_.
+  Clip triggers_[kTriggerQueueSize] = {};
+  std::atomic<uint32_t> trigger_head_{0};
+  std::atomic<uint32_t> trigger_tail_{0};
+  TaskWaiter writer_waiter_;
+  std::atomic<bool> flush_requested_{false};
+
+  // Writer task state: pending_[0] is the clip being written.
+  Clip pending_[kMaxPendingClips] = {};
+  int pending_count_ = 0;
+  bool clip_started_ = false;
+  int fd_ = -1;
+  unsigned int file_index_ = 0;
+  uint32_t write_pos_ = 0;
+  uint32_t clip_bytes_ = 0;
+  bool clip_truncated_ = false;
+
+  std::atomic<uint32_t> triggers_count_{0};
+  std::atomic<uint32_t> merged_{0};
+  std::atomic<uint32_t> dropped_{0};
+  std::atomic<uint32_t> clips_{0};
+  std::atomic<uint32_t> truncated_{0};
+  std::atomic<uint32_t> write_errors_{0};
+  std::atomic<uint32_t> bytes_written_{0};
+  std::atomic<int64_t> write_max_us_{0};
+};
@@ -0,0 +1,70 @@
+#include "cpu_idle.h"
+
+#if defined(ESP_PLATFORM)
+#include "esp_idf_version.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS && \
+    ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 1, 0)
+// The run-time counters may be 32 bits wide: differences have to wrap at the
+// same width.
+using RunTime = configRUN_TIME_COUNTER_TYPE;
+
+// Run time of each core's idle task and the run-time clock.
+static int ReadIdleTimes(uint64_t idle_time[CpuIdleMonitor::kMaxCores], uint64_t* time) {
+  const int cores = portNUM_PROCESSORS < CpuIdleMonitor::kMaxCores
+                        ? portNUM_PROCESSORS : CpuIdleMonitor::kMaxCores;
+  for (int core = 0; core < cores; ++core) {
+    idle_time[core] = ulTaskGetRunTimeCounter(xTaskGetIdleTaskHandleForCore(core));
+  }
+  *time = portGET_RUN_TIME_COUNTER_VALUE();
+  return cores;
+}
+#else
+using RunTime = uint64_t;
+
+static int ReadIdleTimes(uint64_t idle_time[CpuIdleMonitor::kMaxCores], uint64_t* time) {
+  return 0;
+}
+#endif
+#else
+#include <ctime>
+
+using RunTime = uint64_t;
+
+// Wall-clock time the process wasn't running on a CPU, and the wall clock,
+// in nanoseconds.
+static int ReadIdleTimes(uint64_t idle_time[CpuIdleMonitor::kMaxCores], uint64_t* time) {
+  timespec wall;
+  timespec cpu;
+  clock_gettime(CLOCK_MONOTONIC, &wall);
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+  *time = wall.tv_sec * 1000000000ull + wall.tv_nsec;
+  idle_time[0] = *time - (cpu.tv_sec * 1000000000ull + cpu.tv_nsec);
+  return 1;
+}
+#endif
+
+CpuIdleMonitor::CpuIdleMonitor() : last_idle_time_{}, last_time_(0) {
+  ReadIdleTimes(last_idle_time_, &last_time_);
+}
+
+int CpuIdleMonitor::Sample(float idle_percent[kMaxCores]) {
+  uint64_t idle_time[kMaxCores] = {};
+  uint64_t time = 0;
+  const int cores = ReadIdleTimes(idle_time, &time);
+  const RunTime elapsed = static_cast<RunTime>(time - last_time_);
+  for (int core = 0; core < cores; ++core) {
+    const RunTime idle = static_cast<RunTime>(idle_time[core] - last_idle_time_[core]);
+    // On the host, several busy threads can add up to more than the wall
+    // clock: that's no idle time at all.
+    idle_percent[core] = elapsed > 0 && idle <= elapsed
+                             ? 100.0f * static_cast<float>(idle) / elapsed
+                             : 0.0f;
+    last_idle_time_[core] = idle_time[core];
+  }
+  last_time_ = time;
+  return cores;
+}
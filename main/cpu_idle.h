@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+
+// Measures how much of the time each core spends in its idle task, i.e. what
+// capture, feature extraction and inference leave over. On the board this
+// needs CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS. On the host there's a single
+// figure: the share of one core the process left unused.
+class CpuIdleMonitor {
+ public:
+  static constexpr int kMaxCores = 2;
+
+  CpuIdleMonitor();
+
+  // Writes the idle percentage of each core since the previous call (or since
+  // construction) to idle_percent and returns the number of cores, 0 if it
+  // can't be measured.
+  int Sample(float idle_percent[kMaxCores]);
+
+ private:
+  uint64_t last_idle_time_[kMaxCores];
+  uint64_t last_time_;
+};
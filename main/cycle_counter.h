@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+
+// Cheap, high resolution timestamps for benchmarks: the CPU cycle counter on
+// the board, the monotonic clock in nanoseconds on the host. Only differences
+// between two readings are meaningful, and they wrap after 2^32 counts
+// (about 18s at 240MHz, 4s on the host).
+#if defined(ESP_PLATFORM)
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+
+inline uint32_t CycleCount() { return esp_cpu_get_cycle_count(); }
+inline uint32_t CycleCountsPerUs() { return esp_rom_get_cpu_ticks_per_us(); }
+#else
+#include <chrono>
+
+inline uint32_t CycleCount() {
+  return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+inline uint32_t CycleCountsPerUs() { return 1000; }
+#endif
@@ -14,6 +14,12 @@ limitations under the License.
 
  NOTICE: this file was modified such that the feature provider's feature extraction
  could run in its own task, in parallel with inference rather than serially.
+ The spectrogram is kept as a ring of slices rather than shifted every stride,
+ and complete spectrograms are published to the inference loop through a
+ FrameHandoff.
+ Missing slices are computed in one pass over a single span of audio, each
+ from the audio position it stands for. New slices feed an activity gate.
+ Each step is traced as a pipeline stage.
 ==============================================================================*/
 
 #include <freertos/FreeRTOS.h>
@@ -21,6 +27,7 @@ limitations under the License.
 
 #include <esp_log.h>
 
+#include <algorithm>
 #include <cstring>
 #include <esp_timer.h>
 #include "feature_provider.h"
@@ -28,18 +35,30 @@ limitations under the License.
 #include "audio_provider.h"
 #include "micro_features_generator.h"
 #include "micro_model_settings.h"
+#include "pipeline_trace.h"
 #include "tensorflow/lite/micro/micro_log.h"
 
 
 Features g_features;
 const char *TAG = "feature_provider";
 
-FeatureProvider::FeatureProvider(int feature_size, int8_t* feature_data)
+constexpr int kFeatureWindowSamples = kFeatureDurationMs * kAudioSampleFrequency / 1000;
+constexpr int kFeatureStrideSamples = kFeatureStrideMs * kAudioSampleFrequency / 1000;
+
+FeatureProvider::FeatureProvider(int feature_size, int8_t* feature_data,
+                                 FrameHandoff* frame_handoff,
+                                 ActivityGate* activity_gate)
     : feature_size_(feature_size),
       feature_data_(feature_data),
       is_first_run_(true),
+      oldest_slice_(0),
+      audio_end_ms_(0),
+      filled_slices_(0),
+      frame_handoff_(frame_handoff),
+      activity_gate_(activity_gate),
+      frame_pending_(false),
       task_params{},
-      n_new_slices(0){
+      n_new_slices(0) {
   // Initialize the feature data to default values.
   for (int n = 0; n < feature_size_; ++n) {
     feature_data_[n] = 0;
@@ -56,31 +75,27 @@ static void ComputeFeatures(void *pvParameters) {
   xLastWakeTime = xTaskGetTickCount();
   ESP_LOGI(TAG, "Feature provider task starting");
   auto *params = (fp_task_params_t *)pvParameters;
-  int how_many_new_slices = 0;
-  int32_t previous_time = 0;
   while(true) {
     ESP_LOGD(TAG, "Feature provider running at tick: %lu", xTaskGetTickCount());
     const int32_t current_time = LatestAudioTimestamp();
-    ESP_LOGD(TAG, "Last time: %ld, cur time: %ld", previous_time, current_time);
+    ESP_LOGD(TAG, "Cur time: %ld", current_time);
     *(params->n_new_slices) = 0;
-    TfLiteStatus feature_status = params->populate_func(previous_time, current_time, params->n_new_slices);
+    TfLiteStatus feature_status = params->populate_func(current_time, params->n_new_slices);
     if (feature_status != kTfLiteOk) {
       MicroPrintf("Feature generation failed");
       vTaskDelete(nullptr);
       return;
     }
-    previous_time = current_time;
     xTaskDelayUntil(&xLastWakeTime, xFrequency);
   }
 }
 
 
 TfLiteStatus FeatureProvider::InitFeatureExtraction() {
-  task_params.populate_func = [this](auto && PH1, auto && PH2, auto && PH3) {
+  task_params.populate_func = [this](auto && PH1, auto && PH2) {
     return this->PopulateFeatureData(
       std::forward<decltype(PH1)>(PH1),
-      std::forward<decltype(PH2)>(PH2),
-      std::forward<decltype(PH3)>(PH3));
+      std::forward<decltype(PH2)>(PH2));
   };
   task_params.n_new_slices = &n_new_slices;
 
@@ -98,21 +113,21 @@ TfLiteStatus FeatureProvider::InitFeatureExtraction() {
 }
 
 
+void MaterializeFeatureSlices(const int8_t* slices, int oldest_slice, int8_t* output) {
+  const int oldest_bytes = (kFeatureCount - oldest_slice) * kFeatureSize;
+  memcpy(output, slices + oldest_slice * kFeatureSize, oldest_bytes);
+  memcpy(output + oldest_bytes, slices, oldest_slice * kFeatureSize);
+}
+
+
 TfLiteStatus FeatureProvider::PopulateFeatureData(
-    int32_t last_time_in_ms, int32_t time_in_ms, std::atomic<int>* how_many_new_slices) {
+    int32_t time_in_ms, std::atomic<int>* how_many_new_slices) {
   if (feature_size_ != kFeatureElementCount) {
     MicroPrintf("Requested feature_data_ size %d doesn't match %d",
                 feature_size_, kFeatureElementCount);
     return kTfLiteError;
   }
 
-  // Quantize the time into steps as long as each window stride, so we can
-  // figure out which audio data we need to fetch.
-  const int last_step = (last_time_in_ms / kFeatureStrideMs);
-  const int current_step = (time_in_ms / kFeatureStrideMs);
-
-  int slices_needed = current_step - last_step;
-  ESP_LOGD(TAG, "Slices needed: %d", slices_needed);
   // If this is the first call, make sure we don't use any cached information.
   if (is_first_run_) {
     TfLiteStatus init_status = InitializeMicroFeatures();
@@ -120,74 +135,129 @@ TfLiteStatus FeatureProvider::PopulateFeatureData(
       return init_status;
     }
     ESP_LOGI(TAG, "InitializeMicroFeatures successful");
+    // Audio time starts with the recording: the first slices are only due
+    // once it's running.
+    TfLiteStatus audio_status = StartAudioRecording();
+    if (audio_status != kTfLiteOk) {
+      return audio_status;
+    }
     is_first_run_ = false;
-    slices_needed = kFeatureCount;
   }
 
+  // Quantize the time into steps as long as each window stride: the window of
+  // step n ends n strides into the audio. The ring has been read up to
+  // audio_end_ms_, so the slices missing are those of the steps since then.
+  const int current_step = (time_in_ms / kFeatureStrideMs);
+  int slices_needed = current_step - (audio_end_ms_ / kFeatureStrideMs);
+  ESP_LOGD(TAG, "Slices needed: %d", slices_needed);
+
+  // After a stall, the steps that would be pushed out of the spectrogram by
+  // newer ones before it's ever published aren't worth computing.
   if (slices_needed > kFeatureCount) {
+    const int skipped = SkipAudioWindows(slices_needed - kFeatureCount);
+    audio_end_ms_ += skipped * kFeatureStrideMs;
     slices_needed = kFeatureCount;
   }
 
-  const int slices_to_keep = kFeatureCount - slices_needed;
-  const int slices_to_drop = kFeatureCount - slices_to_keep;
-  // If we can avoid recalculating some slices, just move the existing data
-  // up in the spectrogram, to perform something like this:
+  // The slices we can avoid recalculating stay where they are: the new ones
+  // overwrite the oldest, and the ring's start moves past them.
   // last time = 80ms          current time = 120ms
   // +-----------+             +-----------+
-  // | data@20ms |         --> | data@60ms |
-  // +-----------+       --    +-----------+
-  // | data@40ms |     --  --> | data@80ms |
-  // +-----------+   --  --    +-----------+
-  // | data@60ms | --  --      |  <empty>  |
-  // +-----------+   --        +-----------+
-  // | data@80ms | --          |  <empty>  |
+  // | data@20ms | <- oldest   | data@100ms|
   // +-----------+             +-----------+
-  if (slices_to_keep > 0) {
-    for (int dest_slice = 0; dest_slice < slices_to_keep; ++dest_slice) {
-      int8_t* dest_slice_data =
-          feature_data_ + (dest_slice * kFeatureSize);
-      const int src_slice = dest_slice + slices_to_drop;
-      const int8_t* src_slice_data =
-          feature_data_ + (src_slice * kFeatureSize);
-      for (int i = 0; i < kFeatureSize; ++i) {
-        dest_slice_data[i] = src_slice_data[i];
-      }
+  // | data@40ms |             | data@120ms|
+  // +-----------+             +-----------+
+  // | data@60ms |             | data@60ms | <- oldest
+  // +-----------+             +-----------+
+  // | data@80ms |             | data@80ms |
+  // +-----------+             +-----------+
+  // The audio of all the missing slices is read as one span, and the features
+  // of every window in it computed in a single pass, each from its own offset.
+  // Spans are only split when the ring can't hand that much out at once.
+  int oldest_slice = oldest_slice_;
+  int slices_done = 0;
+  while (slices_done < slices_needed) {
+    const int16_t* audio_samples = nullptr;
+    int windows = 0;
+    TfLiteStatus audio_status;
+    {
+      TRACE_STAGE(kAudioSpan);
+      audio_status = GetAudioSpan(slices_needed - slices_done, &windows, &audio_samples);
+    }
+    if (audio_status != kTfLiteOk) {
+      return audio_status;
+    }
+    if (windows == 0) {
+      ESP_LOGD(TAG, "No audio for %d slices", slices_needed - slices_done);
+      break;
+    }
+    TfLiteStatus generate_status;
+    {
+      TRACE_STAGE(kFeatures);
+      generate_status = GenerateFeatures(
+          audio_samples, kFeatureWindowSamples + (windows - 1) * kFeatureStrideSamples,
+          &g_features);
+    }
+    if (generate_status != kTfLiteOk) {
+      return generate_status;
     }
-  }
-  // Any slices that need to be filled in with feature data have their
-  // appropriate audio data pulled, and features calculated for that slice.
-  if (slices_needed > 0) {
-    for (int new_slice = slices_to_keep; new_slice < kFeatureCount;
-         ++new_slice) {
-      const int new_step = (current_step - kFeatureCount + 1) + new_slice;
-      const int32_t slice_start_ms = (new_step * kFeatureStrideMs);
-      int16_t* audio_samples = nullptr;
-      int audio_samples_size = 0;
-      // TODO(petewarden): Fix bug that leads to non-zero slice_start_ms
-      GetAudioSamples(&audio_samples_size, &audio_samples);
-      if (audio_samples_size < kMaxAudioSampleSize) {
-        ESP_LOGI(TAG, "Audio data size %d too small, want %d",
-                    audio_samples_size, kMaxAudioSampleSize);
-        return kTfLiteError;
-      }
-      int8_t* new_slice_data = feature_data_ + (new_slice * kFeatureSize);
-
-      TfLiteStatus generate_status = GenerateFeatures(
-            audio_samples, audio_samples_size, &g_features);
-      if (generate_status != kTfLiteOk) {
-        return generate_status;
-      }
 
-      // copy features
-      for (int j = 0; j < kFeatureSize; ++j) {
-        new_slice_data[j] = g_features[0][j];
+    // copy features
+    TRACE_STAGE(kSliceStore);
+    for (int i = 0; i < windows; ++i) {
+      memcpy(feature_data_ + (oldest_slice * kFeatureSize), g_features[i], kFeatureSize);
+      oldest_slice = (oldest_slice + 1) % kFeatureCount;
+      if (activity_gate_ != nullptr) {
+        activity_gate_->Update(g_features[i], audio_end_ms_ + (i + 1) * kFeatureStrideMs);
       }
     }
+    slices_done += windows;
+    audio_end_ms_ += windows * kFeatureStrideMs;
   }
-  *how_many_new_slices = slices_needed;
+  oldest_slice_ = oldest_slice;
+  filled_slices_ = std::min(filled_slices_ + slices_done, kFeatureCount);
+  // Until the spectrogram has been filled once it's partly silence, not worth
+  // classifying.
+  if (frame_handoff_ != nullptr && filled_slices_ == kFeatureCount &&
+      (slices_done > 0 || frame_pending_)) {
+    const int32_t active_end_ms = activity_gate_ != nullptr
+        ? activity_gate_->last_active_end_ms() : audio_end_ms_;
+    TRACE_STAGE(kInputCopy);
+    frame_pending_ = !frame_handoff_->Publish(feature_data_, oldest_slice,
+                                              audio_end_ms_, active_end_ms);
+  }
+  *how_many_new_slices = slices_done;
   return kTfLiteOk;
 }
 
+TfLiteStatus FeatureProvider::ExtractNextStride() {
+  // Pretend exactly one stride of audio arrived since the previous call, or a
+  // whole spectrogram's worth at first
+  const int32_t time_in_ms = filled_slices_ < kFeatureCount
+      ? kFeatureCount * kFeatureStrideMs
+      : audio_end_ms_ + kFeatureStrideMs;
+  n_new_slices = 0;
+  return PopulateFeatureData(time_in_ms, &n_new_slices);
+}
+
+void FeatureProvider::Reset() {
+  is_first_run_ = true;
+  oldest_slice_ = 0;
+  audio_end_ms_ = 0;
+  filled_slices_ = 0;
+  frame_pending_ = false;
+  if (frame_handoff_ != nullptr) {
+    frame_handoff_->Reset();
+  }
+  if (activity_gate_ != nullptr) {
+    activity_gate_->Reset();
+  }
+  n_new_slices = 0;
+  for (int n = 0; n < feature_size_; ++n) {
+    feature_data_[n] = 0;
+  }
+}
+
 int FeatureProvider::GetNewSlicesN() {
   return n_new_slices;
 }
@@ -19,14 +19,19 @@ limitations under the License.
 #include <atomic>
 #include <functional>
 #include "tensorflow/lite/c/common.h"
+#include "activity_gate.h"
+#include "frame_handoff.h"
 
 
-typedef std::function<TfLiteStatus(int32_t, int32_t, std::atomic<int>*)> PopulateFeatureDataFunc;
+typedef std::function<TfLiteStatus(int32_t, std::atomic<int>*)> PopulateFeatureDataFunc;
 typedef struct {
   PopulateFeatureDataFunc populate_func;
   std::atomic<int> *n_new_slices;
 } fp_task_params_t;
 
+// Copies a spectrogram stored as a ring of kFeatureCount slices, whose oldest
+// slice sits at index oldest_slice, to output in time order (two memcpys).
+void MaterializeFeatureSlices(const int8_t* slices, int oldest_slice, int8_t* output);
 
 // Binds itself to an area of memory intended to hold the input features for an
 // audio-recognition neural network model, and fills that data area with the
@@ -35,23 +40,37 @@ typedef struct {
 // horizontal slices representing the frequencies at one point in time, stacked
 // on top of each other to form a spectrogram showing how those frequencies
 // changed over time.
+// The memory is used as a ring of slices: each stride overwrites the oldest
+// slices with the new ones instead of moving the whole spectrogram up, and
+// every update is published to the FrameHandoff as a complete frame, in time
+// order. Each new slice also goes through the ActivityGate, if there is one,
+// and the frames say where the last active slice was.
 class FeatureProvider {
  public:
   // Create the provider, and bind it to an area of memory. This memory should
   // remain accessible for the lifetime of the provider object, since subsequent
   // calls will fill it with feature data. The provider does no memory
   // management of this data.
-  FeatureProvider(int feature_size, int8_t* feature_data);
+  FeatureProvider(int feature_size, int8_t* feature_data,
+                  FrameHandoff* frame_handoff = nullptr,
+                  ActivityGate* activity_gate = nullptr);
   ~FeatureProvider();
 
   TfLiteStatus InitFeatureExtraction();
   int GetNewSlicesN();
 
+  // Offline alternative to the periodic feature task: processes exactly one
+  // more stride of audio on the calling thread (the whole spectrogram until
+  // it has been filled), without waiting for the wall clock.
+  TfLiteStatus ExtractNextStride();
+  // Starts over with an empty spectrogram, e.g. for a new audio source.
+  void Reset();
+
  private:
 
-  // Fills the feature data with information from audio inputs, and returns how
-  // many feature slices were updated.
-  TfLiteStatus PopulateFeatureData(int32_t last_time_in_ms, int32_t time_in_ms,
+  // Fills the feature data with information from audio inputs up to
+  // time_in_ms, and returns how many feature slices were updated.
+  TfLiteStatus PopulateFeatureData(int32_t time_in_ms,
                                    std::atomic<int>* how_many_new_slices);
 
   int feature_size_;
@@ -59,6 +78,16 @@ class FeatureProvider {
   // Make sure we don't try to use cached information if this is the first call
   // into the provider.
   bool is_first_run_;
+  // Ring slot of the oldest slice, where the next new slice goes
+  std::atomic<int> oldest_slice_;
+  // Audio time at which the newest window read ends, published with frames
+  int32_t audio_end_ms_;
+  // Slices computed since the start, up to kFeatureCount
+  int filled_slices_;
+  FrameHandoff* frame_handoff_;
+  ActivityGate* activity_gate_;
+  // The last update couldn't be published yet
+  bool frame_pending_;
   fp_task_params_t task_params;
   std::atomic<int> n_new_slices;
 };
@@ -0,0 +1,124 @@
+#include "frame_handoff.h"
+
+#include <cstring>
+#include "feature_provider.h"
+
+FrameHandoff::FrameHandoff(int8_t* frame, int8_t* spare, int frame_size)
+    : frame_(frame), spare_(spare), frame_size_(frame_size) {}
+
+bool FrameHandoff::ClaimForFilling(std::atomic<uint8_t>* state, bool* had_frame) {
+  uint8_t current = state->load(std::memory_order_acquire);
+  while (current == kIdle || current == kReady) {
+    if (state->compare_exchange_weak(current, kFilling, std::memory_order_acq_rel)) {
+      *had_frame = current == kReady;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool FrameHandoff::Publish(const int8_t* slices, int oldest_slice,
+                           int32_t audio_end_ms, int32_t active_end_ms) {
+  const uint32_t sequence = published_.load(std::memory_order_relaxed) + 1;
+  bool had_frame = false;
+  if (ClaimForFilling(&frame_state_, &had_frame)) {
+    MaterializeFeatureSlices(slices, oldest_slice, frame_);
+    frame_info_ = {sequence, audio_end_ms, active_end_ms};
+    published_.store(sequence, std::memory_order_relaxed);
+    frame_state_.store(kReady, std::memory_order_release);
+    if (had_frame) {
+      skipped_.fetch_add(1, std::memory_order_relaxed);
+    }
+    // Whatever the spare held is older than this frame now.
+    uint8_t ready = kReady;
+    if (spare_state_.compare_exchange_strong(ready, kIdle, std::memory_order_acq_rel)) {
+      skipped_.fetch_add(1, std::memory_order_relaxed);
+    }
+    consumer_waiter_.Wake();
+    return true;
+  }
+  // The consumer is busy with the frame buffer.
+  if (ClaimForFilling(&spare_state_, &had_frame)) {
+    MaterializeFeatureSlices(slices, oldest_slice, spare_);
+    spare_info_ = {sequence, audio_end_ms, active_end_ms};
+    published_.store(sequence, std::memory_order_relaxed);
+    spare_state_.store(kReady, std::memory_order_release);
+    if (had_frame) {
+      skipped_.fetch_add(1, std::memory_order_relaxed);
+    }
+    consumer_waiter_.Wake();
+    return true;
+  }
+  return false;
+}
+
+bool FrameHandoff::Acquire(FrameInfo* info) {
+  uint8_t frame_state = frame_state_.load(std::memory_order_acquire);
+  do {
+    if (frame_state == kFilling) {
+      // A newer frame is being written in place: come back for it.
+      return false;
+    }
+  } while (!frame_state_.compare_exchange_weak(frame_state, kBusy,
+                                               std::memory_order_acq_rel));
+  bool fresh = frame_state == kReady;
+
+  uint8_t spare_state = kReady;
+  if (spare_state_.compare_exchange_strong(spare_state, kBusy,
+                                           std::memory_order_acq_rel)) {
+    // The spare was normally filled while we held the frame buffer, but the
+    // producer may have published in place since and not invalidated it yet.
+    if (static_cast<int32_t>(spare_info_.sequence - frame_info_.sequence) > 0) {
+      if (fresh) {
+        skipped_.fetch_add(1, std::memory_order_relaxed);
+      }
+      memcpy(frame_, spare_, frame_size_);
+      frame_info_ = spare_info_;
+      fresh = true;
+    } else {
+      skipped_.fetch_add(1, std::memory_order_relaxed);
+    }
+    spare_state_.store(kIdle, std::memory_order_release);
+  }
+
+  if (!fresh) {
+    frame_state_.store(kIdle, std::memory_order_release);
+    return false;
+  }
+  consumed_.fetch_add(1, std::memory_order_relaxed);
+  *info = frame_info_;
+  return true;
+}
+
+bool FrameHandoff::WaitAndAcquire(FrameInfo* info, TickType_t ticks_to_wait) {
+  if (Acquire(info)) {
+    return true;
+  }
+  // While a frame is being written in place, wait for it to be complete
+  // rather than for the spare: Acquire() would turn it down anyway.
+  auto frame_pending = [this] {
+    const uint8_t frame_state = frame_state_.load(std::memory_order_acquire);
+    return frame_state == kReady ||
+           (frame_state != kFilling &&
+            spare_state_.load(std::memory_order_acquire) == kReady);
+  };
+  return consumer_waiter_.Wait(frame_pending, ticks_to_wait) && Acquire(info);
+}
+
+void FrameHandoff::Release() {
+  frame_state_.store(kIdle, std::memory_order_release);
+}
+
+void FrameHandoff::Reset() {
+  consumer_waiter_.Reset();
+  frame_state_.store(kIdle, std::memory_order_relaxed);
+  spare_state_.store(kIdle, std::memory_order_release);
+}
+
+FrameHandoff::Stats FrameHandoff::GetStats() const {
+  return {
+      published_.load(std::memory_order_relaxed),
+      consumed_.load(std::memory_order_relaxed),
+      skipped_.load(std::memory_order_relaxed),
+  };
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include "task_waiter.h"
+
+// Hands complete spectrograms from the feature task (producer) to the
+// inference loop (consumer) without locks and without torn frames.
+//
+// Frames are written straight into the classifier's input tensor whenever
+// the consumer isn't running inference on it, so there is no per-inference
+// copy. While it is, the producer writes to a spare buffer instead, which the
+// consumer copies over the tensor when it comes back for the next frame. The
+// consumer always gets the newest frame: older ones that were never consumed
+// are counted as skipped. The producer never waits; the consumer can sleep
+// until a frame is published with WaitAndAcquire().
+class FrameHandoff {
+ public:
+  // Where a frame sits in the stream. audio_end_ms is the audio time, as
+  // counted by LatestAudioTimestamp(), at which its newest slice ends, and
+  // active_end_ms where the newest slice the ActivityGate found active ends
+  // (-1 if none yet; audio_end_ms when there's no gate).
+  struct FrameInfo {
+    uint32_t sequence;  // 1 for the first frame published, and so on
+    int32_t audio_end_ms;
+    int32_t active_end_ms;
+  };
+
+  struct Stats {
+    uint32_t published;
+    uint32_t consumed;
+    uint32_t skipped;
+  };
+
+  // frame is where the consumer reads frames from, spare a scratch buffer,
+  // both frame_size bytes.
+  FrameHandoff(int8_t* frame, int8_t* spare, int frame_size);
+
+  // Producer side: materializes the spectrogram ring (see
+  // MaterializeFeatureSlices()) as the next frame. Returns false when both
+  // buffers are in use, in which case the frame wasn't published and the
+  // caller should try again with the next stride.
+  bool Publish(const int8_t* slices, int oldest_slice, int32_t audio_end_ms,
+               int32_t active_end_ms);
+
+  // Consumer side: makes the frame buffer hold the newest published frame
+  // and hands it over, or returns false if nothing newer than the last frame
+  // acquired was published since. After a true return the producer keeps off
+  // the frame buffer until Release().
+  bool Acquire(FrameInfo* info);
+  // Acquire() that blocks the calling task, on its task notification, for up
+  // to ticks_to_wait until there is a new frame. It can give up early when it
+  // races with the producer, so call it in a loop.
+  bool WaitAndAcquire(FrameInfo* info, TickType_t ticks_to_wait);
+  void Release();
+
+  // Forgets any pending frame, e.g. when starting over on a new audio stream.
+  // The counters keep going. Only safe while neither side is using it.
+  void Reset();
+
+  Stats GetStats() const;
+
+ private:
+  enum State : uint8_t { kIdle, kFilling, kReady, kBusy };
+
+  // Moves state from kIdle or kReady to kFilling, telling whether it held an
+  // unconsumed frame.
+  static bool ClaimForFilling(std::atomic<uint8_t>* state, bool* had_frame);
+
+  int8_t* const frame_;
+  int8_t* const spare_;
+  const int frame_size_;
+  std::atomic<uint8_t> frame_state_{kIdle};
+  std::atomic<uint8_t> spare_state_{kIdle};
+  TaskWaiter consumer_waiter_;
+  // Only touched by whoever moved the matching state out of kIdle/kReady.
+  FrameInfo frame_info_ = {};
+  FrameInfo spare_info_ = {};
+
+  std::atomic<uint32_t> published_{0};  // also the last sequence number used
+  std::atomic<uint32_t> consumed_{0};
+  std::atomic<uint32_t> skipped_{0};
+};
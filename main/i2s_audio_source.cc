@@ -0,0 +1,249 @@
+/* Copyright 2019 The TensorFlow Authors. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+NOTICE: This file has been split out of audio_provider.cc:
+- More recent i2s API from idf
+- Use ES7210 ADC chip
+- Remove unneeded code
+- The samples are conditioned (DC offset, gain, clipping count) while they're
+  converted
+- Optional multi-channel TDM capture, combined to mono
+- The read and the conversion are traced as pipeline stages
+==============================================================================*/
+
+#include "i2s_audio_source.h"
+
+// FreeRTOS.h must be included before some of the following dependencies.
+// Solves b/150260343.
+// clang-format off
+#include "freertos/FreeRTOS.h"
+// clang-format on
+
+#include <esp_check.h>
+#include "driver/i2s_tdm.h"
+#include "es7210.h"
+#include "esp_log.h"
+#include "pipeline_trace.h"
+#include "sdkconfig.h"
+
+static const char* TAG = "TF_LITE_AUDIO_PROVIDER";
+
+namespace {
+#if CONFIG_IDF_TARGET_ESP32
+i2s_port_t i2s_port = I2S_NUM_1; // for esp32-eye
+#else
+i2s_port_t i2s_port = I2S_NUM_0; // for esp32-s3-eye
+#endif
+}  // namespace
+
+
+static int es7210_codec_init() {
+    ESP_LOGI(TAG, "Init I2C used to configure ES7210");
+    i2c_config_t i2c_conf = {
+        .mode = I2C_MODE_MASTER,
+        .sda_io_num = GPIO_NUM_17,
+        .scl_io_num = GPIO_NUM_18,
+        .sda_pullup_en = GPIO_PULLUP_ENABLE,
+        .scl_pullup_en = GPIO_PULLUP_ENABLE,
+        .master = {
+            .clk_speed = 100000,
+        }
+    };
+    ESP_RETURN_ON_ERROR(i2c_param_config(I2C_NUM_0, &i2c_conf), TAG, "Failed to configure I2C parameters");
+    ESP_RETURN_ON_ERROR(i2c_driver_install(I2C_NUM_0, i2c_conf.mode, 0, 0, 0), TAG, "Failed to install I2C driver");
+
+    /* Create ES7210 device handle */
+    es7210_dev_handle_t es7210_handle = nullptr;
+    es7210_i2c_config_t es7210_i2c_conf = {
+        .i2c_port = I2C_NUM_0,
+        .i2c_addr = 0x40
+    };
+    ESP_RETURN_ON_ERROR(es7210_new_codec(&es7210_i2c_conf, &es7210_handle), TAG, "Failed to instantiate codec.");
+
+    ESP_LOGI(TAG, "Configure ES7210 codec parameters");
+    es7210_codec_config_t codec_conf = {
+        .sample_rate_hz = 16000,
+        .mclk_ratio = I2S_MCLK_MULTIPLE_256,
+        .i2s_format = ES7210_I2S_FMT_I2S,
+        .bit_width = (es7210_i2s_bits_t)(I2S_DATA_BIT_WIDTH_32BIT),
+        .mic_bias = ES7210_MIC_BIAS_2V87,
+        .mic_gain = ES7210_MIC_GAIN_33DB,
+        .flags = {
+            .tdm_enable = true
+        }
+    };
+    ESP_RETURN_ON_ERROR(es7210_config_codec(es7210_handle, &codec_conf), TAG, "Failed to config codec");
+    ESP_RETURN_ON_ERROR(es7210_config_volume(es7210_handle, 0), TAG, "Failed to config volume");
+    return ESP_OK;
+}
+
+static int i2s_init(i2s_chan_handle_t &rx_handle) {
+  // Start listening for audio: MONO @ 16KHz
+  i2s_std_config_t std_config = {
+    .clk_cfg = {
+      .sample_rate_hz = 16000,
+        .clk_src = I2S_CLK_SRC_DEFAULT,
+      .mclk_multiple = I2S_MCLK_MULTIPLE_256,
+    },
+    .slot_cfg = {
+      .data_bit_width = I2S_DATA_BIT_WIDTH_32BIT,
+      .slot_bit_width = I2S_SLOT_BIT_WIDTH_AUTO,
+      .slot_mode = I2S_SLOT_MODE_MONO,
+      .slot_mask = I2S_STD_SLOT_LEFT,
+      .ws_width = I2S_DATA_BIT_WIDTH_32BIT,  // TODO: THIS MUST BE THE SAME AS DATA BIT WIDTH
+      .ws_pol = false,
+      .bit_shift = true,
+      .left_align = true,
+      .big_endian = false,
+      .bit_order_lsb = false
+    },
+    .gpio_cfg = {
+        .mclk = GPIO_NUM_16,
+        .bclk = GPIO_NUM_9,
+        .ws = GPIO_NUM_45,
+        .dout = I2S_GPIO_UNUSED,
+        .din = GPIO_NUM_10,
+        .invert_flags = {
+          .mclk_inv = false,
+          .bclk_inv = false,
+          .ws_inv = false,
+        }
+    }
+  };
+  i2s_chan_config_t chan_config = {
+      .id = i2s_port,
+      .role = I2S_ROLE_MASTER,
+      .dma_desc_num = 512,
+      .dma_frame_num = 8,
+      .auto_clear = false
+  };
+  ESP_RETURN_ON_ERROR(i2s_new_channel(&chan_config, nullptr, &rx_handle), TAG, "Couldn't create new channel");
+  ESP_RETURN_ON_ERROR(i2s_channel_init_std_mode(rx_handle, &std_config), TAG, "Couldn't init i2s mode");
+  ESP_RETURN_ON_ERROR(i2s_channel_enable(rx_handle), TAG, "Couldn't enable channel");
+  ESP_LOGI(TAG, "I2S initialized");
+  return ESP_OK;
+}
+
+// Same pins and clocks, but channels 32-bit slots per frame out of the four
+// the ES7210 sends in TDM mode.
+static int i2s_init_tdm(i2s_chan_handle_t &rx_handle, int channels) {
+  uint32_t slot_mask = 0;
+  for (int c = 0; c < channels; ++c) {
+    slot_mask |= I2S_TDM_SLOT0 << c;
+  }
+  i2s_tdm_config_t tdm_config = {
+    .clk_cfg = I2S_TDM_CLK_DEFAULT_CONFIG(16000),
+    .slot_cfg = I2S_TDM_PHILIPS_SLOT_DEFAULT_CONFIG(
+        I2S_DATA_BIT_WIDTH_32BIT, I2S_SLOT_MODE_STEREO,
+        static_cast<i2s_tdm_slot_mask_t>(slot_mask)),
+    .gpio_cfg = {
+        .mclk = GPIO_NUM_16,
+        .bclk = GPIO_NUM_9,
+        .ws = GPIO_NUM_45,
+        .dout = I2S_GPIO_UNUSED,
+        .din = GPIO_NUM_10,
+        .invert_flags = {
+          .mclk_inv = false,
+          .bclk_inv = false,
+          .ws_inv = false,
+        }
+    }
+  };
+  tdm_config.clk_cfg.mclk_multiple = I2S_MCLK_MULTIPLE_256;
+  tdm_config.slot_cfg.total_slot = 4;
+  i2s_chan_config_t chan_config = {
+      .id = i2s_port,
+      .role = I2S_ROLE_MASTER,
+      .dma_desc_num = 512,
+      .dma_frame_num = 8,
+      .auto_clear = false
+  };
+  ESP_RETURN_ON_ERROR(i2s_new_channel(&chan_config, nullptr, &rx_handle), TAG, "Couldn't create new channel");
+  ESP_RETURN_ON_ERROR(i2s_channel_init_tdm_mode(rx_handle, &tdm_config), TAG, "Couldn't init i2s tdm mode");
+  ESP_RETURN_ON_ERROR(i2s_channel_enable(rx_handle), TAG, "Couldn't enable channel");
+  ESP_LOGI(TAG, "I2S initialized, %d TDM channels", channels);
+  return ESP_OK;
+}
+
+
+TfLiteStatus I2sAudioSource::Start() {
+#if CONFIG_CAPTURE_REMOVE_DC
+  constexpr bool kRemoveDc = true;
+#else
+  constexpr bool kRemoveDc = false;
+#endif
+  conditioner_.Configure(kRemoveDc, CONFIG_CAPTURE_GAIN_PERCENT * kCaptureUnityGain / 100);
+  conditioner_.Reset();
+  num_channels_ = CONFIG_CAPTURE_CHANNELS;
+  if (num_channels_ > 1) {
+#if CONFIG_CAPTURE_COMBINE_SUM
+    constexpr ChannelCombineMode kCombineMode = ChannelCombineMode::kSum;
+#elif CONFIG_CAPTURE_COMBINE_DELAY_AND_SUM
+    constexpr ChannelCombineMode kCombineMode = ChannelCombineMode::kDelayAndSum;
+#else
+    constexpr ChannelCombineMode kCombineMode = ChannelCombineMode::kSelectBest;
+#endif
+    TF_LITE_ENSURE_STATUS(combiner_.Init(num_channels_, kI2sFramesToRead, kCombineMode));
+  }
+  if (es7210_codec_init() != ESP_OK) {
+    ESP_LOGE(TAG, "Can't configure ADC");
+    return kTfLiteError;
+  }
+  const int i2s_status = num_channels_ > 1 ? i2s_init_tdm(rx_handle_, num_channels_)
+                                           : i2s_init(rx_handle_);
+  if (i2s_status != ESP_OK) {
+    ESP_LOGE(TAG, "No i2s RX handle");
+    return kTfLiteError;
+  }
+  return kTfLiteOk;
+}
+
+TfLiteStatus I2sAudioSource::Read(int* samples_size, int16_t** samples) {
+  const size_t frame_bytes = num_channels_ * kI2sBytesPerChannel;
+  const size_t bytes_to_read = kI2sFramesToRead * frame_bytes;
+  size_t bytes_read = bytes_to_read;
+  {
+    TRACE_STAGE(kI2sRead);
+    /* read 100ms data at once from i2s */
+    i2s_channel_read(rx_handle_, (void*)read_buffer_, bytes_to_read,
+             &bytes_read, 100);
+  }
+
+  if (bytes_read <= 0) {
+    ESP_LOGE(TAG, "Error in I2S read : %d", bytes_read);
+    return kTfLiteError;
+  }
+  if (bytes_read < bytes_to_read) {
+    ESP_LOGW(TAG, "Partial I2S read");
+  }
+  const int frames = bytes_read / frame_bytes;
+  *samples_size = frames;
+  TRACE_STAGE(kConvert);
+  const uint32_t clipped_before = conditioner_.clipped_samples();
+  if (num_channels_ > 1) {
+    // de-interleave and combine, into the start of the buffer, then rescale
+    // the combined channel
+    *samples = (int16_t *) read_buffer_;
+    combiner_.Process((const int32_t *) read_buffer_, frames, *samples);
+    conditioner_.Process(*samples, frames);
+  } else {
+    // rescale the data, in place
+    *samples = conditioner_.Process((int32_t *) read_buffer_, frames);
+  }
+  if (conditioner_.clipped_samples() != clipped_before) {
+    ESP_LOGD(TAG, "%lu samples clipped, DC offset %d",
+             conditioner_.clipped_samples() - clipped_before, conditioner_.dc_offset());
+  }
+  return kTfLiteOk;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include "driver/i2s_std.h"
+#include "audio_source.h"
+#include "capture_kernels.h"
+#include "channel_combiner.h"
+
+// Captures from the Korvo2's ES7210 ADC over I2S, 100ms at a time. With
+// CONFIG_CAPTURE_CHANNELS above 1 it reads that many microphones in TDM mode
+// and combines them as CONFIG_CAPTURE_COMBINE_* says.
+class I2sAudioSource : public AudioSource {
+ public:
+  TfLiteStatus Start() override;
+  TfLiteStatus Read(int* samples_size, int16_t** samples) override;
+
+  static constexpr int kI2sFramesToRead = 1600;
+  static constexpr size_t kI2sBytesPerChannel = 4;
+
+  // Samples at full scale since the start
+  uint32_t clipped_samples() const { return conditioner_.clipped_samples(); }
+  // The channel combine stage (multi-channel capture)
+  const ChannelCombiner& combiner() const { return combiner_; }
+
+ private:
+  i2s_chan_handle_t rx_handle_ = nullptr;
+  int num_channels_ = 1;
+  CaptureConditioner conditioner_;
+  ChannelCombiner combiner_;
+  alignas(4) uint8_t read_buffer_[kI2sFramesToRead * kMaxCaptureChannels *
+                                  kI2sBytesPerChannel] = {};
+};
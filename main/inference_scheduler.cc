@@ -0,0 +1,55 @@
+#include "inference_scheduler.h"
+
+#include <algorithm>
+
+InferenceScheduler::InferenceScheduler(int hop_ms)
+    : hop_ms_(std::max(hop_ms, 1)), next_due_ms_(0) {}
+
+bool InferenceScheduler::IsDue(int32_t audio_end_ms) {
+  if (!started_) {
+    next_due_ms_ = audio_end_ms;
+    started_ = true;
+  }
+  if (audio_end_ms < next_due_ms_) {
+    stats_.not_due++;
+    return false;
+  }
+  const int32_t missed = (audio_end_ms - next_due_ms_) / hop_ms_;
+  stats_.missed_hops += missed;
+  next_due_ms_ += (missed + 1) * hop_ms_;
+  return true;
+}
+
+void InferenceScheduler::SetActivityGate(bool enabled, int frame_ms) {
+  gate_enabled_ = enabled;
+  gate_frame_ms_ = frame_ms;
+}
+
+bool InferenceScheduler::NeedsInference(int32_t audio_end_ms, int32_t active_end_ms) {
+  const bool active = active_end_ms >= 0 && active_end_ms > audio_end_ms - gate_frame_ms_;
+  if (gate_enabled_ && has_result_ && !active && !result_was_active_) {
+    stats_.gated++;
+    return false;
+  }
+  has_result_ = true;
+  result_was_active_ = active;
+  return true;
+}
+
+void InferenceScheduler::Record(int64_t inference_us, int64_t latency_us) {
+  stats_.inferences++;
+  if (inference_us > int64_t{hop_ms_} * 1000) {
+    stats_.overruns++;
+  }
+  if (latency_us >= 0) {
+    stats_.latency_count++;
+    stats_.latency_sum_us += latency_us;
+    stats_.latency_max_us = std::max(stats_.latency_max_us, latency_us);
+  }
+}
+
+void InferenceScheduler::Reset() {
+  started_ = false;
+  has_result_ = false;
+  result_was_active_ = false;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+
+// Decides which spectrograms the classifier runs on, and keeps score of how
+// well it keeps up with the audio.
+//
+// Inferences are due once per hop of audio, on a fixed grid: the first frame
+// seen sets it, and a frame is classified when it reaches the next grid point.
+// The hop is also each inference's deadline. When one overruns it, the grid
+// points passed meanwhile are dropped rather than worked off late, and the
+// next inference runs on the newest frame (the FrameHandoff only ever hands
+// that one out), so the classifier catches up in one step.
+//
+// With the activity gate on, a due frame is only classified when there was
+// activity somewhere in it (see ActivityGate), or in the one classified
+// before it, so that the result settles once the activity has passed.
+// Otherwise the previous result still stands and is carried forward.
+//
+// Not thread-safe: meant to be used by the inference loop alone.
+class InferenceScheduler {
+ public:
+  // Counters since the start or the last Reset(); all but latency_max_us can
+  // be subtracted from an earlier snapshot to get the figures of an interval.
+  struct Stats {
+    uint32_t inferences;
+    // Frames left out because they were between two grid points
+    uint32_t not_due;
+    // Grid points that got no inference because the classifier was late
+    uint32_t missed_hops;
+    // Due frames the activity gate found nothing new in, which got the
+    // previous result instead of an inference
+    uint32_t gated;
+    // Inferences that took longer than a hop
+    uint32_t overruns;
+    // From the capture of a frame's newest audio to the end of its inference,
+    // for the inferences where it was known
+    uint32_t latency_count;
+    int64_t latency_sum_us;
+    int64_t latency_max_us;
+  };
+
+  explicit InferenceScheduler(int hop_ms);
+
+  // Whether the frame whose newest audio ends at audio_end_ms (see
+  // FrameHandoff::FrameInfo) should be classified. A true return moves the
+  // grid on to the next hop after it.
+  bool IsDue(int32_t audio_end_ms);
+
+  // Turns the activity gate on or off, for frames spanning frame_ms of audio.
+  void SetActivityGate(bool enabled, int frame_ms);
+  bool activity_gate_enabled() const { return gate_enabled_; }
+  // For a due frame (see FrameHandoff::FrameInfo): whether to run the
+  // classifier on it, or to carry the previous result forward. Always true
+  // with the gate off.
+  bool NeedsInference(int32_t audio_end_ms, int32_t active_end_ms);
+
+  // Records an inference that took inference_us, from acquiring the frame to
+  // the output being processed, and ended latency_us after the frame's newest
+  // audio was captured, or with a negative latency_us if that isn't known.
+  void Record(int64_t inference_us, int64_t latency_us);
+
+  // Starts a new grid with the next frame, and forgets the previous result,
+  // e.g. for a new audio stream. The counters keep going.
+  void Reset();
+
+  int hop_ms() const { return hop_ms_; }
+  const Stats& GetStats() const { return stats_; }
+
+ private:
+  const int hop_ms_;
+  // Audio time of the next grid point
+  int32_t next_due_ms_;
+  bool started_ = false;
+  bool gate_enabled_ = false;
+  int gate_frame_ms_ = 0;
+  bool has_result_ = false;
+  // The last frame classified had activity in it.
+  bool result_was_active_ = false;
+  Stats stats_ = {};
+};
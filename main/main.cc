@@ -14,9 +14,24 @@ limitations under the License.
 ==============================================================================*/
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "audio_provider.h"
+#include "i2s_audio_source.h"
 #include "main_functions.h"
+#include "sdkconfig.h"
+#if CONFIG_PIPELINE_BENCHMARK
+#include "pipeline_benchmarks.h"
+#endif
 
 [[noreturn]] void tf_main() {
+#if CONFIG_PIPELINE_BENCHMARK
+  RunPipelineBenchmarks(CONFIG_PIPELINE_BENCHMARK_ITERATIONS,
+                        "/sdcard/benchmarks.jsonl");
+  while (true) {
+    vTaskDelay(portMAX_DELAY);
+  }
+#endif
+  static I2sAudioSource i2s_audio_source;
+  SetAudioSource(&i2s_audio_source);
   setup();
   while (true) {
     loop();
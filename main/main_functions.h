@@ -16,6 +16,9 @@ limitations under the License.
 #ifndef TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_MAIN_FUNCTIONS_H_
 #define TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_MAIN_FUNCTIONS_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
 // Expose a C friendly interface for main functions.
 #ifdef __cplusplus
 extern "C" {
@@ -30,8 +33,100 @@ void setup();
 // compatibility.
 void loop();
 
+// Wall-clock time spent in each stage by step_offline().
+typedef struct {
+  int64_t windows;         // classifier invocations
+  int64_t gated;           // results carried forward by the activity gate
+  int64_t audio_ms;        // audio consumed
+  int64_t features_us;     // GetAudioSpan() + GenerateFeatures()
+  int64_t inference_us;    // input copy + Invoke()
+  int64_t postprocess_us;  // dequantization, argmax, smoothing and logging
+} offline_stats_t;
+
+// Offline processing, for the host build: setup_offline() prepares everything
+// like setup() but doesn't start the periodic feature task, and returns false
+// if the classifier couldn't be set up. Each step_offline() call then
+// extracts the features of the next stride of audio on the calling thread and
+// classifies them like loop() does, as fast as the CPU allows. It returns
+// false once the audio source is exhausted. stats may be NULL.
+bool setup_offline();
+bool step_offline(offline_stats_t* stats);
+// Starts over with fresh feature extraction state, after SetAudioSource() was
+// pointed at the next recording. Prediction timestamps keep counting up.
+void reset_offline();
+
 #ifdef __cplusplus
 }
+
+#include "clip_recorder.h"
+#include "frame_handoff.h"
+#include "inference_scheduler.h"
+#include "model_loader.h"
+#include "tensor_arena.h"
+
+namespace tflite {
+class MicroInterpreter;
+class MicroOpResolver;
+}  // namespace tflite
+
+// The ops of the classifier model, registered on the first call; null if
+// registering them failed. Doesn't need setup().
+const tflite::MicroOpResolver* classifier_op_resolver();
+
+// The classifier's interpreter once setup() or setup_offline() built it, for
+// benchmarks and tools; null before that or if the setup failed.
+tflite::MicroInterpreter* classifier_interpreter();
+
+// The tensor arena of classifier_interpreter(), to tell where it ended up;
+// null before setup() or setup_offline().
+const TensorArena* classifier_tensor_arena();
+
+// Builds another interpreter of the classifier, for benchmarks comparing
+// arena placements or model sources: allocates arena for it as placement
+// asks, with the same fallback as setup(), and constructs it in place in
+// storage, of at least sizeof(tflite::MicroInterpreter) bytes, on
+// loaded_model if it isn't null or else on the model setup() loaded. Null if
+// setup() or setup_offline() hasn't run or the tensors don't fit. The caller
+// destroys the interpreter before the arena and the model.
+tflite::MicroInterpreter* build_classifier_interpreter(TensorArena::Placement placement,
+                                                       TensorArena* arena, void* storage,
+                                                       const tflite::Model* loaded_model =
+                                                           nullptr);
+
+// Spectrogram frames published by the feature provider, consumed by the
+// classifier and skipped because a newer one came before it was free.
+FrameHandoff::Stats feature_frame_stats();
+
+// How the classifier kept up with its hop: inferences run, frames left out,
+// or gated, deadlines overrun and end-to-end latency.
+InferenceScheduler::Stats inference_schedule_stats();
+
+// Turns the activity gate on or off after setup, e.g. to compare both on the
+// same audio. It starts as the rendered kActivityGateEnabled.
+void set_activity_gate_enabled(bool enabled);
+
+// The category of the last result, inferred or carried forward, if it was
+// above the detection threshold, -1 otherwise.
+int last_detected_category();
+
+// Records WAV clips of the detections to the SD card, as CONFIG_CLIP_RECORDING
+// does. Call before setup() or setup_offline().
+void enable_clip_recording();
+// Blocks until the clips of every detection so far are written, cutting them
+// at the audio captured so far.
+void flush_clip_recording();
+// All zero when not recording clips.
+ClipRecorder::Stats clip_recording_stats();
+
+// Loads the classifier model from source instead of the configured
+// CONFIG_MODEL_SOURCE; the app image's one is still used when that fails.
+// Call before setup() or setup_offline().
+void set_model_source(ModelLoader::Source source);
+
+// Averages the results over window_ms before detecting anything, instead of
+// the rendered smoothing_window_ms (see PosteriorSmoother); 0 for no
+// smoothing. Call before setup() or setup_offline().
+void set_posterior_smoothing_window(int window_ms);
 #endif
 
 #endif  // TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_MAIN_FUNCTIONS_H_
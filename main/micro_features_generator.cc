@@ -13,14 +13,20 @@ See the License for the specific language governing permissions and
 limitations under the License.
 
 NOTICE: updated one of the registered ops for compatibility with
-newer tflite versions
+newer tflite versions. The features are computed by the native
+AudioFrontend unless CONFIG_AUDIO_FRONTEND_INTERPRETED is set. The
+interpreter's operators can be profiled. The arena size is rendered
+with the model settings and its usage is reported.
 ==============================================================================*/
 
 #include "micro_features_generator.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <esp_log.h>
+#include "sdkconfig.h"
+#include "audio_frontend.h"
 #include "audio_preprocessor_int8_model_data.h"
 #include "tensorflow/lite/schema/schema_generated.h"
 #include "tensorflow/lite/micro/micro_log.h"
@@ -28,6 +34,7 @@ newer tflite versions
 #include "tensorflow/lite/micro/micro_mutable_op_resolver.h"
 #include "tensorflow/lite/micro/micro_log.h"
 #include "micro_model_settings.h"
+#include "op_profiler.h"
 
 namespace {
 
@@ -36,8 +43,10 @@ bool g_is_first_time = true;
 
 const tflite::Model* model = nullptr;
 tflite::MicroInterpreter* interpreter = nullptr;
+OpProfiler* op_profiler = nullptr;
 
-constexpr size_t kArenaSize = 16 * 1024;
+// Measured on the host by birdnet_arena_size, see micro_model_settings.h
+constexpr size_t kArenaSize = kPreprocessorArenaSize;
 alignas(16) uint8_t g_arena[kArenaSize];
 
 constexpr int kAudioSampleDurationCount =
@@ -45,6 +54,13 @@ constexpr int kAudioSampleDurationCount =
 constexpr int kAudioSampleStrideCount =
     kFeatureStrideMs * kAudioSampleFrequency / 1000;
 using AudioPreprocessorOpResolver = tflite::MicroMutableOpResolver<18>;
+
+#if CONFIG_AUDIO_FRONTEND_INTERPRETED
+constexpr bool kUseInterpreter = true;
+#else
+constexpr bool kUseInterpreter = false;
+#endif
+AudioFrontend g_audio_frontend;
 }  // namespace
 
 TfLiteStatus RegisterOps(AudioPreprocessorOpResolver& op_resolver) {
@@ -69,31 +85,69 @@ TfLiteStatus RegisterOps(AudioPreprocessorOpResolver& op_resolver) {
   return kTfLiteOk;
 }
 
+const tflite::Model* GetAudioPreprocessorModel() {
+  return tflite::GetModel(g_audio_preprocessor_int8_tflite);
+}
+
+const tflite::MicroOpResolver* GetAudioPreprocessorOpResolver() {
+  static AudioPreprocessorOpResolver op_resolver;
+  static bool registered = false;
+  if (!registered) {
+    if (RegisterOps(op_resolver) != kTfLiteOk) {
+      return nullptr;
+    }
+    registered = true;
+  }
+  return &op_resolver;
+}
+
 TfLiteStatus InitializeMicroFeatures() {
   g_is_first_time = true;
+  if (!kUseInterpreter) {
+    return g_audio_frontend.Init();
+  }
+  return InitializeInterpretedFeatures();
+}
+
+TfLiteStatus InitializeInterpretedFeatures() {
+  // Already set up: only forget the state (noise estimates, ...) carried over
+  // from the previous audio stream.
+  if (interpreter != nullptr) {
+    return interpreter->Reset();
+  }
 
   // Map the model into a usable data structure. This doesn't involve any
   // copying or parsing, it's a very lightweight operation.
-  model = tflite::GetModel(g_audio_preprocessor_int8_tflite);
+  model = GetAudioPreprocessorModel();
   if (model->version() != TFLITE_SCHEMA_VERSION) {
     MicroPrintf("Model provided for Feature generator is schema version %d "
                 "not equal to supported version %d.", model->version(), TFLITE_SCHEMA_VERSION);
     return kTfLiteError;
   }
 
-  static AudioPreprocessorOpResolver op_resolver;
-  RegisterOps(op_resolver);
+  const tflite::MicroOpResolver* op_resolver = GetAudioPreprocessorOpResolver();
+  if (op_resolver == nullptr) {
+    return kTfLiteError;
+  }
 
-  static tflite::MicroInterpreter static_interpreter(model, op_resolver, g_arena, kArenaSize);
+#if CONFIG_OP_PROFILER
+  static OpProfiler static_op_profiler("preprocessor");
+  op_profiler = &static_op_profiler;
+#endif
+
+  static tflite::MicroInterpreter static_interpreter(model, *op_resolver, g_arena, kArenaSize,
+                                                     nullptr, op_profiler);
   interpreter = &static_interpreter;
 
   if (interpreter->AllocateTensors() != kTfLiteOk) {
-    MicroPrintf("AllocateTensors failed for Feature provider model. Line %d", __LINE__);
+    MicroPrintf("AllocateTensors failed for Feature provider model, is "
+                "preprocessor_arena_size (%u) what birdnet_arena_size measured?",
+                (unsigned) kArenaSize);
     return kTfLiteError;
   }
 
-  // MicroPrintf("AudioPreprocessor model arena size = %u",
-  //             interpreter.arena_used_bytes());
+  MicroPrintf("AudioPreprocessor model arena size = %u of %u",
+              (unsigned) interpreter->arena_used_bytes(), (unsigned) kArenaSize);
 
   return kTfLiteOk;
 }
@@ -106,6 +160,9 @@ TfLiteStatus GenerateSingleFeature(const int16_t* audio_data,
   TfLiteTensor* output = interpreter->output(0);
   std::copy_n(audio_data, audio_data_size,
               tflite::GetTensorData<int16_t>(input));
+  if (op_profiler != nullptr) {
+    op_profiler->BeginInvoke();
+  }
   if (interpreter->Invoke() != kTfLiteOk) {
     MicroPrintf("Feature generator model invocation failed");
   }
@@ -116,6 +173,12 @@ TfLiteStatus GenerateSingleFeature(const int16_t* audio_data,
   return kTfLiteOk;
 }
 
+TfLiteStatus GenerateInterpretedFeature(const int16_t* audio_data,
+                                        int8_t* feature_output) {
+  return GenerateSingleFeature(audio_data, kAudioSampleDurationCount,
+                               feature_output, interpreter);
+}
+
 TfLiteStatus GenerateFeatures(const int16_t* audio_data,
                               const size_t audio_data_size,
                               Features* features_output) {
@@ -123,9 +186,13 @@ TfLiteStatus GenerateFeatures(const int16_t* audio_data,
   size_t feature_index = 0;
   while (remaining_samples >= kAudioSampleDurationCount &&
          feature_index < kFeatureCount) {
-    TF_LITE_ENSURE_STATUS(
-        GenerateSingleFeature(audio_data, kAudioSampleDurationCount,
-                              (*features_output)[feature_index], interpreter));
+    if (kUseInterpreter) {
+      TF_LITE_ENSURE_STATUS(
+          GenerateSingleFeature(audio_data, kAudioSampleDurationCount,
+                                (*features_output)[feature_index], interpreter));
+    } else {
+      g_audio_frontend.Process(audio_data, (*features_output)[feature_index]);
+    }
     feature_index++;
     audio_data += kAudioSampleStrideCount;
     remaining_samples -= kAudioSampleStrideCount;
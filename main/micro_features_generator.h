@@ -11,6 +11,10 @@ distributed under the License is distributed on an "AS IS" BASIS,
 WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
+
+NOTICE: The interpreted preprocessor is exposed next to GenerateFeatures(),
+which can also use the native AudioFrontend, along with its model and
+op resolver.
 ==============================================================================*/
 
 #ifndef TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_MICRO_FEATURES_MICRO_FEATURES_GENERATOR_H_
@@ -21,7 +25,13 @@ limitations under the License.
 
 using Features = int8_t[kFeatureCount][kFeatureSize];
 
-// Sets up any resources needed for the feature generation pipeline.
+namespace tflite {
+class MicroOpResolver;
+struct Model;
+}  // namespace tflite
+
+// Sets up any resources needed for the feature generation pipeline. Calling it
+// again resets the pipeline's state, for starting over on a new audio stream.
 TfLiteStatus InitializeMicroFeatures();
 
 // Converts audio sample data into a more compact form that's appropriate for
@@ -30,4 +40,16 @@ TfLiteStatus GenerateFeatures(const int16_t* audio_data,
                               const size_t audio_data_size,
                               Features* features_output);
 
+// The audio preprocessor model run by a TFLM interpreter, one window at a
+// time. GenerateFeatures() uses it in place of the native AudioFrontend when
+// CONFIG_AUDIO_FRONTEND_INTERPRETED is set; benchmarks and equivalence checks
+// can set it up and call it either way. Initializing it again resets it.
+TfLiteStatus InitializeInterpretedFeatures();
+TfLiteStatus GenerateInterpretedFeature(const int16_t* audio_data,
+                                        int8_t* feature_output);
+// The audio preprocessor model, and its ops registered on the first call;
+// null if registering them failed.
+const tflite::Model* GetAudioPreprocessorModel();
+const tflite::MicroOpResolver* GetAudioPreprocessorOpResolver();
+
 #endif  // TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_MICRO_FEATURES_MICRO_FEATURES_GENERATOR_H_
@@ -0,0 +1,214 @@
+#include "model_loader.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "micro_model_settings.h"
+#include "model.h"
+#include "sd_card.h"
+#include "tensorflow/lite/micro/micro_op_resolver.h"
+#include "tensorflow/lite/schema/schema_generated.h"
+#include "tensorflow/lite/schema/schema_utils.h"
+
+static const char* TAG = "model_loader";
+
+// Flatbuffers and the TFLM kernels reading the weights in place want them
+// at least this aligned
+constexpr size_t kModelAlignment = 16;
+
+ModelLoader::~ModelLoader() {
+  Unload();
+}
+
+void ModelLoader::Unload() {
+  if (mapped_) {
+    esp_partition_munmap(mmap_handle_);
+    mapped_ = false;
+  }
+  heap_caps_free(buffer_);
+  buffer_ = nullptr;
+  data_ = nullptr;
+  size_ = 0;
+  model_ = nullptr;
+}
+
+esp_err_t ModelLoader::Load(Source source, const tflite::MicroOpResolver& op_resolver) {
+  Unload();
+  source_ = source;
+  const int64_t start_us = esp_timer_get_time();
+  esp_err_t err = ESP_OK;
+  switch (source) {
+    case Source::kBuiltIn:
+      data_ = g_model;
+      size_ = g_model_len;
+      break;
+    case Source::kPartition:
+      err = MapPartition();
+      break;
+    case Source::kSdCard:
+      err = ReadSdCard();
+      break;
+  }
+  if (err == ESP_OK) {
+    err = Check(op_resolver);
+  }
+  load_us_ = esp_timer_get_time() - start_us;
+  if (err != ESP_OK) {
+    Unload();
+    return err;
+  }
+  ESP_LOGI(TAG, "Model from %s: %u bytes, loaded in %lld us", SourceName(source),
+           (unsigned) size_, (long long) load_us_);
+  return ESP_OK;
+}
+
+esp_err_t ModelLoader::MapPartition() {
+  const esp_partition_t* partition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, kPartitionLabel);
+  if (partition == nullptr) {
+    ESP_LOGE(TAG, "No \"%s\" partition", kPartitionLabel);
+    return ESP_ERR_NOT_FOUND;
+  }
+  // The .tflite doesn't record its size: the whole partition is mapped, and
+  // the flatbuffer checked against it.
+  const void* data;
+  const esp_err_t err = esp_partition_mmap(partition, 0, partition->size,
+                                           ESP_PARTITION_MMAP_DATA, &data, &mmap_handle_);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to map the \"%s\" partition (%s)", kPartitionLabel,
+             esp_err_to_name(err));
+    return err;
+  }
+  mapped_ = true;
+  data_ = static_cast<const uint8_t*>(data);
+  size_ = partition->size;
+  return ESP_OK;
+}
+
+esp_err_t ModelLoader::ReadSdCard() {
+  char path[128];
+  snprintf(path, sizeof(path), "%s/%s", sdcard::mountPoint(), kSdCardFileName);
+  FILE* file = fopen(path, "rb");
+  if (file == nullptr) {
+    ESP_LOGE(TAG, "Failed to open %s: %s", path, strerror(errno));
+    return ESP_ERR_NOT_FOUND;
+  }
+  long size = -1;
+  if (fseek(file, 0, SEEK_END) == 0) {
+    size = ftell(file);
+    rewind(file);
+  }
+  if (size <= 0) {
+    ESP_LOGE(TAG, "%s is empty or unreadable", path);
+    fclose(file);
+    return ESP_ERR_INVALID_SIZE;
+  }
+  buffer_ = static_cast<uint8_t*>(heap_caps_aligned_alloc(kModelAlignment, size,
+                                                          MALLOC_CAP_SPIRAM));
+  if (buffer_ == nullptr) {
+    buffer_ = static_cast<uint8_t*>(heap_caps_aligned_alloc(kModelAlignment, size,
+                                                            MALLOC_CAP_DEFAULT));
+  }
+  if (buffer_ == nullptr) {
+    ESP_LOGE(TAG, "Can't allocate %ld bytes for %s", size, path);
+    fclose(file);
+    return ESP_ERR_NO_MEM;
+  }
+  const size_t read = fread(buffer_, 1, size, file);
+  fclose(file);
+  if (read != static_cast<size_t>(size)) {
+    ESP_LOGE(TAG, "Failed to read %s", path);
+    return ESP_FAIL;
+  }
+  data_ = buffer_;
+  size_ = size;
+  return ESP_OK;
+}
+
+esp_err_t ModelLoader::Check(const tflite::MicroOpResolver& op_resolver) {
+  flatbuffers::Verifier verifier(data_, size_);
+  if (!tflite::ModelBufferHasIdentifier(data_) || !tflite::VerifyModelBuffer(verifier)) {
+    ESP_LOGE(TAG, "The %s model isn't a valid .tflite", SourceName(source_));
+    return ESP_FAIL;
+  }
+  const tflite::Model* model = tflite::GetModel(data_);
+  if (model->version() != TFLITE_SCHEMA_VERSION) {
+    ESP_LOGE(TAG, "The %s model is schema version %lu, not %d", SourceName(source_),
+             (unsigned long) model->version(), TFLITE_SCHEMA_VERSION);
+    return ESP_ERR_INVALID_VERSION;
+  }
+
+  // The input has to be the spectrogram the feature provider produces
+  const auto* subgraphs = model->subgraphs();
+  const tflite::SubGraph* subgraph =
+      subgraphs != nullptr && subgraphs->size() > 0 ? subgraphs->Get(0) : nullptr;
+  const tflite::Tensor* input = nullptr;
+  if (subgraph != nullptr && subgraph->inputs() != nullptr && subgraph->tensors() != nullptr &&
+      subgraph->inputs()->size() == 1 &&
+      static_cast<uint32_t>(subgraph->inputs()->Get(0)) < subgraph->tensors()->size()) {
+    input = subgraph->tensors()->Get(subgraph->inputs()->Get(0));
+  }
+  constexpr int32_t kInputShape[] = {1, kFeatureCount, kFeatureSize, 1};
+  const auto* shape = input != nullptr ? input->shape() : nullptr;
+  bool input_ok = shape != nullptr && shape->size() == 4 &&
+                  input->type() == tflite::TensorType_INT8;
+  for (int i = 0; input_ok && i < 4; ++i) {
+    input_ok = shape->Get(i) == kInputShape[i];
+  }
+  if (!input_ok) {
+    ESP_LOGE(TAG, "The %s model's input isn't a 1x%dx%dx1 int8 spectrogram",
+             SourceName(source_), kFeatureCount, kFeatureSize);
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  // And the output the kCategoryCount scores that are labeled with
+  // kCategoryLabels
+  const tflite::Tensor* output = nullptr;
+  if (subgraph->outputs() != nullptr && subgraph->outputs()->size() == 1 &&
+      static_cast<uint32_t>(subgraph->outputs()->Get(0)) < subgraph->tensors()->size()) {
+    output = subgraph->tensors()->Get(subgraph->outputs()->Get(0));
+  }
+  constexpr int32_t kOutputShape[] = {1, kCategoryCount};
+  const auto* output_shape = output != nullptr ? output->shape() : nullptr;
+  bool output_ok = output_shape != nullptr && output_shape->size() == 2 &&
+                   output->type() == tflite::TensorType_INT8;
+  for (int i = 0; output_ok && i < 2; ++i) {
+    output_ok = output_shape->Get(i) == kOutputShape[i];
+  }
+  if (!output_ok) {
+    ESP_LOGE(TAG, "The %s model's output isn't 1x%d int8 scores", SourceName(source_),
+             kCategoryCount);
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  // Only the rendered op set is registered
+  if (model->operator_codes() != nullptr) {
+    for (const tflite::OperatorCode* code : *model->operator_codes()) {
+      const tflite::BuiltinOperator builtin = tflite::GetBuiltinCode(code);
+      const bool custom = builtin == tflite::BuiltinOperator_CUSTOM;
+      const char* name = custom ? (code->custom_code() != nullptr ? code->custom_code()->c_str()
+                                                                  : "")
+                                : tflite::EnumNameBuiltinOperator(builtin);
+      if ((custom ? op_resolver.FindOp(name) : op_resolver.FindOp(builtin)) == nullptr) {
+        ESP_LOGE(TAG, "The %s model uses %s, which isn't registered", SourceName(source_),
+                 name);
+        return ESP_ERR_NOT_SUPPORTED;
+      }
+    }
+  }
+
+  model_ = model;
+  return ESP_OK;
+}
+
+const char* ModelLoader::SourceName(Source source) {
+  switch (source) {
+    case Source::kBuiltIn: return "app image";
+    case Source::kPartition: return "partition";
+    case Source::kSdCard: return "SD card";
+  }
+  return "";
+}
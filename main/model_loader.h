@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "esp_err.h"
+#include "esp_partition.h"
+
+namespace tflite {
+class MicroOpResolver;
+struct Model;
+}  // namespace tflite
+
+// Where the classifier's .tflite comes from, so that a new model doesn't
+// need the app to be forged and flashed again:
+//
+//   kBuiltIn    g_model, rendered into the app image from model.cc.jinja
+//   kPartition  the "model" data partition, memory-mapped: the weights are
+//               read through the flash cache and never copied to RAM
+//   kSdCard     model.tflite on the SD card, read into PSRAM
+//
+// Whatever the source, the model is checked before an interpreter is built
+// on it: a well-formed flatbuffer of the supported schema version, whose
+// input is the rendered kFeatureCount x kFeatureSize int8 spectrogram, whose
+// output is kCategoryCount int8 scores and whose ops are all registered. A
+// model that isn't stays unloaded.
+class ModelLoader {
+ public:
+  enum class Source { kBuiltIn, kPartition, kSdCard };
+
+  static constexpr const char* kPartitionLabel = "model";
+  static constexpr const char* kSdCardFileName = "model.tflite";
+
+  ModelLoader() = default;
+  ~ModelLoader();
+  ModelLoader(const ModelLoader&) = delete;
+  ModelLoader& operator=(const ModelLoader&) = delete;
+
+  // Maps or reads the model from source and checks it against op_resolver,
+  // unloading the previous one. The SD card has to be mounted for kSdCard.
+  esp_err_t Load(Source source, const tflite::MicroOpResolver& op_resolver);
+  void Unload();
+
+  // Null unless loaded
+  const tflite::Model* model() const { return model_; }
+  Source source() const { return source_; }
+  static const char* SourceName(Source source);
+  // Bytes of the .tflite, or of the whole partition it is in
+  size_t size() const { return size_; }
+  // How long the last Load() took, checks included
+  int64_t load_us() const { return load_us_; }
+
+ private:
+  esp_err_t MapPartition();
+  esp_err_t ReadSdCard();
+  esp_err_t Check(const tflite::MicroOpResolver& op_resolver);
+
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  // What backs data_, when it isn't g_model
+  uint8_t* buffer_ = nullptr;
+  esp_partition_mmap_handle_t mmap_handle_ = 0;
+  bool mapped_ = false;
+  const tflite::Model* model_ = nullptr;
+  Source source_ = Source::kBuiltIn;
+  int64_t load_us_ = 0;
+};
@@ -0,0 +1,202 @@
+#include "op_profiler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include "benchmark.h"
+#include "cycle_counter.h"
+#include "esp_log.h"
+
+static const char* TAG = "op_profile";
+
+namespace {
+
+// Which kernels the op times are from
+#if CONFIG_NN_OPTIMIZED
+constexpr const char* kKernels = "ESP-NN optimized kernels";
+#elif defined(ESP_PLATFORM)
+constexpr const char* kKernels = "ESP-NN ANSI C kernels";
+#else
+constexpr const char* kKernels = "reference kernels";
+#endif
+
+constexpr int kMaxProfilers = 4;
+OpProfiler* g_profilers[kMaxProfilers];
+std::atomic<int> g_profiler_count{0};
+
+}  // namespace
+
+OpProfiler::OpProfiler(const char* name) : name_(name) {
+  const int index = g_profiler_count.load(std::memory_order_relaxed);
+  if (index == kMaxProfilers) {
+    ESP_LOGW(TAG, "Too many profilers, %s won't be reported", name);
+    return;
+  }
+  g_profilers[index] = this;
+  g_profiler_count.store(index + 1, std::memory_order_release);
+}
+
+void OpProfiler::BeginInvoke() {
+  next_layer_ = 0;
+  depth_ = 0;
+  invokes_.store(invokes_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+uint32_t OpProfiler::BeginEvent(const char* tag) {
+  const bool nested = depth_++ > 0;
+  if (next_layer_ == kMaxLayers) {
+    if (!nested) {
+      overflow_start_ = CycleCount();
+    }
+    return kMaxLayers;
+  }
+  const int index = next_layer_++;
+  Layer& layer = layers_[index];
+  if (layer.calls.load(std::memory_order_relaxed) == 0) {
+    // Published by the first call's count
+    layer.tag = tag;
+    layer.nested = nested;
+  }
+  starts_[index] = CycleCount();
+  return index;
+}
+
+void OpProfiler::EndEvent(uint32_t event_handle) {
+  const uint32_t now = CycleCount();
+  depth_--;
+  if (event_handle >= kMaxLayers) {
+    overflow_calls_.store(overflow_calls_.load(std::memory_order_relaxed) + 1,
+                          std::memory_order_relaxed);
+    if (depth_ == 0) {
+      total_cycles_.store(total_cycles_.load(std::memory_order_relaxed) +
+                          (now - overflow_start_), std::memory_order_relaxed);
+    }
+    return;
+  }
+  Layer& layer = layers_[event_handle];
+  const uint32_t cycles = now - starts_[event_handle];
+  layer.cycles.store(layer.cycles.load(std::memory_order_relaxed) + cycles,
+                     std::memory_order_relaxed);
+  layer.calls.store(layer.calls.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+  if (!layer.nested) {
+    total_cycles_.store(total_cycles_.load(std::memory_order_relaxed) + cycles,
+                        std::memory_order_relaxed);
+  }
+}
+
+void OpProfiler::Report(FILE* file) {
+  const uint32_t invokes = invokes_.load(std::memory_order_relaxed);
+  const uint64_t total_cycles = total_cycles_.load(std::memory_order_relaxed);
+  const uint32_t overflow_calls = overflow_calls_.load(std::memory_order_relaxed);
+  const uint32_t new_invokes = invokes - reported_invokes_;
+  const uint64_t new_total_cycles = total_cycles - reported_total_cycles_;
+  const uint32_t new_overflow_calls = overflow_calls - reported_overflow_calls_;
+  reported_invokes_ = invokes;
+  reported_total_cycles_ = total_cycles;
+  reported_overflow_calls_ = overflow_calls;
+
+  // Layers since the previous report, and the op types they add up to
+  struct Row {
+    const char* tag;
+    bool nested;
+    int layers;
+    uint32_t calls;
+    uint64_t cycles;
+  };
+  // Static, they'd take a lot of the reporting task's stack
+  static Row layers[kMaxLayers];
+  static Row types[kMaxLayers];
+  int layer_count = 0;
+  int type_count = 0;
+  for (int i = 0; i < kMaxLayers; ++i) {
+    const uint32_t calls = layers_[i].calls.load(std::memory_order_acquire);
+    if (calls == 0) {
+      break;
+    }
+    const uint64_t cycles = layers_[i].cycles.load(std::memory_order_relaxed);
+    Row& row = layers[layer_count++];
+    row = {layers_[i].tag, layers_[i].nested, 1, calls - reported_layers_[i].calls,
+           cycles - reported_layers_[i].cycles};
+    reported_layers_[i] = {calls, cycles};
+
+    Row* type = std::find_if(types, types + type_count, [&row](const Row& t) {
+      return strcmp(t.tag, row.tag) == 0 && t.nested == row.nested;
+    });
+    if (type == types + type_count) {
+      *type = {row.tag, row.nested, 0, 0, 0};
+      type_count++;
+    }
+    type->layers++;
+    type->calls += row.calls;
+    type->cycles += row.cycles;
+  }
+  if (new_invokes == 0) {
+    return;
+  }
+
+  const double us_per_cycle = 1.0 / CycleCountsPerUs();
+  const double invoke_us = static_cast<double>(new_total_cycles) / new_invokes * us_per_cycle;
+  ESP_LOGI(TAG, "%s: %lu invokes, mean %.1f us in %d layers, %s", name_,
+           (unsigned long) new_invokes, invoke_us, layer_count, kKernels);
+  if (new_overflow_calls > 0) {
+    ESP_LOGW(TAG, "%s: %lu ops past the first %d layers are only in the total", name_,
+             (unsigned long) new_overflow_calls, kMaxLayers);
+  }
+  // Share of the Invoke() time, without counting nested events twice
+  auto share = [new_total_cycles](const Row& row) {
+    return new_total_cycles > 0 ? 100.0 * row.cycles / new_total_cycles : 0.0;
+  };
+  auto mean_us = [new_invokes, us_per_cycle](const Row& row) {
+    return static_cast<double>(row.cycles) / new_invokes * us_per_cycle;
+  };
+
+  std::sort(types, types + type_count,
+            [](const Row& a, const Row& b) { return a.cycles > b.cycles; });
+  for (int i = 0; i < type_count; ++i) {
+    const Row& type = types[i];
+    ESP_LOGI(TAG, "  %-28s %3d layers %7lu calls %10.1f us/invoke %5.1f%%%s", type.tag,
+             type.layers, (unsigned long) type.calls, mean_us(type), share(type),
+             type.nested ? " (nested)" : "");
+    if (file != nullptr) {
+      fprintf(file, "{\"op_profile\": \"%s\", \"platform\": \"%s\", \"op\": \"%s\", "
+              "\"nested\": %s, \"layers\": %d, \"calls\": %lu, \"us_per_invoke\": %.2f, "
+              "\"share_percent\": %.2f}\n", name_, BenchmarkPlatform(), type.tag,
+              type.nested ? "true" : "false", type.layers, (unsigned long) type.calls,
+              mean_us(type), share(type));
+    }
+  }
+  for (int i = 0; i < layer_count; ++i) {
+    const Row& layer = layers[i];
+    ESP_LOGI(TAG, "  #%-3d %-23s %7lu calls %10.1f us/invoke %5.1f%%%s", i, layer.tag,
+             (unsigned long) layer.calls, mean_us(layer), share(layer),
+             layer.nested ? " (nested)" : "");
+    if (file != nullptr) {
+      fprintf(file, "{\"op_profile\": \"%s\", \"platform\": \"%s\", \"layer\": %d, "
+              "\"op\": \"%s\", \"nested\": %s, \"calls\": %lu, \"us_per_invoke\": %.2f, "
+              "\"share_percent\": %.2f}\n", name_, BenchmarkPlatform(), i, layer.tag,
+              layer.nested ? "true" : "false", (unsigned long) layer.calls, mean_us(layer),
+              share(layer));
+    }
+  }
+}
+
+void ReportOpProfiles(const char* path) {
+  const int count = g_profiler_count.load(std::memory_order_acquire);
+  if (count == 0) {
+    return;
+  }
+  FILE* file = nullptr;
+  if (path != nullptr) {
+    file = fopen(path, "a");
+    if (file == nullptr) {
+      ESP_LOGE(TAG, "Failed to open %s: %s", path, strerror(errno));
+    }
+  }
+  for (int i = 0; i < count; ++i) {
+    g_profilers[i]->Report(file);
+  }
+  if (file != nullptr) {
+    fclose(file);
+  }
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include "sdkconfig.h"
+#include "tensorflow/lite/micro/micro_profiler_interface.h"
+
+// Per-operator timing of a TFLM interpreter, for finding the layers of a
+// model worth changing. Passed to the MicroInterpreter as its profiler, it
+// gets an event around every operator the interpreter invokes and accounts
+// its cycles to the operator's position in the Invoke(), its layer.
+// Report() then sums the layers up by op type too, with each one's share of
+// the total, the same way on the board and on the host.
+//
+// BeginInvoke() has to be called before each Invoke(), for the layers to be
+// counted from the first one again. Events past kMaxLayers of them in one
+// Invoke() are only counted in the total. Nested events, such as the
+// operators of a subgraph called by another one, get a layer of their own
+// but aren't counted twice in the total.
+//
+// The counters have a single writer, the task running the interpreter, and
+// Report() can run in any other one.
+class OpProfiler : public tflite::MicroProfilerInterface {
+ public:
+  static constexpr int kMaxLayers = 128;
+
+  // name identifies the interpreter in the reports; it isn't copied.
+  explicit OpProfiler(const char* name);
+  OpProfiler(const OpProfiler&) = delete;
+  OpProfiler& operator=(const OpProfiler&) = delete;
+
+  void BeginInvoke();
+  uint32_t BeginEvent(const char* tag) override;
+  void EndEvent(uint32_t event_handle) override;
+
+  // Logs the invokes since the previous call, their mean time, then the
+  // mean time per Invoke() of each op type and of each layer, with their
+  // call counts and share of the total. When file isn't null, also writes
+  // each op type and layer to it as a JSON line.
+  void Report(FILE* file);
+
+ private:
+  struct Layer {
+    const char* tag;
+    bool nested;
+    std::atomic<uint32_t> calls;
+    std::atomic<uint64_t> cycles;
+  };
+  struct LayerSnapshot {
+    uint32_t calls;
+    uint64_t cycles;
+  };
+
+  const char* name_;
+  Layer layers_[kMaxLayers] = {};
+  uint32_t starts_[kMaxLayers] = {};
+  int next_layer_ = 0;
+  int depth_ = 0;
+  std::atomic<uint32_t> invokes_{0};
+  // Top-level events only
+  std::atomic<uint64_t> total_cycles_{0};
+  // Events past kMaxLayers
+  std::atomic<uint32_t> overflow_calls_{0};
+  uint32_t overflow_start_ = 0;
+
+  uint32_t reported_invokes_ = 0;
+  uint64_t reported_total_cycles_ = 0;
+  uint32_t reported_overflow_calls_ = 0;
+  LayerSnapshot reported_layers_[kMaxLayers] = {};
+};
+
+// Reports every OpProfiler created so far, see OpProfiler::Report(),
+// appending the JSON lines to path when it isn't null.
+void ReportOpProfiles(const char* path);
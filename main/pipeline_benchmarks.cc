@@ -0,0 +1,1063 @@
+#include "pipeline_benchmarks.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "audio_frontend.h"
+#include "audio_ring.h"
+#include "benchmark.h"
+#include "capture_kernels.h"
+#include "channel_combiner.h"
+#include "feature_provider.h"
+#include "main_functions.h"
+#include "micro_features_generator.h"
+#include "micro_model_settings.h"
+#include "posterior_smoother.h"
+#include "prediction_logger.h"
+#include "ringbuf.h"
+#include "score_selection.h"
+#include "sd_card.h"
+#include "tensorflow/lite/micro/micro_interpreter.h"
+
+static const char *TAG = "benchmark";
+
+namespace {
+constexpr int kI2sSamplesPerRead = 1600;  // 100ms, as read by I2sAudioSource
+constexpr int kWindowSamples = kFeatureDurationMs * kAudioSampleFrequency / 1000;
+constexpr int kStrideSamples = kFeatureStrideMs * kAudioSampleFrequency / 1000;
+constexpr int kStridesPerRead = kI2sSamplesPerRead / kStrideSamples;
+
+// Equivalence checks of this run that found mismatches
+int g_failed_checks = 0;
+
+// ReportEquivalence(), counting the check in g_failed_checks if it failed.
+void CheckEquivalence(const char* name, int compared, int mismatches, int max_abs_diff,
+                      FILE* file) {
+  if (!ReportEquivalence(name, compared, mismatches, max_abs_diff, file)) {
+    g_failed_checks++;
+  }
+}
+
+int32_t g_i2s_words[kI2sSamplesPerRead];
+int32_t g_tdm_words[kI2sSamplesPerRead * kMaxCaptureChannels];
+int16_t g_channel_samples[kMaxCaptureChannels][kI2sSamplesPerRead];
+int16_t g_reference_channel_samples[kMaxCaptureChannels][kI2sSamplesPerRead];
+int16_t g_capture_samples[kI2sSamplesPerRead];
+int16_t g_reference_samples[kI2sSamplesPerRead];
+int16_t g_window[kWindowSamples];
+int8_t g_spectrogram[kFeatureElementCount];
+int8_t g_spectrogram_in_order[kFeatureElementCount];
+int16_t g_stride[kStrideSamples];
+int8_t g_bench_features[kFeatureSize];
+int8_t g_reference_features[kFeatureSize];
+AudioFrontend g_bench_frontend;
+
+// Deterministic noise, so every run and platform sees the same input.
+uint32_t NextNoise(uint32_t* state) {
+  *state = *state * 1664525u + 1013904223u;
+  return *state;
+}
+
+// White noise in [-1, 1) as a function of the sample index, so any stretch
+// of it can be generated on its own.
+float HashNoise(uint32_t t) {
+  uint32_t hash = t * 2654435761u;
+  hash ^= hash >> 15;
+  hash *= 2246822519u;
+  hash ^= hash >> 13;
+  return static_cast<int16_t>(hash >> 16) / 32768.0f;
+}
+
+// Sample t of a 5 s test signal that takes the frontend through its whole
+// range: silence, a tone sweep, noise fading in, clipping, then a quiet tone
+// in quiet noise, so the noise estimates and the gain control move a lot.
+int16_t FrontendTestSample(int t) {
+  constexpr float kPi = 3.14159265f;
+  constexpr int kSecond = kAudioSampleFrequency;
+  const float noise = HashNoise(t);
+  const float seconds = static_cast<float>(t) / kSecond;
+  if (t < kSecond / 2) {
+    return 0;
+  }
+  if (t < 3 * kSecond / 2) {
+    const float sweep_seconds = seconds - 0.5f;
+    const float phase = 2 * kPi * (200 * sweep_seconds + 3400 * sweep_seconds * sweep_seconds);
+    return static_cast<int16_t>(3000 * sinf(phase));
+  }
+  if (t < 3 * kSecond) {
+    return static_cast<int16_t>(32767 * noise * (seconds - 1.5f) / 1.5f);
+  }
+  if (t < 7 * kSecond / 2) {
+    return static_cast<int16_t>(std::max(-32768.0f, std::min(32767.0f, 131072 * noise)));
+  }
+  return static_cast<int16_t>(500 * sinf(2 * kPi * 1000 * seconds) + 200 * noise);
+}
+
+// Runs every capture kernel against the scalar reference on a block of noise
+// that keeps hitting the rails, with a few DC offsets and gains, over a
+// length that leaves the vector kernels a scalar tail.
+void CheckCaptureKernelEquivalence(FILE* results_file) {
+  struct Setting {
+    int16_t dc;
+    int16_t gain;
+  };
+  constexpr Setting kSettings[] = {
+      {0, kCaptureUnityGain}, {1234, 3 * kCaptureUnityGain},
+      {-20000, INT16_MAX},    {INT16_MIN, 1},
+  };
+  constexpr int kSamples = kI2sSamplesPerRead - 3;
+  int count = 0;
+  const CaptureKernel* kernels = CaptureKernels(&count);
+  for (int k = 1; k < count; ++k) {
+    int mismatches = 0;
+    int max_abs_diff = 0;
+    for (const Setting& setting : kSettings) {
+      uint32_t reference_clipped = 0;
+      uint32_t clipped = 0;
+      const int32_t reference_sum = kernels[0].convert(
+          g_i2s_words, g_reference_samples, kSamples, setting.dc, setting.gain,
+          &reference_clipped);
+      const int32_t sum = kernels[k].convert(g_i2s_words, g_capture_samples, kSamples,
+                                             setting.dc, setting.gain, &clipped);
+      for (int i = 0; i < kSamples; ++i) {
+        const int diff = std::abs(g_capture_samples[i] - g_reference_samples[i]);
+        if (diff != 0) {
+          mismatches++;
+          max_abs_diff = std::max(max_abs_diff, diff);
+        }
+      }
+      if (sum != reference_sum || clipped != reference_clipped) {
+        ESP_LOGW(TAG, "%s: sum %ld, %lu clipped; reference %ld, %lu clipped",
+                 kernels[k].name, static_cast<long>(sum), static_cast<unsigned long>(clipped),
+                 static_cast<long>(reference_sum),
+                 static_cast<unsigned long>(reference_clipped));
+        mismatches++;
+      }
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "capture_%s_vs_scalar_reference", kernels[k].name);
+    CheckEquivalence(name, static_cast<int>(std::size(kSettings)) * (kSamples + 1), mismatches,
+                     max_abs_diff, results_file);
+  }
+}
+
+// Every capture kernel this build and CPU have on one I2S read, with DC
+// removal and a gain so that nothing is skipped, then the equivalence check.
+void RunCaptureBenchmarks(int iterations, FILE* results_file) {
+  int count = 0;
+  const CaptureKernel* kernels = CaptureKernels(&count);
+  for (int k = 0; k < count; ++k) {
+    const CaptureKernelFunc convert = kernels[k].convert;
+    char name[64];
+    snprintf(name, sizeof(name), "capture_%s", kernels[k].name);
+    ReportBenchmark(RunBenchmark(name, iterations, [convert] {
+      uint32_t clipped = 0;
+      convert(g_i2s_words, g_capture_samples, kI2sSamplesPerRead, 100,
+              2 * kCaptureUnityGain, &clipped);
+    }), results_file);
+  }
+  // The in-place conversion the capture task does, with the fastest kernel.
+  // Converting in place overwrites the input, so the words are restored first,
+  // which the figure includes.
+  CaptureConditioner conditioner;
+  conditioner.Configure(true, 2 * kCaptureUnityGain);
+  static int32_t words[kI2sSamplesPerRead];
+  ReportBenchmark(RunBenchmark("capture_in_place", iterations, [&conditioner] {
+    memcpy(words, g_i2s_words, sizeof(words));
+    conditioner.Process(words, kI2sSamplesPerRead);
+  }), results_file);
+
+  CheckCaptureKernelEquivalence(results_file);
+}
+
+// Where each microphone of the test TDM signal hears the source, relative to
+// the first one, in samples
+constexpr int kTestChannelLags[kMaxCaptureChannels] = {0, 1, -2, 3};
+
+// Fills g_tdm_words with frames [start, start + kI2sSamplesPerRead) of four
+// microphones hearing the same broadband source at kTestChannelLags, each with
+// its own noise.
+void FillTdmTestBlock(int start) {
+  for (int i = 0; i < kI2sSamplesPerRead; ++i) {
+    const uint32_t t = start + i;
+    for (int c = 0; c < kMaxCaptureChannels; ++c) {
+      const float sample = 8000 * HashNoise(t - kTestChannelLags[c]) +
+                           1000 * HashNoise(t + (c + 1) * 7919u * 7919u);
+      g_tdm_words[i * kMaxCaptureChannels + c] = static_cast<int32_t>(sample) * 65536;
+    }
+  }
+}
+
+// Runs the vector channel kernels against the scalar reference for every
+// channel count, and with a few mixes, over a length that leaves a tail.
+void CheckChannelKernelEquivalence(FILE* results_file) {
+  constexpr int kSamples = kI2sSamplesPerRead - 5;
+  constexpr int16_t kWeightSets[][kMaxCaptureChannels] = {
+      {8192, 8192, 8192, 8192},
+      {INT16_MAX, 0, 0, 0},
+      {-16384, 16384, -100, 100},
+      {32767 / 3, -32767 / 3, 32767 / 3, 0},
+  };
+  // Noise from word to word, some of it at the rails
+  uint32_t noise = 7;
+  for (int32_t& word : g_tdm_words) {
+    word = static_cast<int32_t>(NextNoise(&noise));
+  }
+  int count = 0;
+  const ChannelKernel* kernels = ChannelKernels(&count);
+  int16_t* outputs[kMaxCaptureChannels];
+  int16_t* reference_outputs[kMaxCaptureChannels];
+  const int16_t* inputs[kMaxCaptureChannels];
+  for (int c = 0; c < kMaxCaptureChannels; ++c) {
+    outputs[c] = g_channel_samples[c];
+    reference_outputs[c] = g_reference_channel_samples[c];
+    inputs[c] = g_reference_channel_samples[c];
+  }
+  for (int k = 1; k < count; ++k) {
+    int compared = 0;
+    int mismatches = 0;
+    int max_abs_diff = 0;
+    auto compare = [&](const int16_t* samples, const int16_t* reference) {
+      for (int i = 0; i < kSamples; ++i) {
+        const int diff = std::abs(samples[i] - reference[i]);
+        if (diff != 0) {
+          mismatches++;
+          max_abs_diff = std::max(max_abs_diff, diff);
+        }
+      }
+      compared += kSamples;
+    };
+    for (int channels = 1; channels <= kMaxCaptureChannels; ++channels) {
+      uint32_t levels[kMaxCaptureChannels] = {};
+      uint32_t reference_levels[kMaxCaptureChannels] = {};
+      kernels[0].deinterleave(g_tdm_words, channels, kSamples, reference_outputs,
+                              reference_levels);
+      kernels[k].deinterleave(g_tdm_words, channels, kSamples, outputs, levels);
+      for (int c = 0; c < channels; ++c) {
+        compare(outputs[c], reference_outputs[c]);
+        mismatches += levels[c] != reference_levels[c];
+      }
+      for (const auto& weights : kWeightSets) {
+        kernels[0].mix(inputs, weights, channels, kSamples, g_reference_samples);
+        kernels[k].mix(inputs, weights, channels, kSamples, g_capture_samples);
+        compare(g_capture_samples, g_reference_samples);
+      }
+      const int16_t* shifted = inputs[channels - 1] + 1;
+      mismatches += kernels[k].correlate(inputs[0], shifted, kSamples - 1) !=
+                    kernels[0].correlate(inputs[0], shifted, kSamples - 1);
+      compared++;
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "channels_%s_vs_scalar_reference", kernels[k].name);
+    CheckEquivalence(name, compared, mismatches, max_abs_diff, results_file);
+  }
+}
+
+// Streams a few blocks of the test TDM signal through delay-and-sum and
+// checks that it found the lags the microphones were given.
+void CheckDelayEstimation(FILE* results_file) {
+  ChannelCombiner combiner;
+  if (combiner.Init(kMaxCaptureChannels, kI2sSamplesPerRead,
+                    ChannelCombineMode::kDelayAndSum) != kTfLiteOk) {
+    return;
+  }
+  for (int block = 0; block < 3; ++block) {
+    FillTdmTestBlock(block * kI2sSamplesPerRead);
+    combiner.Process(g_tdm_words, kI2sSamplesPerRead, g_capture_samples);
+  }
+  int mismatches = 0;
+  int max_abs_diff = 0;
+  for (int c = 1; c < kMaxCaptureChannels; ++c) {
+    const int diff = std::abs(combiner.delay(c) - kTestChannelLags[c]);
+    mismatches += diff != 0;
+    max_abs_diff = std::max(max_abs_diff, diff);
+  }
+  CheckEquivalence("delay_and_sum_lags", kMaxCaptureChannels - 1, mismatches,
+                   max_abs_diff, results_file);
+}
+
+// De-interleaving, mixing and cross-correlating four channels of one I2S read
+// with every channel kernel, the whole combine stage in each mode, then the
+// checks.
+void RunChannelBenchmarks(int iterations, FILE* results_file) {
+  FillTdmTestBlock(0);
+  int count = 0;
+  const ChannelKernel* kernels = ChannelKernels(&count);
+  int16_t* outputs[kMaxCaptureChannels];
+  const int16_t* inputs[kMaxCaptureChannels];
+  for (int c = 0; c < kMaxCaptureChannels; ++c) {
+    outputs[c] = g_channel_samples[c];
+    inputs[c] = g_channel_samples[c];
+  }
+  constexpr int16_t kWeights[kMaxCaptureChannels] = {8192, 8192, 8192, 8192};
+  for (int k = 0; k < count; ++k) {
+    const ChannelKernel* kernel = &kernels[k];
+    char name[64];
+    snprintf(name, sizeof(name), "deinterleave4_%s", kernel->name);
+    ReportBenchmark(RunBenchmark(name, iterations, [kernel, &outputs] {
+      uint32_t levels[kMaxCaptureChannels] = {};
+      kernel->deinterleave(g_tdm_words, kMaxCaptureChannels, kI2sSamplesPerRead,
+                           outputs, levels);
+    }), results_file);
+    snprintf(name, sizeof(name), "mix4_%s", kernel->name);
+    ReportBenchmark(RunBenchmark(name, iterations, [kernel, &inputs, &kWeights] {
+      kernel->mix(inputs, kWeights, kMaxCaptureChannels, kI2sSamplesPerRead,
+                  g_capture_samples);
+    }), results_file);
+    snprintf(name, sizeof(name), "correlate_%s", kernel->name);
+    ReportBenchmark(RunBenchmark(name, iterations, [kernel, &inputs] {
+      kernel->correlate(inputs[0], inputs[1], kI2sSamplesPerRead);
+    }), results_file);
+  }
+
+  struct Mode {
+    const char* name;
+    ChannelCombineMode mode;
+  };
+  constexpr Mode kModes[] = {
+      {"combine4_select_best", ChannelCombineMode::kSelectBest},
+      {"combine4_sum", ChannelCombineMode::kSum},
+      {"combine4_delay_and_sum", ChannelCombineMode::kDelayAndSum},
+  };
+  for (const Mode& mode : kModes) {
+    ChannelCombiner combiner;
+    if (combiner.Init(kMaxCaptureChannels, kI2sSamplesPerRead, mode.mode) != kTfLiteOk) {
+      ESP_LOGE(TAG, "Couldn't set up the channel combiner");
+      return;
+    }
+    ReportBenchmark(RunBenchmark(mode.name, iterations, [&combiner] {
+      combiner.Process(g_tdm_words, kI2sSamplesPerRead, g_capture_samples);
+    }), results_file);
+  }
+
+  CheckDelayEstimation(results_file);
+  CheckChannelKernelEquivalence(results_file);
+}
+
+// Streams the test signal through the interpreted preprocessor and the
+// native frontend, from a fresh state, and compares every feature.
+TfLiteStatus CheckFrontendEquivalence(FILE* results_file) {
+  constexpr int kWindows = 5 * 1000 / kFeatureStrideMs;
+  TF_LITE_ENSURE_STATUS(InitializeInterpretedFeatures());
+  TF_LITE_ENSURE_STATUS(g_bench_frontend.Init());
+  int mismatches = 0;
+  int max_abs_diff = 0;
+  for (int window = 0; window < kWindows; ++window) {
+    for (int i = 0; i < kWindowSamples; ++i) {
+      g_window[i] = FrontendTestSample(window * kStrideSamples + i);
+    }
+    TF_LITE_ENSURE_STATUS(GenerateInterpretedFeature(g_window, g_reference_features));
+    g_bench_frontend.Process(g_window, g_bench_features);
+    for (int i = 0; i < kFeatureSize; ++i) {
+      const int diff = std::abs(g_bench_features[i] - g_reference_features[i]);
+      if (diff != 0) {
+        if (mismatches == 0) {
+          ESP_LOGW(TAG, "First frontend mismatch: window %d, channel %d: %d, "
+                   "preprocessor model %d", window, i, g_bench_features[i],
+                   g_reference_features[i]);
+        }
+        mismatches++;
+        max_abs_diff = std::max(max_abs_diff, diff);
+      }
+    }
+  }
+  CheckEquivalence("audio_frontend_vs_preprocessor", kWindows * kFeatureSize,
+                   mismatches, max_abs_diff, results_file);
+  return kTfLiteOk;
+}
+
+// The interpreted preprocessor against the native frontend: speed on one
+// window, then equality on a whole stream.
+void RunFrontendBenchmarks(int iterations, FILE* results_file) {
+  if (InitializeInterpretedFeatures() != kTfLiteOk ||
+      g_bench_frontend.Init() != kTfLiteOk) {
+    ESP_LOGE(TAG, "Couldn't set up the audio frontends");
+    g_failed_checks++;
+    return;
+  }
+  const BenchmarkResult interpreted =
+      RunBenchmark("audio_preprocessor", iterations, [] {
+        GenerateInterpretedFeature(g_window, g_bench_features);
+      });
+  ReportBenchmark(interpreted, results_file);
+  const BenchmarkResult native = RunBenchmark("audio_frontend", iterations, [] {
+    g_bench_frontend.Process(g_window, g_bench_features);
+  });
+  ReportBenchmark(native, results_file);
+  ESP_LOGI(TAG, "Native audio frontend: %.1fx the speed of the preprocessor model",
+           static_cast<double>(interpreted.mean_us / native.mean_us));
+
+  if (CheckFrontendEquivalence(results_file) != kTfLiteOk) {
+    ESP_LOGE(TAG, "Couldn't compare the audio frontends");
+    g_failed_checks++;
+  }
+}
+
+// The capture -> feature handoff through either ring buffer implementation:
+// exactly one of rb and ring is set.
+struct RingHandoff {
+  ringbuf_t* rb;
+  AudioRing* ring;
+  int blocks;
+  volatile bool producer_done;
+};
+
+int RingWrite(RingHandoff* handoff, TickType_t ticks_to_wait) {
+  const int16_t* block = reinterpret_cast<const int16_t*>(g_i2s_words);
+  if (handoff->rb != nullptr) {
+    return rb_write(handoff->rb, reinterpret_cast<const uint8_t*>(block),
+                    kI2sSamplesPerRead * sizeof(int16_t), ticks_to_wait) /
+           sizeof(int16_t);
+  }
+  return handoff->ring->Write(block, kI2sSamplesPerRead, ticks_to_wait);
+}
+
+int RingRead(RingHandoff* handoff, TickType_t ticks_to_wait) {
+  if (handoff->rb != nullptr) {
+    const int bytes_read = rb_read(handoff->rb, reinterpret_cast<uint8_t*>(g_stride),
+                                   sizeof(g_stride), ticks_to_wait);
+    return bytes_read > 0 ? bytes_read / sizeof(int16_t) : 0;
+  }
+  return std::max(handoff->ring->Read(g_stride, kStrideSamples, ticks_to_wait), 0);
+}
+
+// Stands in for the capture task, minus the pacing: writes 100ms blocks as
+// fast as the consumer lets it.
+void RingProducer(void* arg) {
+  auto* handoff = static_cast<RingHandoff*>(arg);
+  for (int i = 0; i < handoff->blocks; ++i) {
+    RingWrite(handoff, portMAX_DELAY);
+  }
+  if (handoff->rb != nullptr) {
+    rb_signal_writer_finished(handoff->rb);
+  } else {
+    handoff->ring->SignalWriterFinished();
+  }
+  handoff->producer_done = true;
+  vTaskDelete(nullptr);
+}
+
+// Uncontended cost of moving one 100ms block through the ring: one write and
+// the stride reads the feature task would do.
+BenchmarkResult BenchmarkRingBlock(const char* name, RingHandoff* handoff,
+                                   int iterations) {
+  return RunBenchmark(name, iterations, [handoff] {
+    RingWrite(handoff, 0);
+    for (int i = 0; i < kStridesPerRead; ++i) {
+      RingRead(handoff, 0);
+    }
+  });
+}
+
+// Latency of each stride read while a producer task keeps the ring busy, so
+// both sides contend on it like the capture and feature tasks do.
+BenchmarkResult BenchmarkRingHandoff(const char* name, RingHandoff* handoff,
+                                     int iterations) {
+  handoff->blocks = (iterations + kStridesPerRead - 1) / kStridesPerRead;
+  handoff->producer_done = false;
+  xTaskCreatePinnedToCore(RingProducer, "RingProducer", 1024 * 4, handoff, 8,
+                          nullptr, 0);
+  std::vector<uint32_t> cycles;
+  cycles.reserve(handoff->blocks * kStridesPerRead);
+  while (true) {
+    const uint32_t start = CycleCount();
+    if (RingRead(handoff, portMAX_DELAY) == 0) {
+      break;
+    }
+    cycles.push_back(CycleCount() - start);
+  }
+  while (!handoff->producer_done) {
+    vTaskDelay(1);
+  }
+  return SummarizeBenchmark(name, cycles);
+}
+
+void RunRingBenchmarks(int iterations, FILE* results_file) {
+  constexpr int kRingSamples = kAudioSampleFrequency;
+  RingHandoff legacy = {rb_init("bench_ringbuf", kRingSamples * sizeof(int16_t)),
+                        nullptr, 0, false};
+  AudioRing ring;
+  RingHandoff lock_free = {nullptr, &ring, 0, false};
+  if (legacy.rb == nullptr || ring.Init(kRingSamples) != kTfLiteOk) {
+    ESP_LOGE(TAG, "Couldn't allocate the ring buffers");
+    return;
+  }
+
+  ReportBenchmark(BenchmarkRingBlock("ringbuf_c_block", &legacy, iterations),
+                  results_file);
+  ReportBenchmark(BenchmarkRingBlock("audio_ring_block", &lock_free, iterations),
+                  results_file);
+  rb_reset(legacy.rb);
+  ring.Reset();
+  ReportBenchmark(BenchmarkRingHandoff("ringbuf_c_handoff", &legacy, iterations),
+                  results_file);
+  ReportBenchmark(BenchmarkRingHandoff("audio_ring_handoff", &lock_free, iterations),
+                  results_file);
+  rb_cleanup(legacy.rb);
+}
+}  // namespace
+
+// Logs iterations records, 100 ms apart, as fast as the logger's writer
+// takes them, and reports how many bytes it wrote and at what rate.
+void ReportPredictionLogRate(const char* name, sdcard::PredictionLogger* logger,
+                             const int8_t* scores, int iterations,
+                             int64_t* timestamp_ms, FILE* results_file) {
+  const uint64_t bytes_before = logger->GetStats().bytes_written;
+  const int64_t start_us = esp_timer_get_time();
+  for (int i = 0; i < iterations; ++i) {
+    while (!logger->Log(scores, *timestamp_ms, false)) {
+      logger->Flush();
+    }
+    *timestamp_ms += 100;
+  }
+  logger->Flush();
+  const int64_t elapsed_us = esp_timer_get_time() - start_us;
+  const uint64_t bytes = logger->GetStats().bytes_written - bytes_before;
+  ReportThroughput(name, bytes, elapsed_us, results_file);
+  ESP_LOGI(TAG, "%s: %d records of %.1f bytes, %.0f records/s", name, iterations,
+           static_cast<double>(bytes) / iterations, iterations * 1e6 / elapsed_us);
+}
+
+// What logging one row of predictions costs the inference task: the old
+// synchronous path (size check, one fprintf per category, fflush and fsync)
+// against queueing it for a PredictionLogger. The logger writes to its own
+// directory on the card, and is flushed between batches, untimed, so that
+// nothing is dropped. Then how fast the writer gets rows onto the card, and
+// how big they are, as CSV and in the binary format.
+void RunPredictionLogBenchmarks(int iterations, FILE* results_file) {
+  // Output quantization of a typical int8 classifier
+  constexpr float kScale = 1.0f / 256;
+  constexpr int kZeroPoint = -128;
+  int8_t scores[kCategoryCount];
+  float predictions[kCategoryCount];
+  uint32_t noise = 1;
+  for (int i = 0; i < kCategoryCount; ++i) {
+    scores[i] = static_cast<int8_t>(NextNoise(&noise) >> 24);
+    predictions[i] = (scores[i] - kZeroPoint) * kScale;
+  }
+
+  char path[256];
+  snprintf(path, sizeof(path), "%s/bench_predictions.csv", sdcard::mountPoint());
+  FILE* file = fopen(path, "a");
+  if (file == nullptr) {
+    ESP_LOGE(TAG, "Failed to open %s: %s", path, strerror(errno));
+    return;
+  }
+  int64_t timestamp_ms = 0;
+  ReportBenchmark(RunBenchmark("prediction_log_sync_row", iterations,
+                               [file, &predictions, &timestamp_ms] {
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) < 0) {
+      return;
+    }
+    fprintf(file, "%lld", (long long) timestamp_ms++);
+    for (int i = 0; i < kCategoryCount; i++) {
+      fprintf(file, ",%.4f", predictions[i]);
+    }
+    fprintf(file, "\n");
+    fflush(file);
+    fsync(fileno(file));
+  }), results_file);
+  fclose(file);
+  remove(path);
+
+  static sdcard::PredictionLogger logger;
+  static char log_directory[256];
+  snprintf(log_directory, sizeof(log_directory), "%s/bench_log", sdcard::mountPoint());
+  mkdir(log_directory, 0755);
+  if (logger.Start(log_directory,
+                   {1000, 32, sdcard::PredictionLogger::Format::kCsv, kScale, kZeroPoint, 0,
+                    nullptr})
+      != ESP_OK) {
+    return;
+  }
+  std::vector<uint32_t> cycles(iterations);
+  for (int i = 0; i < iterations; ++i) {
+    if (i % (sdcard::PredictionLogger::kQueueCapacity / 2) == 0) {
+      logger.Flush();
+    }
+    const uint32_t start = CycleCount();
+    logger.Log(scores, timestamp_ms++);
+    cycles[i] = CycleCount() - start;
+  }
+  ReportBenchmark(SummarizeBenchmark("prediction_log_enqueue", cycles), results_file);
+  logger.Flush();
+  const sdcard::PredictionLogger::Stats stats = logger.GetStats();
+  ESP_LOGI(TAG, "Prediction log writer: %lu records in %lu commits, mean %lld us, "
+           "worst %lld us, %lu dropped", (unsigned long) stats.committed,
+           (unsigned long) stats.commits,
+           (long long) (stats.commits > 0 ? stats.commit_sum_us / stats.commits : 0),
+           (long long) stats.commit_max_us, (unsigned long) stats.dropped);
+
+  ReportPredictionLogRate("prediction_log_csv_rate", &logger, scores, iterations,
+                          &timestamp_ms, results_file);
+  static sdcard::PredictionLogger binary_logger;
+  static char binary_log_directory[256];
+  snprintf(binary_log_directory, sizeof(binary_log_directory), "%s/bench_binlog",
+           sdcard::mountPoint());
+  mkdir(binary_log_directory, 0755);
+  if (binary_logger.Start(binary_log_directory,
+                          {1000, 32, sdcard::PredictionLogger::Format::kBinary, kScale,
+                           kZeroPoint, 0, nullptr}) != ESP_OK) {
+    return;
+  }
+  ReportPredictionLogRate("prediction_log_binary_rate", &binary_logger, scores, iterations,
+                          &timestamp_ms, results_file);
+
+  // Sparse: the top score only
+  static sdcard::PredictionLogger sparse_logger;
+  static char sparse_log_directory[256];
+  snprintf(sparse_log_directory, sizeof(sparse_log_directory), "%s/bench_sparselog",
+           sdcard::mountPoint());
+  mkdir(sparse_log_directory, 0755);
+  if (sparse_logger.Start(sparse_log_directory,
+                          {1000, 32, sdcard::PredictionLogger::Format::kCsv, kScale,
+                           kZeroPoint, 1, nullptr}) != ESP_OK) {
+    return;
+  }
+  ReportPredictionLogRate("prediction_log_csv_top1_rate", &sparse_logger, scores, iterations,
+                          &timestamp_ms, results_file);
+  static sdcard::PredictionLogger sparse_binary_logger;
+  static char sparse_binary_log_directory[256];
+  snprintf(sparse_binary_log_directory, sizeof(sparse_binary_log_directory),
+           "%s/bench_sparsebinlog", sdcard::mountPoint());
+  mkdir(sparse_binary_log_directory, 0755);
+  if (sparse_binary_logger.Start(sparse_binary_log_directory,
+                                 {1000, 32, sdcard::PredictionLogger::Format::kBinary, kScale,
+                                  kZeroPoint, 1, nullptr}) != ESP_OK) {
+    return;
+  }
+  ReportPredictionLogRate("prediction_log_binary_top1_rate", &sparse_binary_logger, scores,
+                          iterations, &timestamp_ms, results_file);
+}
+
+// The PosteriorSmoother's update, and its running sums checked against
+// averaging the window from scratch on every result: a stream of results
+// 100 ms apart with jitter and gaps, scores drifting so that categories take
+// turns at the top, on a 1 s window that holds at most 8 of them.
+void RunPosteriorSmootherBenchmarks(int iterations, FILE* results_file) {
+  constexpr float kScale = 1.0f / 256;
+  constexpr int kZeroPoint = -128;
+  constexpr PosteriorSmoother::Config kConfig = {1000, 0.5f, 1500, 3, 8};
+  // The threshold as the smoother quantizes it
+  const int threshold = static_cast<int>(std::ceil(kConfig.detection_threshold / kScale)) +
+                        kZeroPoint;
+  static PosteriorSmoother smoother;
+  if (smoother.Init(kConfig, kScale, kZeroPoint) != ESP_OK) {
+    return;
+  }
+
+  struct Entry {
+    int64_t time_ms;
+    int8_t scores[kCategoryCount];
+  };
+  std::deque<Entry> window;
+  std::vector<int64_t> last_detection_ms(kCategoryCount, INT64_MIN);
+  int8_t averages[kCategoryCount];
+  uint32_t noise = 1;
+  int64_t time_ms = 0;
+  int compared = 0;
+  int mismatches = 0;
+  int max_abs_diff = 0;
+  for (int step = 0; step < 2000; ++step) {
+    time_ms += 60 + NextNoise(&noise) % 80 + (NextNoise(&noise) % 50 == 0 ? 2000 : 0);
+    Entry entry = {time_ms, {}};
+    for (int i = 0; i < kCategoryCount; ++i) {
+      const int favored = (step / 25) % kCategoryCount;
+      const int base = i == favored ? 60 : -100;
+      entry.scores[i] = static_cast<int8_t>(
+          std::min(127, std::max(-128, base + static_cast<int>(NextNoise(&noise) >> 26) - 32)));
+    }
+    PosteriorSmoother::Result result;
+    smoother.Update(entry.scores, time_ms, &result);
+    smoother.GetAverages(averages);
+
+    while (!window.empty() && (static_cast<int>(window.size()) == kConfig.max_results ||
+                               window.front().time_ms < time_ms - kConfig.average_window_ms)) {
+      window.pop_front();
+    }
+    window.push_back(entry);
+    int top = 0;
+    double top_mean = -1000;
+    int top_hits = 0;
+    for (int i = 0; i < kCategoryCount; ++i) {
+      double sum = 0;
+      int hits = 0;
+      for (const Entry& e : window) {
+        sum += e.scores[i];
+        hits += e.scores[i] >= threshold;
+      }
+      const double mean = sum / window.size();
+      const int average = static_cast<int>(std::floor(mean + 0.5));
+      max_abs_diff = std::max(max_abs_diff, std::abs(average - averages[i]));
+      mismatches += average != averages[i];
+      compared++;
+      if (mean > top_mean) {
+        top = i;
+        top_mean = mean;
+        top_hits = hits;
+      }
+    }
+    int category = -1;
+    bool is_new_detection = false;
+    if (top_mean >= threshold && top_hits >= kConfig.minimum_count) {
+      category = top;
+      if (last_detection_ms[top] == INT64_MIN ||
+          time_ms - last_detection_ms[top] >= kConfig.suppression_ms) {
+        last_detection_ms[top] = time_ms;
+        is_new_detection = true;
+      }
+    }
+    mismatches += category != result.category || is_new_detection != result.is_new_detection;
+    compared++;
+  }
+  CheckEquivalence("posterior_smoother", compared, mismatches, max_abs_diff, results_file);
+
+  int8_t scores[kCategoryCount];
+  for (int i = 0; i < kCategoryCount; ++i) {
+    scores[i] = static_cast<int8_t>(NextNoise(&noise) >> 24);
+  }
+  ReportBenchmark(RunBenchmark("posterior_smoother_update", iterations,
+                               [&scores, &time_ms] {
+    PosteriorSmoother::Result result;
+    time_ms += 100;
+    smoother.Update(scores, time_ms, &result);
+  }), results_file);
+}
+
+// Picking the scores a sparse log keeps out of a large label set, as
+// BirdNET's 6522 categories: SelectTopScores() against sorting the
+// categories by score with std::partial_sort, which it has to agree with.
+// Then how long formatting a dense CSV row of all of them takes, which is
+// what the selection saves.
+void RunScoreSelectionBenchmarks(int iterations, FILE* results_file) {
+  constexpr int kCategories = 6522;
+  constexpr int kTopK = 5;
+  static int8_t scores[kCategories];
+  static int8_t min_scores[kCategories];
+  static uint16_t selected[kCategories];
+  static uint16_t reference[kCategories];
+  uint32_t noise = 1;
+  for (int i = 0; i < kCategories; ++i) {
+    // Mostly low scores, as a softmax output is, with ties
+    scores[i] = static_cast<int8_t>(-128 + (NextNoise(&noise) >> 26));
+    min_scores[i] = static_cast<int8_t>(-128 + (NextNoise(&noise) >> 27));
+  }
+  for (int i = 0; i < 8; ++i) {
+    scores[NextNoise(&noise) % kCategories] = static_cast<int8_t>(NextNoise(&noise) >> 24);
+  }
+
+  // Every combination of the options, on the same scores
+  int compared = 0;
+  int mismatches = 0;
+  for (const int top_k : {kTopK, 1, 64, 0}) {
+    for (const int8_t* min : {static_cast<const int8_t*>(nullptr),
+                              static_cast<const int8_t*>(min_scores)}) {
+      int candidates = 0;
+      for (int i = 0; i < kCategories; ++i) {
+        if (min == nullptr || scores[i] >= min[i]) {
+          reference[candidates++] = static_cast<uint16_t>(i);
+        }
+      }
+      const int expected = top_k > 0 ? std::min(top_k, candidates) : candidates;
+      std::partial_sort(reference, reference + expected, reference + candidates,
+                        [](uint16_t a, uint16_t b) {
+        return scores[a] != scores[b] ? scores[a] > scores[b] : a < b;
+      });
+      const int kept = SelectTopScores(scores, kCategories, top_k, min, selected);
+      compared += expected;
+      if (kept != expected) {
+        mismatches += std::abs(kept - expected);
+      }
+      for (int i = 0; i < std::min(kept, expected); ++i) {
+        mismatches += selected[i] != reference[i];
+      }
+    }
+  }
+  CheckEquivalence("score_select", compared, mismatches, 0, results_file);
+
+  ReportBenchmark(RunBenchmark("score_select_top5_6k", iterations, [] {
+    SelectTopScores(scores, kCategories, kTopK, nullptr, selected);
+  }), results_file);
+  ReportBenchmark(RunBenchmark("score_partial_sort_top5_6k", iterations, [] {
+    for (int i = 0; i < kCategories; ++i) {
+      reference[i] = static_cast<uint16_t>(i);
+    }
+    std::partial_sort(reference, reference + kTopK, reference + kCategories,
+                      [](uint16_t a, uint16_t b) {
+      return scores[a] != scores[b] ? scores[a] > scores[b] : a < b;
+    });
+  }), results_file);
+  static char line[kCategories * 8];
+  ReportBenchmark(RunBenchmark("score_format_dense_row_6k", iterations, [] {
+    size_t length = 0;
+    for (int i = 0; i < kCategories; ++i) {
+      length += snprintf(line + length, sizeof(line) - length, ",%.4f",
+                         (scores[i] + 128) / 256.0f);
+    }
+  }), results_file);
+}
+
+// Streams iterations blocks of 128 ms of audio to the card, with a
+// writeBytes() call per block and then through a StreamWriter, and reports
+// the time per block and the sustained rate of both.
+void RunStreamWriterBenchmarks(int iterations, FILE* results_file) {
+  constexpr size_t kBlockSize = 4096;
+  static uint8_t block[kBlockSize];
+  uint32_t noise = 1;
+  for (uint8_t& byte : block) {
+    byte = static_cast<uint8_t>(NextNoise(&noise) >> 24);
+  }
+  std::vector<uint32_t> cycles(iterations);
+
+  char path[256];
+  snprintf(path, sizeof(path), "%s/bench_stream.raw", sdcard::mountPoint());
+  remove(path);
+  int64_t start_us = esp_timer_get_time();
+  for (int i = 0; i < iterations; ++i) {
+    const uint32_t start = CycleCount();
+    sdcard::writeBytes(path, block, kBlockSize);
+    cycles[i] = CycleCount() - start;
+  }
+  ReportThroughput("sd_write_bytes_4k_rate", uint64_t{kBlockSize} * iterations,
+                   esp_timer_get_time() - start_us, results_file);
+  ReportBenchmark(SummarizeBenchmark("sd_write_bytes_4k", cycles), results_file);
+  remove(path);
+
+  static char stream_directory[256];
+  snprintf(stream_directory, sizeof(stream_directory), "%s/bench_stream",
+           sdcard::mountPoint());
+  mkdir(stream_directory, 0755);
+  sdcard::StreamWriter writer;
+  const sdcard::StreamWriter::Config config = {
+      stream_directory, "raw", 2 * 1024 * 1024, 1024 * 1024, 1000, 0, nullptr, 0};
+  start_us = esp_timer_get_time();
+  if (writer.Open(config) != ESP_OK) {
+    return;
+  }
+  const unsigned int first_file = writer.file_index();
+  for (int i = 0; i < iterations; ++i) {
+    const uint32_t start = CycleCount();
+    writer.Write(block, kBlockSize);
+    cycles[i] = CycleCount() - start;
+  }
+  const unsigned int last_file = writer.file_index();
+  writer.Close();
+  ReportThroughput("stream_writer_4k_rate", uint64_t{kBlockSize} * iterations,
+                   esp_timer_get_time() - start_us, results_file);
+  ReportBenchmark(SummarizeBenchmark("stream_writer_4k", cycles), results_file);
+  const sdcard::StreamWriter::Stats& stats = writer.stats();
+  ESP_LOGI(TAG, "Stream writer: %lu files, %lu writes (worst %lld us), %lu syncs "
+           "(worst %lld us), %lu errors", (unsigned long) stats.files,
+           (unsigned long) stats.writes, (long long) stats.write_max_us,
+           (unsigned long) stats.syncs, (long long) stats.sync_max_us,
+           (unsigned long) stats.write_errors);
+  // Room for the directory and the file name after it
+  char file_path[sizeof(stream_directory) + 16];
+  for (unsigned int i = first_file; i <= last_file; ++i) {
+    snprintf(file_path, sizeof(file_path), "%s/%u.raw", stream_directory, i);
+    remove(file_path);
+  }
+}
+
+// Invoke() with the whole tensor arena in PSRAM, as it used to be, and with a
+// hybrid one, on the same spectrogram, then checks that both give the same
+// scores. The classifier's own interpreter stands for its placement, since on
+// the board it may hold the internal RAM a second hybrid arena would need;
+// the other one gets an interpreter of its own.
+static void RunArenaPlacementBenchmarks(int iterations, FILE* results_file) {
+  struct Run {
+    TensorArena::Placement placement;
+    const char* name;
+    int8_t scores[kCategoryCount];
+    bool done;
+  };
+  Run runs[] = {{TensorArena::Placement::kPsram, "classifier_invoke_psram_arena", {}, false},
+                {TensorArena::Placement::kHybrid, "classifier_invoke_hybrid_arena", {}, false}};
+  alignas(tflite::MicroInterpreter) static uint8_t storage[sizeof(tflite::MicroInterpreter)];
+  for (Run& run : runs) {
+    TensorArena arena;
+    tflite::MicroInterpreter* interpreter = classifier_interpreter();
+    const bool own = classifier_tensor_arena()->placement() != run.placement;
+    if (own) {
+      interpreter = build_classifier_interpreter(run.placement, &arena, storage);
+      if (interpreter != nullptr && arena.placement() != run.placement) {
+        ESP_LOGW(TAG, "No internal RAM left for a second hybrid arena, skipping %s", run.name);
+        interpreter->~MicroInterpreter();
+        continue;
+      }
+    }
+    if (interpreter == nullptr) {
+      ESP_LOGE(TAG, "Can't build the classifier for %s", run.name);
+      continue;
+    }
+    memcpy(tflite::GetTensorData<int8_t>(interpreter->input(0)), g_spectrogram,
+           kFeatureElementCount);
+    ReportBenchmark(RunBenchmark(run.name, iterations, [interpreter] {
+      interpreter->Invoke();
+    }), results_file);
+    memcpy(run.scores, tflite::GetTensorData<int8_t>(interpreter->output(0)), kCategoryCount);
+    run.done = true;
+    if (own) {
+      interpreter->~MicroInterpreter();
+    }
+  }
+
+  if (runs[0].done && runs[1].done) {
+    int mismatches = 0;
+    int max_abs_diff = 0;
+    for (int i = 0; i < kCategoryCount; ++i) {
+      const int diff = std::abs(runs[0].scores[i] - runs[1].scores[i]);
+      mismatches += diff != 0;
+      max_abs_diff = std::max(max_abs_diff, diff);
+    }
+    CheckEquivalence("classifier_psram_vs_hybrid_arena", kCategoryCount, mismatches,
+                     max_abs_diff, results_file);
+  }
+}
+
+// Loading the classifier model from each source there is one on, with its
+// checks, then building an interpreter on it and its first Invoke(), which
+// reads the weights from the source rather than a warm cache, and the ones
+// after it. The interpreters all get a PSRAM arena, so that only the model's
+// placement differs.
+static void RunModelSourceBenchmarks(int iterations, FILE* results_file) {
+  struct Run {
+    ModelLoader::Source source;
+    const char* load_name;
+    const char* build_name;
+    const char* first_invoke_name;
+    const char* invoke_name;
+  };
+  constexpr Run runs[] = {
+      {ModelLoader::Source::kBuiltIn, "model_load_builtin", "classifier_build_builtin_model",
+       "classifier_first_invoke_builtin_model", "classifier_invoke_builtin_model"},
+      {ModelLoader::Source::kPartition, "model_load_partition",
+       "classifier_build_partition_model", "classifier_first_invoke_partition_model",
+       "classifier_invoke_partition_model"},
+      {ModelLoader::Source::kSdCard, "model_load_sd_card", "classifier_build_sd_card_model",
+       "classifier_first_invoke_sd_card_model", "classifier_invoke_sd_card_model"}};
+  // Reading a model from the card takes a while
+  constexpr int kLoadIterations = 3;
+  const tflite::MicroOpResolver* op_resolver = classifier_op_resolver();
+  alignas(tflite::MicroInterpreter) static uint8_t storage[sizeof(tflite::MicroInterpreter)];
+  for (const Run& run : runs) {
+    ModelLoader loader;
+    std::vector<uint32_t> load_cycles;
+    for (int i = 0; i < kLoadIterations; ++i) {
+      const uint32_t start = CycleCount();
+      if (loader.Load(run.source, *op_resolver) != ESP_OK) {
+        break;
+      }
+      load_cycles.push_back(CycleCount() - start);
+    }
+    if (load_cycles.size() < kLoadIterations) {
+      ESP_LOGW(TAG, "No model on the %s, skipping %s", ModelLoader::SourceName(run.source),
+               run.load_name);
+      continue;
+    }
+    ReportBenchmark(SummarizeBenchmark(run.load_name, load_cycles), results_file);
+
+    TensorArena arena;
+    const uint32_t build_start = CycleCount();
+    tflite::MicroInterpreter* interpreter = build_classifier_interpreter(
+        TensorArena::Placement::kPsram, &arena, storage, loader.model());
+    std::vector<uint32_t> build_cycles = {CycleCount() - build_start};
+    if (interpreter == nullptr) {
+      ESP_LOGE(TAG, "Can't build the classifier for %s", run.build_name);
+      continue;
+    }
+    ReportBenchmark(SummarizeBenchmark(run.build_name, build_cycles), results_file);
+    memcpy(tflite::GetTensorData<int8_t>(interpreter->input(0)), g_spectrogram,
+           kFeatureElementCount);
+    const uint32_t first_invoke_start = CycleCount();
+    interpreter->Invoke();
+    std::vector<uint32_t> first_invoke_cycles = {CycleCount() - first_invoke_start};
+    ReportBenchmark(SummarizeBenchmark(run.first_invoke_name, first_invoke_cycles),
+                    results_file);
+    ReportBenchmark(RunBenchmark(run.invoke_name, iterations, [interpreter] {
+      interpreter->Invoke();
+    }), results_file);
+    interpreter->~MicroInterpreter();
+  }
+}
+
+TfLiteStatus RunPipelineBenchmarks(int iterations, const char* results_path) {
+  uint32_t noise = 1;
+  for (int32_t& word : g_i2s_words) {
+    word = static_cast<int32_t>(NextNoise(&noise));
+  }
+  for (int16_t& sample : g_window) {
+    sample = static_cast<int16_t>(NextNoise(&noise) >> 20);
+  }
+  for (int8_t& feature : g_spectrogram) {
+    feature = static_cast<int8_t>(NextNoise(&noise));
+  }
+
+  g_failed_checks = 0;
+
+  // One-off cost of building the classifier, then the rest of the setup.
+  const uint32_t setup_start = CycleCount();
+  const bool setup_ok = setup_offline();
+  std::vector<uint32_t> setup_cycles = {CycleCount() - setup_start};
+  tflite::MicroInterpreter* interpreter = classifier_interpreter();
+  if (!setup_ok || interpreter == nullptr) {
+    ESP_LOGE(TAG, "Classifier setup failed");
+    return kTfLiteError;
+  }
+  TF_LITE_ENSURE_STATUS(InitializeMicroFeatures());
+
+  FILE* results_file = nullptr;
+  if (results_path != nullptr) {
+    results_file = fopen(results_path, "a");
+    if (results_file == nullptr) {
+      ESP_LOGE(TAG, "Failed to open %s: %s", results_path, strerror(errno));
+    }
+  }
+
+  ReportBenchmark(SummarizeBenchmark("classifier_setup", setup_cycles), results_file);
+
+  RunCaptureBenchmarks(iterations, results_file);
+  RunChannelBenchmarks(iterations, results_file);
+
+  ReportBenchmark(RunBenchmark("spectrogram_materialize", iterations, [] {
+    MaterializeFeatureSlices(g_spectrogram, kFeatureCount / 2, g_spectrogram_in_order);
+  }), results_file);
+
+  RunRingBenchmarks(iterations, results_file);
+
+  RunFrontendBenchmarks(iterations, results_file);
+
+  RunPredictionLogBenchmarks(iterations, results_file);
+  RunScoreSelectionBenchmarks(iterations, results_file);
+  RunPosteriorSmootherBenchmarks(iterations, results_file);
+  RunStreamWriterBenchmarks(iterations, results_file);
+
+  int8_t* model_input = tflite::GetTensorData<int8_t>(interpreter->input(0));
+  memcpy(model_input, g_spectrogram, kFeatureElementCount);
+  ReportBenchmark(RunBenchmark("classifier_invoke", iterations, [interpreter] {
+    interpreter->Invoke();
+  }), results_file);
+  RunArenaPlacementBenchmarks(iterations, results_file);
+  RunModelSourceBenchmarks(iterations, results_file);
+
+  if (results_file != nullptr) {
+    fclose(results_file);
+  }
+  if (g_failed_checks > 0) {
+    ESP_LOGE(TAG, "%d equivalence checks found mismatches", g_failed_checks);
+    return kTfLiteError;
+  }
+  return kTfLiteOk;
+}
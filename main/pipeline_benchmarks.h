@@ -0,0 +1,20 @@
+#pragma once
+#include "tensorflow/lite/c/common.h"
+
+// Per-window latency of the pipeline's hot paths: the I2S conversion done by
+// the capture task (every kernel this build has), de-interleaving and
+// combining four TDM microphones, the capture -> feature ring buffer
+// (AudioRing against the older ringbuf.c, uncontended and with a producer
+// task hammering it), the feature task's audio frontend (native and
+// interpreted), putting the spectrogram ring back in time order, logging a
+// row of predictions (synchronously and through the PredictionLogger's
+// queue, and the writer's rate as CSV and binary, dense and sparse),
+// picking the top scores out of a large label set, streaming audio to the
+// card (writeBytes() against StreamWriter, also as MB/s) and the
+// classifier's Invoke(). Builds the classifier like setup_offline() does.
+// The capture and channel kernels, the native frontend and the score
+// selection are also checked against their references, and delay-and-sum
+// against known microphone delays. Results are reported as JSON lines on
+// stdout, and appended to results_path too unless it is null. Returns
+// kTfLiteError if the setup failed or any check found a mismatch.
+TfLiteStatus RunPipelineBenchmarks(int iterations, const char* results_path);
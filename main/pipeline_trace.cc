@@ -0,0 +1,236 @@
+#include "pipeline_trace.h"
+
+#if CONFIG_PIPELINE_TRACE
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include "benchmark.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char* TAG = "trace";
+
+namespace {
+
+constexpr int kStageCount = static_cast<int>(TraceStage::kCount);
+constexpr int kRingCount = static_cast<int>(TraceRing::kCount);
+// Four per power of two of cycles
+constexpr int kLatencyBuckets = 32 * 4;
+// Tenths of the capacity
+constexpr int kFillBuckets = 10;
+
+constexpr const char* kStageNames[kStageCount] = {
+    "i2s_read", "convert", "ring_write", "audio_span", "features",
+    "slice_store", "input_copy", "invoke", "postprocess", "log_predictions"};
+constexpr const char* kRingNames[kRingCount] = {"capture_ring", "prediction_log_queue"};
+
+// Zero-initialized as globals
+struct StageCounters {
+  std::atomic<uint32_t> runs;
+  std::atomic<uint64_t> cycles;
+  std::atomic<uint32_t> max_cycles;
+  std::atomic<uint32_t> buckets[kLatencyBuckets];
+};
+
+struct RingCounters {
+  std::atomic<uint32_t> writes;
+  std::atomic<uint32_t> max_fill_percent;
+  std::atomic<uint32_t> overruns;
+  std::atomic<uint32_t> dropped;
+  std::atomic<uint32_t> buckets[kFillBuckets];
+};
+
+StageCounters g_stages[kStageCount];
+RingCounters g_rings[kRingCount];
+
+// What the previous report saw, to report the difference
+struct StageSnapshot {
+  uint32_t runs;
+  uint64_t cycles;
+  uint32_t buckets[kLatencyBuckets];
+};
+struct RingSnapshot {
+  uint32_t writes;
+  uint32_t overruns;
+  uint32_t dropped;
+  uint32_t buckets[kFillBuckets];
+};
+StageSnapshot g_reported_stages[kStageCount];
+RingSnapshot g_reported_rings[kRingCount];
+
+// Values below 4 have a bucket each; above, each power of two is split in
+// four by the two bits after the leading one.
+int LatencyBucket(uint32_t cycles) {
+  if (cycles < 4) {
+    return static_cast<int>(cycles);
+  }
+  const int octave = 31 - __builtin_clz(cycles);
+  return octave * 4 + static_cast<int>((cycles >> (octave - 2)) & 3);
+}
+
+// The smallest number of cycles past the bucket
+uint64_t LatencyBucketLimit(int bucket) {
+  if (bucket < 4) {
+    return static_cast<uint64_t>(bucket) + 1;
+  }
+  return static_cast<uint64_t>(5 + bucket % 4) << (bucket / 4 - 2);
+}
+
+// The first bucket by which fraction of the total count is reached
+int PercentileBucket(const uint32_t* buckets, int bucket_count, uint32_t total,
+                     float fraction) {
+  const uint32_t rank = std::max<uint32_t>(1, static_cast<uint32_t>(total * fraction + 0.5f));
+  uint32_t seen = 0;
+  for (int b = 0; b < bucket_count; ++b) {
+    seen += buckets[b];
+    if (seen >= rank) {
+      return b;
+    }
+  }
+  return bucket_count - 1;
+}
+
+void ReportStage(int stage, int64_t time_ms, FILE* file) {
+  StageCounters& counters = g_stages[stage];
+  StageSnapshot& reported = g_reported_stages[stage];
+  const uint32_t runs = counters.runs.load(std::memory_order_relaxed);
+  const uint64_t cycles = counters.cycles.load(std::memory_order_relaxed);
+  uint32_t buckets[kLatencyBuckets];
+  uint32_t bucket_total = 0;
+  for (int b = 0; b < kLatencyBuckets; ++b) {
+    const uint32_t count = counters.buckets[b].load(std::memory_order_relaxed);
+    buckets[b] = count - reported.buckets[b];
+    reported.buckets[b] = count;
+    bucket_total += buckets[b];
+  }
+  const uint32_t new_runs = runs - reported.runs;
+  const uint64_t new_cycles = cycles - reported.cycles;
+  reported.runs = runs;
+  reported.cycles = cycles;
+  if (new_runs == 0 || bucket_total == 0) {
+    return;
+  }
+
+  const double us_per_cycle = 1.0 / CycleCountsPerUs();
+  const double mean_us = static_cast<double>(new_cycles) / new_runs * us_per_cycle;
+  const double p50_us = LatencyBucketLimit(
+      PercentileBucket(buckets, kLatencyBuckets, bucket_total, 0.5f)) * us_per_cycle;
+  const double p99_us = LatencyBucketLimit(
+      PercentileBucket(buckets, kLatencyBuckets, bucket_total, 0.99f)) * us_per_cycle;
+  const double max_us = counters.max_cycles.load(std::memory_order_relaxed) * us_per_cycle;
+  ESP_LOGI(TAG, "%-15s %7lu runs, mean %9.1f us, p50 < %9.1f us, p99 < %9.1f us, "
+           "worst %9.1f us", kStageNames[stage], (unsigned long) new_runs, mean_us, p50_us,
+           p99_us, max_us);
+  if (file != nullptr) {
+    fprintf(file, "{\"trace\": \"%s\", \"platform\": \"%s\", \"time_ms\": %lld, "
+            "\"runs\": %lu, \"mean_us\": %.2f, \"p50_us\": %.2f, \"p99_us\": %.2f, "
+            "\"max_us\": %.2f}\n", kStageNames[stage], BenchmarkPlatform(),
+            (long long) time_ms, (unsigned long) new_runs, mean_us, p50_us, p99_us, max_us);
+  }
+}
+
+void ReportRing(int ring, int64_t time_ms, FILE* file) {
+  RingCounters& counters = g_rings[ring];
+  RingSnapshot& reported = g_reported_rings[ring];
+  uint32_t buckets[kFillBuckets];
+  uint32_t bucket_total = 0;
+  for (int b = 0; b < kFillBuckets; ++b) {
+    const uint32_t count = counters.buckets[b].load(std::memory_order_relaxed);
+    buckets[b] = count - reported.buckets[b];
+    reported.buckets[b] = count;
+    bucket_total += buckets[b];
+  }
+  const uint32_t writes = counters.writes.load(std::memory_order_relaxed);
+  const uint32_t overruns = counters.overruns.load(std::memory_order_relaxed);
+  const uint32_t dropped = counters.dropped.load(std::memory_order_relaxed);
+  const uint32_t new_writes = writes - reported.writes;
+  const uint32_t new_overruns = overruns - reported.overruns;
+  const uint32_t new_dropped = dropped - reported.dropped;
+  reported.writes = writes;
+  reported.overruns = overruns;
+  reported.dropped = dropped;
+  if (new_writes == 0 && new_overruns == 0) {
+    return;
+  }
+
+  // Upper bounds of the buckets, in percent
+  const int p50_percent = bucket_total > 0
+      ? (PercentileBucket(buckets, kFillBuckets, bucket_total, 0.5f) + 1) * 10 : 0;
+  const int p99_percent = bucket_total > 0
+      ? (PercentileBucket(buckets, kFillBuckets, bucket_total, 0.99f) + 1) * 10 : 0;
+  const unsigned long max_percent = counters.max_fill_percent.load(std::memory_order_relaxed);
+  ESP_LOGI(TAG, "%-20s %7lu writes, fill p50 <= %3d%%, p99 <= %3d%%, worst %3lu%%; "
+           "%lu overruns, %lu dropped", kRingNames[ring], (unsigned long) new_writes,
+           p50_percent, p99_percent, max_percent, (unsigned long) new_overruns,
+           (unsigned long) new_dropped);
+  if (file != nullptr) {
+    fprintf(file, "{\"trace\": \"%s\", \"platform\": \"%s\", \"time_ms\": %lld, "
+            "\"writes\": %lu, \"fill_p50_percent\": %d, \"fill_p99_percent\": %d, "
+            "\"fill_max_percent\": %lu, \"overruns\": %lu, \"dropped\": %lu}\n",
+            kRingNames[ring], BenchmarkPlatform(), (long long) time_ms,
+            (unsigned long) new_writes, p50_percent, p99_percent, max_percent,
+            (unsigned long) new_overruns, (unsigned long) new_dropped);
+  }
+}
+
+}  // namespace
+
+void TraceStageCycles(TraceStage stage, uint32_t cycles) {
+  StageCounters& counters = g_stages[static_cast<int>(stage)];
+  counters.runs.fetch_add(1, std::memory_order_relaxed);
+  counters.cycles.fetch_add(cycles, std::memory_order_relaxed);
+  counters.buckets[LatencyBucket(cycles)].fetch_add(1, std::memory_order_relaxed);
+  if (cycles > counters.max_cycles.load(std::memory_order_relaxed)) {
+    counters.max_cycles.store(cycles, std::memory_order_relaxed);
+  }
+}
+
+void TraceRingFill(TraceRing ring, uint32_t filled, uint32_t capacity) {
+  if (capacity == 0) {
+    return;
+  }
+  RingCounters& counters = g_rings[static_cast<int>(ring)];
+  const uint32_t percent = std::min<uint32_t>(
+      100, static_cast<uint32_t>(uint64_t{filled} * 100 / capacity));
+  counters.writes.fetch_add(1, std::memory_order_relaxed);
+  counters.buckets[std::min<int>(percent / 10, kFillBuckets - 1)].fetch_add(
+      1, std::memory_order_relaxed);
+  if (percent > counters.max_fill_percent.load(std::memory_order_relaxed)) {
+    counters.max_fill_percent.store(percent, std::memory_order_relaxed);
+  }
+}
+
+void TraceRingOverrun(TraceRing ring, uint32_t dropped) {
+  RingCounters& counters = g_rings[static_cast<int>(ring)];
+  counters.overruns.fetch_add(1, std::memory_order_relaxed);
+  counters.dropped.fetch_add(dropped, std::memory_order_relaxed);
+}
+
+void ReportPipelineTrace(const char* path) {
+  FILE* file = nullptr;
+  if (path != nullptr) {
+    file = fopen(path, "a");
+    if (file == nullptr) {
+      ESP_LOGE(TAG, "Failed to open %s: %s", path, strerror(errno));
+    }
+  }
+  const int64_t time_ms = esp_timer_get_time() / 1000;
+  for (int stage = 0; stage < kStageCount; ++stage) {
+    ReportStage(stage, time_ms, file);
+  }
+  for (int ring = 0; ring < kRingCount; ++ring) {
+    ReportRing(ring, time_ms, file);
+  }
+  if (file != nullptr) {
+    fclose(file);
+  }
+}
+
+#else
+
+void ReportPipelineTrace(const char* path) {}
+
+#endif  // CONFIG_PIPELINE_TRACE
@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include "cycle_counter.h"
+#include "sdkconfig.h"
+
+// Per-stage latency tracing of the running pipeline, for finding out where
+// the time goes on the board without a debugger attached. Each stage has a
+// call count, a cycle sum, a worst case and a fixed histogram of its
+// latencies: four buckets per power of two of cycles, so a percentile read
+// from it is within 25% of the real one. The buffers between the tasks have
+// a histogram of their fill level at each write, and count the writes that
+// didn't fit. ReportPipelineTrace() logs what happened since its previous
+// call.
+//
+// Everything is compiled out unless CONFIG_PIPELINE_TRACE is set: the hooks
+// are then empty inline functions and TRACE_STAGE() expands to nothing. With
+// it, a traced stage costs two cycle counter reads and a few relaxed atomic
+// increments. Any task can record any stage, although each is normally only
+// recorded by one. Stages can nest: kLogPredictions is part of kPostprocess.
+
+enum class TraceStage : uint8_t {
+  kI2sRead,         // waiting for and reading a DMA block from I2S
+  kConvert,         // rescaling or combining the block to 16-bit mono
+  kRingWrite,       // writing it to the capture ring
+  kAudioSpan,       // GetAudioSpan(), including the wait for the audio
+  kFeatures,        // GenerateFeatures() on the span
+  kSliceStore,      // storing the new slices in the spectrogram ring
+  kInputCopy,       // publishing the spectrogram to the input tensor
+  kInvoke,          // the classifier's Invoke()
+  kPostprocess,     // dequantization, argmax, smoothing and logging
+  kLogPredictions,  // queueing a prediction log record
+  kCount,
+};
+
+enum class TraceRing : uint8_t {
+  kCapture,        // capture ring, in samples
+  kPredictionLog,  // prediction log queue, in records
+  kCount,
+};
+
+#if CONFIG_PIPELINE_TRACE
+
+// Records one run of stage that took cycles CycleCount() counts.
+void TraceStageCycles(TraceStage stage, uint32_t cycles);
+// Records the fill level of ring right after a write.
+void TraceRingFill(TraceRing ring, uint32_t filled, uint32_t capacity);
+// Records a write to ring that didn't fit, dropping dropped items.
+void TraceRingOverrun(TraceRing ring, uint32_t dropped);
+
+// Records the time from its construction to the end of the scope.
+class TraceScope {
+ public:
+  explicit TraceScope(TraceStage stage) : stage_(stage), start_(CycleCount()) {}
+  ~TraceScope() { TraceStageCycles(stage_, CycleCount() - start_); }
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+ private:
+  TraceStage stage_;
+  uint32_t start_;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+// Traces the rest of the enclosing scope as TraceStage::stage.
+#define TRACE_STAGE(stage) \
+  TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(TraceStage::stage)
+
+#else
+
+inline void TraceStageCycles(TraceStage, uint32_t) {}
+inline void TraceRingFill(TraceRing, uint32_t, uint32_t) {}
+inline void TraceRingOverrun(TraceRing, uint32_t) {}
+#define TRACE_STAGE(stage) do {} while (0)
+
+#endif  // CONFIG_PIPELINE_TRACE
+
+// Logs one line per stage that ran since the previous call, with its count,
+// mean, p50 and p99 latency over that interval and its worst latency so far,
+// then one line per ring. When path isn't null, also appends the same as
+// JSON lines to that file. Does nothing when tracing is compiled out.
+void ReportPipelineTrace(const char* path);
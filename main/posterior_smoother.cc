@@ -0,0 +1,148 @@
+#include "posterior_smoother.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "micro_model_settings.h"
+
+static const char* TAG = "smoother";
+
+PosteriorSmoother::~PosteriorSmoother() {
+  Free();
+}
+
+void PosteriorSmoother::Free() {
+  heap_caps_free(scores_);
+  heap_caps_free(times_);
+  heap_caps_free(sums_);
+  heap_caps_free(hits_);
+  heap_caps_free(last_detection_ms_);
+  scores_ = nullptr;
+  times_ = nullptr;
+  sums_ = nullptr;
+  hits_ = nullptr;
+  last_detection_ms_ = nullptr;
+}
+
+esp_err_t PosteriorSmoother::Init(const Config& config, float scale, int zero_point) {
+  if (scores_ != nullptr) {
+    return ESP_OK;
+  }
+  config_ = config;
+  config_.max_results = std::max(config.max_results, 1);
+  config_.minimum_count = std::min(config.minimum_count, config_.max_results);
+  // The lowest score q with (q - zero_point) * scale >= the threshold
+  const float q = std::ceil(config.detection_threshold / scale) + zero_point;
+  threshold_ = static_cast<uint32_t>(std::min(std::max(q, -128.0f), 127.0f) - INT8_MIN);
+
+  // The window is the big one, with many categories
+  const size_t window_size = static_cast<size_t>(config_.max_results) * kCategoryCount;
+  scores_ = static_cast<uint8_t*>(heap_caps_malloc(window_size, MALLOC_CAP_SPIRAM));
+  if (scores_ == nullptr) {
+    scores_ = static_cast<uint8_t*>(heap_caps_malloc(window_size, MALLOC_CAP_DEFAULT));
+  }
+  times_ = static_cast<int64_t*>(
+      heap_caps_malloc(config_.max_results * sizeof(int64_t), MALLOC_CAP_DEFAULT));
+  sums_ = static_cast<uint32_t*>(
+      heap_caps_malloc(kCategoryCount * sizeof(uint32_t), MALLOC_CAP_DEFAULT));
+  hits_ = static_cast<uint16_t*>(
+      heap_caps_malloc(kCategoryCount * sizeof(uint16_t), MALLOC_CAP_DEFAULT));
+  last_detection_ms_ = static_cast<int64_t*>(
+      heap_caps_malloc(kCategoryCount * sizeof(int64_t), MALLOC_CAP_DEFAULT));
+  if (scores_ == nullptr || times_ == nullptr || sums_ == nullptr || hits_ == nullptr ||
+      last_detection_ms_ == nullptr) {
+    ESP_LOGE(TAG, "Can't allocate the smoothing window of %d results", config_.max_results);
+    Free();
+    return ESP_ERR_NO_MEM;
+  }
+  Reset();
+  ESP_LOGI(TAG, "Averaging over %d ms (%d results), threshold %d, suppression %d ms, "
+           "minimum count %d", config_.average_window_ms, config_.max_results,
+           static_cast<int>(threshold_) + INT8_MIN, config_.suppression_ms,
+           config_.minimum_count);
+  return ESP_OK;
+}
+
+void PosteriorSmoother::Reset() {
+  if (scores_ == nullptr) {
+    return;
+  }
+  head_ = 0;
+  count_ = 0;
+  memset(sums_, 0, kCategoryCount * sizeof(uint32_t));
+  memset(hits_, 0, kCategoryCount * sizeof(uint16_t));
+  std::fill(last_detection_ms_, last_detection_ms_ + kCategoryCount, INT64_MIN);
+  last_time_ms_ = INT64_MIN;
+}
+
+void PosteriorSmoother::Evict() {
+  const uint8_t* oldest = scores_ + static_cast<size_t>(head_) * kCategoryCount;
+  for (int i = 0; i < kCategoryCount; ++i) {
+    sums_[i] -= oldest[i];
+    hits_[i] -= oldest[i] >= threshold_;
+  }
+  head_ = head_ + 1 == config_.max_results ? 0 : head_ + 1;
+  count_--;
+}
+
+bool PosteriorSmoother::Update(const int8_t* scores, int64_t time_ms, Result* result) {
+  result->category = -1;
+  result->average = INT8_MIN;
+  result->is_new_detection = false;
+  if (scores_ == nullptr || time_ms < last_time_ms_) {
+    return false;
+  }
+  last_time_ms_ = time_ms;
+
+  // Results older than the window leave it, and the oldest one makes room
+  // if it's full.
+  while (count_ > 0 && (count_ == config_.max_results ||
+                        times_[head_] < time_ms - config_.average_window_ms)) {
+    Evict();
+  }
+  int tail = head_ + count_;
+  if (tail >= config_.max_results) {
+    tail -= config_.max_results;
+  }
+  uint8_t* row = scores_ + static_cast<size_t>(tail) * kCategoryCount;
+  times_[tail] = time_ms;
+  count_++;
+
+  int top = 0;
+  for (int i = 0; i < kCategoryCount; ++i) {
+    const uint8_t score = static_cast<uint8_t>(scores[i] - INT8_MIN);
+    row[i] = score;
+    sums_[i] += score;
+    hits_[i] += score >= threshold_;
+    if (sums_[i] > sums_[top]) {
+      top = i;
+    }
+  }
+
+  // average >= threshold, without the division
+  const uint32_t count = static_cast<uint32_t>(count_);
+  if (sums_[top] < threshold_ * count || hits_[top] < config_.minimum_count) {
+    return true;
+  }
+  result->category = top;
+  result->average = static_cast<int8_t>((sums_[top] + count / 2) / count + INT8_MIN);
+  if (last_detection_ms_[top] == INT64_MIN ||
+      time_ms - last_detection_ms_[top] >= config_.suppression_ms) {
+    last_detection_ms_[top] = time_ms;
+    result->is_new_detection = true;
+  }
+  return true;
+}
+
+void PosteriorSmoother::GetAverages(int8_t* averages) const {
+  if (count_ == 0) {
+    std::fill(averages, averages + kCategoryCount, INT8_MIN);
+    return;
+  }
+  const uint32_t count = static_cast<uint32_t>(count_);
+  for (int i = 0; i < kCategoryCount; ++i) {
+    averages[i] = static_cast<int8_t>((sums_[i] + count / 2) / count + INT8_MIN);
+  }
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include "esp_err.h"
+
+// Turns the classifier's independent per-window results into detections, in
+// the spirit of the micro_speech example's RecognizeCommands: scores are
+// averaged over the last average_window_ms of results, and a category is
+// detected when it has the highest average, that average reaches
+// detection_threshold, at least minimum_count of the results in the window
+// reached it on their own, and the category wasn't detected in the last
+// suppression_ms. Suppression is per category: another category can still be
+// detected in the meantime, and the same one twice in a row once the interval
+// has passed, so overlapping windows of one call make one detection instead
+// of a row each.
+//
+// Works on the int8 scores as they come out of the model: the window is a
+// ring of the last max_results results, and each category has a running sum
+// and a running count of results at the threshold, updated as results come
+// in and leave the window, so an update costs a few integer operations per
+// category whatever the window length. The threshold is quantized once, and
+// compared against the sums without dividing them. Integer arithmetic
+// throughout, so the same results give the same detections on every
+// platform.
+//
+// Not thread-safe: meant to be used by the inference task alone.
+class PosteriorSmoother {
+ public:
+  struct Config {
+    int average_window_ms;
+    // In the dequantized scores' units
+    float detection_threshold;
+    int suppression_ms;
+    int minimum_count;
+    // Results the window can hold. Once full, the oldest result leaves it
+    // even if it's less than average_window_ms old.
+    int max_results;
+  };
+
+  struct Result {
+    // Category with the highest average if it passes the threshold and the
+    // minimum count, -1 otherwise
+    int category;
+    // Its average, quantized like the scores
+    int8_t average;
+    // Whether that's a new detection, rather than one still suppressed
+    bool is_new_detection;
+  };
+
+  PosteriorSmoother() = default;
+  ~PosteriorSmoother();
+  PosteriorSmoother(const PosteriorSmoother&) = delete;
+  PosteriorSmoother& operator=(const PosteriorSmoother&) = delete;
+
+  // Allocates the window for kCategoryCount categories; scale and zero_point
+  // are the scores' quantization. Calling it again does nothing.
+  esp_err_t Init(const Config& config, float scale, int zero_point);
+
+  // Empties the window and forgets past detections, e.g. for a new
+  // recording.
+  void Reset();
+
+  // Adds the kCategoryCount scores of the result at time_ms. Returns false,
+  // leaving the window alone, if time_ms is before the previous result's.
+  bool Update(const int8_t* scores, int64_t time_ms, Result* result);
+
+  // Averages of every category over the window, quantized like the scores.
+  void GetAverages(int8_t* averages) const;
+
+  // Results in the window
+  int count() const { return count_; }
+
+ private:
+  // Takes the oldest result out of the sums.
+  void Evict();
+  void Free();
+
+  Config config_ = {};
+  // Scores are kept offset by -INT8_MIN, so that the sums are unsigned
+  uint32_t threshold_ = 0;
+  // The window: max_results rows of kCategoryCount offset scores, oldest at
+  // head_
+  uint8_t* scores_ = nullptr;
+  int64_t* times_ = nullptr;
+  int head_ = 0;
+  int count_ = 0;
+  // Per category: sum of the scores in the window, results at the threshold,
+  // and when it was last detected
+  uint32_t* sums_ = nullptr;
+  uint16_t* hits_ = nullptr;
+  int64_t* last_detection_ms_ = nullptr;
+  int64_t last_time_ms_ = INT64_MIN;
+};
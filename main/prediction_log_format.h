@@ -0,0 +1,82 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace sdcard {
+
+// Layout of the binary prediction log, N.bin, shared by the PredictionLogger
+// and the host tool that turns it back into CSV. All little-endian.
+//
+// Header:
+//   "BNPL"                magic
+//   u16 version           kBinaryLogVersion
+//   u16 flags             kBinaryLogSparse, or 0
+//   u32 category_count
+//   f32 scale             the classifier output's quantization: a score q
+//   i32 zero_point        stands for (q - zero_point) * scale
+//   u32 labels_size
+//   labels                category_count NUL-terminated labels, labels_size
+//                         bytes in all
+//
+// Then one record per logged result:
+//   varint delta_ms       zigzag-encoded LEB128 varint: the timestamp minus
+//                         that of the previous record in the file (of 0 for
+//                         the first one)
+//   i8 scores[category_count]
+//
+// or with kBinaryLogSparse, only the categories selected for the record, by
+// decreasing score:
+//   varint delta_ms
+//   varint count
+//   count times:
+//     varint category     index into the labels
+//     i8 score
+// Sparse records with nothing selected are left out.
+constexpr char kBinaryLogMagic[4] = {'B', 'N', 'P', 'L'};
+constexpr uint16_t kBinaryLogVersion = 1;
+constexpr uint16_t kBinaryLogSparse = 1 << 0;
+constexpr size_t kBinaryLogFixedHeaderSize = 24;
+constexpr size_t kMaxVarintSize = 10;
+
+inline size_t PutVarint(uint64_t value, uint8_t* out) {
+  size_t size = 0;
+  while (value >= 0x80) {
+    out[size++] = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  out[size++] = static_cast<uint8_t>(value);
+  return size;
+}
+
+// Returns the bytes read, or 0 if the varint doesn't end before end.
+inline size_t GetVarint(const uint8_t* in, const uint8_t* end, uint64_t* value) {
+  *value = 0;
+  for (size_t i = 0; i < kMaxVarintSize && in + i < end; ++i) {
+    *value |= uint64_t{in[i] & 0x7fu} << (7 * i);
+    if (!(in[i] & 0x80)) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+inline uint64_t ZigZag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t UnZigZag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+inline void PutLe32(uint32_t value, uint8_t* out) {
+  for (int i = 0; i < 4; ++i) {
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+inline uint32_t GetLe32(const uint8_t* in) {
+  return in[0] | (in[1] << 8) | (in[2] << 16) | (uint32_t{in[3]} << 24);
+}
+
+}  // namespace sdcard
@@ -0,0 +1,502 @@
+#include "prediction_logger.h"
+#include "pipeline_trace.h"
+#include "prediction_log_format.h"
+#include "score_selection.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char* TAG = "prediction_log";
+
+namespace {
+constexpr const char* kSparseCsvHeader = "timestamp,label,score\n";
+
+// Whether the CSV file at path starts with the header a dense or sparse log
+// writes: lines of the other layout, or of other labels, can't go after it.
+bool CsvHeaderMatches(const char* path, bool sparse) {
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) {
+    return false;
+  }
+  auto next = [file](const char* expected) {
+    for (; *expected != '\0'; ++expected) {
+      if (fgetc(file) != static_cast<unsigned char>(*expected)) {
+        return false;
+      }
+    }
+    return true;
+  };
+  bool match;
+  if (sparse) {
+    match = next(kSparseCsvHeader);
+  } else {
+    match = next("timestamp");
+    for (auto kCategoryLabel : kCategoryLabels) {
+      match = match && next(",") && next(kCategoryLabel);
+    }
+    match = match && next("\n");
+  }
+  fclose(file);
+  return match;
+}
+}  // namespace
+
+namespace sdcard {
+
+esp_err_t PredictionLogger::Start(const char* directory, const Config& config) {
+  if (task_started_) {
+    return ESP_OK;
+  }
+  directory_ = directory;
+  config_ = config;
+  commit_interval_us_ = int64_t{std::max(config.commit_interval_ms, 1)} * 1000;
+  commit_records_ = std::max(config.commit_records, 1);
+  sparse_ = config.top_k > 0 || config.min_scores != nullptr;
+
+  if (records_ == nullptr) {
+    records_ = static_cast<Record*>(
+        heap_caps_malloc(kQueueCapacity * sizeof(Record), MALLOC_CAP_SPIRAM));
+  }
+  if (records_ == nullptr) {
+    records_ = static_cast<Record*>(
+        heap_caps_malloc(kQueueCapacity * sizeof(Record), MALLOC_CAP_DEFAULT));
+  }
+  // The SD driver can DMA straight from internal, word-aligned memory;
+  // anything else goes through its bounce buffer. The binary log has its
+  // StreamWriter's.
+  const bool csv = config.format == Format::kCsv;
+  if (sparse_) {
+    // A sparse line has one label in it, of any length
+    size_t longest_label = 0;
+    for (auto kCategoryLabel : kCategoryLabels) {
+      longest_label = std::max(longest_label, strlen(kCategoryLabel));
+    }
+    line_capacity_ = std::max(kMaxLineSize, 48 + longest_label);
+  }
+  if (buffer_ == nullptr && csv) {
+    buffer_ = static_cast<char*>(
+        heap_caps_malloc(kWriteUnitSize + line_capacity_, MALLOC_CAP_DMA));
+  }
+  if (buffer_ == nullptr && csv) {
+    buffer_ = static_cast<char*>(
+        heap_caps_malloc(kWriteUnitSize + line_capacity_, MALLOC_CAP_DEFAULT));
+  }
+  if (selected_ == nullptr && sparse_) {
+    selected_ = static_cast<uint16_t*>(
+        heap_caps_malloc(kCategoryCount * sizeof(uint16_t), MALLOC_CAP_DEFAULT));
+  }
+  // Delta and count, then at most a 3-byte index and a score per category
+  const size_t encoded_size =
+      sparse_ ? 2 * kMaxVarintSize + kCategoryCount * 4 : kMaxVarintSize + kCategoryCount;
+  if (encoded_ == nullptr && !csv) {
+    encoded_ = static_cast<uint8_t*>(heap_caps_malloc(encoded_size, MALLOC_CAP_DEFAULT));
+  }
+  if (records_ == nullptr || (buffer_ == nullptr && csv) ||
+      (selected_ == nullptr && sparse_) || (encoded_ == nullptr && !csv)) {
+    ESP_LOGE(TAG, "Can't allocate the prediction log queue and buffers");
+    return ESP_ERR_NO_MEM;
+  }
+
+  if (xTaskCreatePinnedToCore(TaskEntry, "PredictionLog", 6144, this, 5, nullptr, 0)
+      != pdPASS) {
+    ESP_LOGE(TAG, "Can't start the prediction log writer");
+    return ESP_FAIL;
+  }
+  task_started_ = true;
+  ESP_LOGI(TAG, "Committing predictions (%s%s) every %d ms or %lu records",
+           csv ? "CSV" : "binary", sparse_ ? ", sparse" : "", config.commit_interval_ms,
+           (unsigned long) commit_records_);
+  return ESP_OK;
+}
+
+bool PredictionLogger::Log(const int8_t* scores, int64_t timestamp_ms,
+                           bool count_drop) {
+  const uint32_t tail = tail_.load(std::memory_order_relaxed);
+  const uint32_t depth = tail - head_.load(std::memory_order_acquire);
+  if (depth >= kQueueCapacity) {
+    // Without count_drop the caller retries: nothing is lost yet.
+    if (count_drop) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      TraceRingOverrun(TraceRing::kPredictionLog, 1);
+    }
+    return false;
+  }
+  Record& record = records_[tail % kQueueCapacity];
+  record.timestamp_ms = timestamp_ms;
+  memcpy(record.scores, scores, sizeof(record.scores));
+  tail_.store(tail + 1, std::memory_order_release);
+  TraceRingFill(TraceRing::kPredictionLog, depth + 1, kQueueCapacity);
+
+  queued_.fetch_add(1, std::memory_order_relaxed);
+  if (depth + 1 > queue_high_water_.load(std::memory_order_relaxed)) {
+    queue_high_water_.store(depth + 1, std::memory_order_relaxed);
+  }
+  writer_waiter_.Wake();
+  return true;
+}
+
+void PredictionLogger::Flush() {
+  if (!task_started_) {
+    return;
+  }
+  flush_requested_.store(true, std::memory_order_release);
+  writer_waiter_.Wake();
+  while (flush_requested_.load(std::memory_order_acquire)) {
+    vTaskDelay(1);
+  }
+}
+
+PredictionLogger::Stats PredictionLogger::GetStats() const {
+  Stats stats;
+  stats.queued = queued_.load(std::memory_order_relaxed);
+  stats.dropped = dropped_.load(std::memory_order_relaxed);
+  stats.queue_depth = tail_.load(std::memory_order_relaxed) -
+                      head_.load(std::memory_order_relaxed);
+  stats.queue_high_water = queue_high_water_.load(std::memory_order_relaxed);
+  stats.committed = committed_.load(std::memory_order_relaxed);
+  stats.commits = commits_.load(std::memory_order_relaxed);
+  stats.write_errors = write_errors_.load(std::memory_order_relaxed);
+  stats.bytes_written = bytes_written_.load(std::memory_order_relaxed);
+  stats.commit_sum_us = commit_sum_us_.load(std::memory_order_relaxed);
+  stats.commit_max_us = commit_max_us_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void PredictionLogger::TaskEntry(void* logger) {
+  static_cast<PredictionLogger*>(logger)->Run();
+}
+
+void PredictionLogger::Run() {
+  if (config_.format == Format::kCsv) {
+    FindFileIndex();
+  }
+  while (true) {
+    // Sleep until a record comes in, or until the group waiting in the
+    // buffer is due.
+    TickType_t ticks_to_wait = portMAX_DELAY;
+    if (pending_records_ > 0) {
+      const int64_t left_us = group_start_us_ + commit_interval_us_ - esp_timer_get_time();
+      ticks_to_wait = left_us > 0 ? pdMS_TO_TICKS(left_us / 1000) + 1 : 0;
+    }
+    if (ticks_to_wait > 0) {
+      writer_waiter_.Wait([this] {
+        return tail_.load(std::memory_order_acquire) !=
+                   head_.load(std::memory_order_relaxed) ||
+               flush_requested_.load(std::memory_order_acquire);
+      }, ticks_to_wait);
+    }
+    // Whatever was queued before a flush request is in the queue by now.
+    const bool flush = flush_requested_.load(std::memory_order_acquire);
+    Drain();
+    if (pending_records_ > 0 &&
+        (flush || pending_records_ >= commit_records_ ||
+         esp_timer_get_time() - group_start_us_ >= commit_interval_us_)) {
+      Commit();
+    }
+    if (flush) {
+      flush_requested_.store(false, std::memory_order_release);
+    }
+  }
+}
+
+void PredictionLogger::Drain() {
+  uint32_t head = head_.load(std::memory_order_relaxed);
+  const uint32_t tail = tail_.load(std::memory_order_acquire);
+  for (; head != tail; ++head) {
+    if (pending_records_ == 0) {
+      group_start_us_ = esp_timer_get_time();
+    }
+    if (config_.format == Format::kBinary) {
+      AppendBinary(records_[head % kQueueCapacity]);
+    } else {
+      Append(records_[head % kQueueCapacity]);
+    }
+    head_.store(head + 1, std::memory_order_release);
+  }
+}
+
+void PredictionLogger::Append(const Record& record) {
+  if (fd_ < 0 && !OpenFile()) {
+    write_errors_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  // Leave room for the newline
+  const size_t capacity = line_capacity_ - 1;
+  if (sparse_) {
+    const int selected = SelectTopScores(record.scores, kCategoryCount, config_.top_k,
+                                         config_.min_scores, selected_);
+    for (int i = 0; i < selected; i++) {
+      const int category = selected_[i];
+      const float prediction =
+          (record.scores[category] - config_.zero_point) * config_.scale;
+      char* line = buffer_ + buffer_fill_;
+      size_t length = std::min<size_t>(
+          snprintf(line, capacity, "%lld,%s,%.4f", (long long) record.timestamp_ms,
+                   kCategoryLabels[category], prediction),
+          capacity - 1);
+      line[length++] = '\n';
+      EndLine(length);
+    }
+  } else {
+    char* line = buffer_ + buffer_fill_;
+    size_t length = std::min<size_t>(
+        snprintf(line, capacity, "%lld", (long long) record.timestamp_ms), capacity - 1);
+    for (int i = 0; i < kCategoryCount; i++) {
+      const float prediction = (record.scores[i] - config_.zero_point) * config_.scale;
+      length += std::min<size_t>(
+          snprintf(line + length, capacity - length, ",%.4f", prediction),
+          capacity - length - 1);
+    }
+    line[length++] = '\n';
+    EndLine(length);
+  }
+  pending_records_++;
+
+  if (file_size_ + buffer_fill_ >= kMaxFileSize) {
+    Commit();
+    ESP_LOGI(TAG, "File %u.csv reached size limit (%zu bytes), rotating",
+             file_index_, file_size_);
+    CloseFile();
+    file_index_++;
+  }
+}
+
+void PredictionLogger::EndLine(size_t length) {
+  buffer_fill_ += length;
+  // A complete allocation unit goes out right away, without waiting for the
+  // commit.
+  const size_t unit_left = kWriteUnitSize - file_size_ % kWriteUnitSize;
+  if (buffer_fill_ >= unit_left) {
+    WriteOut(unit_left);
+    memmove(buffer_, buffer_ + unit_left, buffer_fill_ - unit_left);
+    buffer_fill_ -= unit_left;
+  }
+}
+
+void PredictionLogger::AppendBinary(const Record& record) {
+  if (!stream_.is_open() && !OpenStream()) {
+    write_errors_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  size_t size = 0;
+  if (sparse_) {
+    const int selected = SelectTopScores(record.scores, kCategoryCount, config_.top_k,
+                                         config_.min_scores, selected_);
+    if (selected == 0) {
+      pending_records_++;
+      return;
+    }
+    // Encoded after the delta, which depends on the file the record goes to
+    size = kMaxVarintSize + PutVarint(selected, encoded_ + kMaxVarintSize);
+    for (int i = 0; i < selected; i++) {
+      size += PutVarint(selected_[i], encoded_ + size);
+      encoded_[size++] = static_cast<uint8_t>(record.scores[selected_[i]]);
+    }
+  } else {
+    memcpy(encoded_ + kMaxVarintSize, record.scores, kCategoryCount);
+    size = kMaxVarintSize + kCategoryCount;
+  }
+  if (stream_.file_size() + size > kMaxFileSize) {
+    Commit();
+    ESP_LOGI(TAG, "File %u.bin reached size limit (%zu bytes), rotating",
+             stream_.file_index(), stream_.file_size());
+    stream_.Rotate();
+    // Each file stands on its own: deltas start over from 0.
+    last_timestamp_ms_ = 0;
+  }
+  // The delta goes right in front of the rest of the record.
+  uint8_t delta[kMaxVarintSize];
+  const size_t delta_size =
+      PutVarint(ZigZag(record.timestamp_ms - last_timestamp_ms_), delta);
+  uint8_t* start = encoded_ + kMaxVarintSize - delta_size;
+  memcpy(start, delta, delta_size);
+  size -= kMaxVarintSize - delta_size;
+  if (!stream_.Write(start, size)) {
+    write_errors_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  last_timestamp_ms_ = record.timestamp_ms;
+  pending_records_++;
+}
+
+bool PredictionLogger::OpenStream() {
+  if (header_ == nullptr) {
+    size_t labels_size = 0;
+    for (auto kCategoryLabel : kCategoryLabels) {
+      labels_size += strlen(kCategoryLabel) + 1;
+    }
+    header_ = static_cast<uint8_t*>(
+        heap_caps_malloc(kBinaryLogFixedHeaderSize + labels_size, MALLOC_CAP_DEFAULT));
+    if (header_ == nullptr) {
+      return false;
+    }
+    memcpy(header_, kBinaryLogMagic, sizeof(kBinaryLogMagic));
+    header_[4] = kBinaryLogVersion & 0xff;
+    header_[5] = kBinaryLogVersion >> 8;
+    const uint16_t flags = sparse_ ? kBinaryLogSparse : 0;
+    header_[6] = flags & 0xff;
+    header_[7] = flags >> 8;
+    PutLe32(kCategoryCount, header_ + 8);
+    uint32_t scale_bits;
+    memcpy(&scale_bits, &config_.scale, sizeof(scale_bits));
+    PutLe32(scale_bits, header_ + 12);
+    PutLe32(static_cast<uint32_t>(config_.zero_point), header_ + 16);
+    PutLe32(labels_size, header_ + 20);
+    uint8_t* label = header_ + kBinaryLogFixedHeaderSize;
+    for (auto kCategoryLabel : kCategoryLabels) {
+      const size_t size = strlen(kCategoryLabel) + 1;
+      memcpy(label, kCategoryLabel, size);
+      label += size;
+    }
+    header_size_ = label - header_;
+  }
+  // Records are committed and files rotated by the logger itself.
+  const StreamWriter::Config config = {directory_, "bin", 0, 0, 0, 0, header_, header_size_};
+  last_timestamp_ms_ = 0;
+  return stream_.Open(config) == ESP_OK;
+}
+
+bool PredictionLogger::WriteOut(size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    const ssize_t written = write(fd_, buffer_ + done, size - done);
+    if (written <= 0) {
+      ESP_LOGE(TAG, "Failed to write to %u.csv: %s", file_index_, strerror(errno));
+      write_errors_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    done += written;
+  }
+  file_size_ += size;
+  bytes_written_.fetch_add(size, std::memory_order_relaxed);
+  return true;
+}
+
+bool PredictionLogger::WriteString(const char* text) {
+  const size_t size = strlen(text);
+  if (write(fd_, text, size) != static_cast<ssize_t>(size)) {
+    ESP_LOGE(TAG, "Failed to write to %u.csv: %s", file_index_, strerror(errno));
+    return false;
+  }
+  file_size_ += size;
+  bytes_written_.fetch_add(size, std::memory_order_relaxed);
+  return true;
+}
+
+void PredictionLogger::Commit() {
+  const int64_t start_us = esp_timer_get_time();
+  bool ok;
+  if (config_.format == Format::kBinary) {
+    ok = stream_.Sync();
+    if (!ok) {
+      write_errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+    bytes_written_.store(stream_.stats().bytes, std::memory_order_relaxed);
+  } else {
+    ok = fd_ >= 0 && (buffer_fill_ == 0 || WriteOut(buffer_fill_));
+    buffer_fill_ = 0;
+    if (ok && fsync(fd_) != 0) {
+      ESP_LOGE(TAG, "Failed to sync %u.csv: %s", file_index_, strerror(errno));
+      write_errors_.fetch_add(1, std::memory_order_relaxed);
+      ok = false;
+    }
+  }
+  const int64_t commit_us = esp_timer_get_time() - start_us;
+
+  commits_.fetch_add(1, std::memory_order_relaxed);
+  commit_sum_us_.fetch_add(commit_us, std::memory_order_relaxed);
+  if (commit_us > commit_max_us_.load(std::memory_order_relaxed)) {
+    commit_max_us_.store(commit_us, std::memory_order_relaxed);
+  }
+  if (ok) {
+    committed_.fetch_add(pending_records_, std::memory_order_relaxed);
+  }
+  ESP_LOGD(TAG, "Committed %lu records in %lld us, file size %zu/%zu",
+           (unsigned long) pending_records_, (long long) commit_us,
+           config_.format == Format::kBinary ? stream_.file_size() : file_size_,
+           kMaxFileSize);
+  pending_records_ = 0;
+}
+
+void PredictionLogger::FindFileIndex() {
+  // Continue after the highest numbered file on the card
+  DIR* dir = opendir(directory_);
+  if (dir == nullptr) {
+    ESP_LOGE(TAG, "Failed to open %s directory: %s", directory_, strerror(errno));
+  } else {
+    struct dirent* entry;
+    unsigned int max_index = 0;
+    while ((entry = readdir(dir)) != nullptr) {
+      unsigned int index;
+      if (sscanf(entry->d_name, "%u.csv", &index) == 1) {
+        max_index = std::max(max_index, index);
+      }
+    }
+    closedir(dir);
+    file_index_ = max_index;
+  }
+  ESP_LOGI(TAG, "Curr file index: %u", file_index_);
+
+  // Keep using it if it has space and the same header
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%u.csv", directory_, file_index_);
+  struct stat file_stat = {};
+  if (stat(path, &file_stat) != 0 || file_stat.st_size >= kMaxFileSize) {
+    file_index_++;
+  } else if (file_stat.st_size > 0 && !CsvHeaderMatches(path, sparse_)) {
+    ESP_LOGI(TAG, "%s has another layout, starting a new file", path);
+    file_index_++;
+  }
+}
+
+bool PredictionLogger::OpenFile() {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%u.csv", directory_, file_index_);
+  fd_ = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (fd_ < 0) {
+    ESP_LOGE(TAG, "Failed to open predictions file %s: %s", path, strerror(errno));
+    return false;
+  }
+  // The one size query: from here on it's counted as it's written.
+  struct stat file_stat = {};
+  file_size_ = fstat(fd_, &file_stat) == 0 ? file_stat.st_size : 0;
+  ESP_LOGI(TAG, "Opened prediction file: %s (size: %zu bytes)", path, file_size_);
+
+  // The labels can be of any length: the header goes straight to the file.
+  if (file_size_ == 0 && sparse_) {
+    if (!WriteString(kSparseCsvHeader)) {
+      CloseFile();
+      return false;
+    }
+  } else if (file_size_ == 0) {
+    bool ok = WriteString("timestamp");
+    for (auto kCategoryLabel : kCategoryLabels) {
+      ok = ok && WriteString(",") && WriteString(kCategoryLabel);
+    }
+    if (!ok || !WriteString("\n")) {
+      CloseFile();
+      return false;
+    }
+  }
+  return true;
+}
+
+void PredictionLogger::CloseFile() {
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+}  // namespace sdcard
@@ -0,0 +1,175 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "esp_err.h"
+#include "micro_model_settings.h"
+#include "stream_writer.h"
+#include "task_waiter.h"
+
+namespace sdcard {
+
+// Writes the prediction log from a background task, so that the inference
+// task never waits on the card: Log() copies the classifier's raw int8
+// scores into a lock-free single-producer queue and returns, or drops the
+// record if the queue is full.
+//
+// The log is CSV, or with Format::kBinary, N.bin files written through a
+// StreamWriter (see prediction_log_format.h): the labels and quantization
+// once per file, then per record a delta-encoded timestamp and the raw
+// scores, about a seventh of the CSV's size. Both rotate at kMaxFileSize.
+//
+// With top_k or min_scores set, the log is sparse: the writer task picks
+// each record's top_k scores that reach their category's minimum (see
+// SelectTopScores()) and logs only those, as timestamp,label,score lines of
+// CSV or as (category, score) pairs. For large label sets, where a detection
+// has a handful of relevant categories out of thousands, that is most of the
+// formatting time and card space saved.
+//
+// For the CSVs:
+// The writer task formats the records into a buffer of kWriteUnitSize bytes,
+// the card's allocation unit, and writes it out whenever it fills up to the
+// next allocation unit boundary of the file, so that FATFS gets whole,
+// aligned clusters. The file size is tracked in memory. Records are committed
+// (written out and fsync'ed) in groups: once commit_records of them are
+// waiting, or commit_interval_ms after the first one of the group came in,
+// whichever comes first. Files are rotated at kMaxFileSize, as N.csv with N
+// counting up from the highest number already on the card.
+class PredictionLogger {
+ public:
+  enum class Format { kCsv, kBinary };
+
+  struct Config {
+    int commit_interval_ms;
+    int commit_records;
+    Format format;
+    // Quantization of the scores: q stands for (q - zero_point) * scale
+    float scale;
+    int zero_point;
+    // Sparse logging: the top_k scores of each record (0 for all) of those
+    // that reach min_scores[category] (null for no minimum). Both unset for
+    // every score of every record.
+    int top_k;
+    const int8_t* min_scores;
+  };
+
+  // Counters since Start(). The writer's side is only updated once per
+  // commit.
+  struct Stats {
+    uint32_t queued;
+    // Records Log() couldn't queue because the writer was too far behind
+    uint32_t dropped;
+    uint32_t queue_depth;
+    uint32_t queue_high_water;
+    // Records written out and synced, and the commits that did it
+    uint32_t committed;
+    uint32_t commits;
+    uint32_t write_errors;
+    uint64_t bytes_written;
+    // Time each commit spent in write() and fsync()
+    int64_t commit_sum_us;
+    int64_t commit_max_us;
+  };
+
+  static constexpr int kQueueCapacity = 64;
+  static constexpr size_t kWriteUnitSize = 16 * 1024;
+  static constexpr size_t kMaxFileSize = 512 * 1024;
+
+  PredictionLogger() = default;
+  PredictionLogger(const PredictionLogger&) = delete;
+  PredictionLogger& operator=(const PredictionLogger&) = delete;
+
+  // Allocates the queue and the buffers and starts the writer task, which
+  // writes to the log files in directory. Calling it again does nothing.
+  // config.min_scores must outlive the logger.
+  esp_err_t Start(const char* directory, const Config& config);
+  bool started() const { return task_started_; }
+
+  // Producer side, for one task only: queues the kCategoryCount scores of
+  // timestamp_ms without blocking. Returns false if the queue was full, in
+  // which case the record is counted as dropped if count_drop is set.
+  bool Log(const int8_t* scores, int64_t timestamp_ms, bool count_drop = true);
+  // Blocks the calling task until everything logged before was committed.
+  void Flush();
+
+  Stats GetStats() const;
+
+ private:
+  struct Record {
+    int64_t timestamp_ms;
+    int8_t scores[kCategoryCount];
+  };
+
+  // Longest CSV line a dense record can format to
+  static constexpr size_t kMaxLineSize = 24 + kCategoryCount * 16;
+
+  static void TaskEntry(void* logger);
+  void Run();
+  // Formats every queued record into the buffer.
+  void Drain();
+  void Append(const Record& record);
+  // Takes the length bytes formatted at the end of the buffer.
+  void EndLine(size_t length);
+  void AppendBinary(const Record& record);
+  // Opens the binary log's first file, with its header built from config_.
+  bool OpenStream();
+  // Writes the first size bytes of the buffer to the file.
+  bool WriteOut(size_t size);
+  bool WriteString(const char* text);
+  // Writes the whole buffer out and syncs the file.
+  void Commit();
+  // Picks the file to continue, or the next one if it's full or was written
+  // with another layout.
+  void FindFileIndex();
+  bool OpenFile();
+  void CloseFile();
+
+  const char* directory_ = nullptr;
+  Config config_ = {};
+  bool sparse_ = false;
+  int64_t commit_interval_us_ = 0;
+  uint32_t commit_records_ = 1;
+  bool task_started_ = false;
+
+  // The queue: the producer owns tail_, the writer head_. Both count records
+  // forever and wrap around kQueueCapacity.
+  Record* records_ = nullptr;
+  std::atomic<uint32_t> head_{0};
+  std::atomic<uint32_t> tail_{0};
+  TaskWaiter writer_waiter_;
+  // Set by Flush(), cleared by the writer once it committed what was queued
+  std::atomic<bool> flush_requested_{false};
+
+  // Writer task state
+  char* buffer_ = nullptr;
+  // Room left past the buffer's kWriteUnitSize bytes for one line
+  size_t line_capacity_ = kMaxLineSize;
+  size_t buffer_fill_ = 0;
+  // The categories selected for a sparse record, and the binary encoding of
+  // a record
+  uint16_t* selected_ = nullptr;
+  uint8_t* encoded_ = nullptr;
+  int fd_ = -1;
+  unsigned int file_index_ = 0;
+  // Bytes in the file, not counting the buffer
+  size_t file_size_ = 0;
+  uint32_t pending_records_ = 0;
+  int64_t group_start_us_ = 0;
+  // The binary log: its header, and the timestamp the next delta is from
+  StreamWriter stream_;
+  uint8_t* header_ = nullptr;
+  size_t header_size_ = 0;
+  int64_t last_timestamp_ms_ = 0;
+
+  std::atomic<uint32_t> queued_{0};
+  std::atomic<uint32_t> dropped_{0};
+  std::atomic<uint32_t> queue_high_water_{0};
+  std::atomic<uint32_t> committed_{0};
+  std::atomic<uint32_t> commits_{0};
+  std::atomic<uint32_t> write_errors_{0};
+  std::atomic<uint64_t> bytes_written_{0};
+  std::atomic<int64_t> commit_sum_us_{0};
+  std::atomic<int64_t> commit_max_us_{0};
+};
+
+}  // namespace sdcard
@@ -0,0 +1,48 @@
+#include "score_selection.h"
+
+#include <algorithm>
+
+int SelectTopScores(const int8_t* scores, int count, int top_k,
+                    const int8_t* min_scores, uint16_t* selected) {
+  // Scores below cut_off are out, and only ties_left of those at it are in.
+  int cut_off = INT8_MIN;
+  int ties_left = count;
+  if (top_k > 0) {
+    int histogram[256] = {};
+    int candidates = 0;
+    for (int i = 0; i < count; ++i) {
+      if (min_scores == nullptr || scores[i] >= min_scores[i]) {
+        histogram[scores[i] - INT8_MIN]++;
+        candidates++;
+      }
+    }
+    if (candidates > top_k) {
+      int above = 0;
+      cut_off = INT8_MAX;
+      while (above + histogram[cut_off - INT8_MIN] < top_k) {
+        above += histogram[cut_off - INT8_MIN];
+        cut_off--;
+      }
+      ties_left = top_k - above;
+    }
+  }
+
+  int kept = 0;
+  for (int i = 0; i < count; ++i) {
+    const int score = scores[i];
+    if (score < cut_off || (min_scores != nullptr && score < min_scores[i])) {
+      continue;
+    }
+    if (score == cut_off) {
+      if (ties_left == 0) {
+        continue;
+      }
+      ties_left--;
+    }
+    selected[kept++] = static_cast<uint16_t>(i);
+  }
+  std::sort(selected, selected + kept, [scores](uint16_t a, uint16_t b) {
+    return scores[a] != scores[b] ? scores[a] > scores[b] : a < b;
+  });
+  return kept;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+
+// Picks the categories worth logging out of a classifier output, straight on
+// its int8 scores: those whose score reaches their own minimum, and of those
+// the top_k highest. With min_scores null every category is a candidate, and
+// with top_k 0 every candidate is kept.
+//
+// A partial selection rather than a sort: one pass builds a histogram of the
+// candidates' 256 possible scores, the cut-off score of the top_k is read off
+// it, and a second pass collects the categories above it (and as many at it
+// as there's room for, lowest index first). Linear in count, so it stays
+// cheap with thousands of categories; only the categories kept are sorted.
+//
+// Writes the kept categories to selected, highest score first (lowest index
+// first among equal scores), and returns how many there are. selected needs
+// room for count entries when top_k is 0, for top_k otherwise.
+int SelectTopScores(const int8_t* scores, int count, int top_k,
+                    const int8_t* min_scores, uint16_t* selected);
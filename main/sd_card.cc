@@ -1,180 +1,105 @@
+#include <algorithm>
 #include <cerrno>
-#include "esp_vfs.h"
-#include "esp_vfs_fat.h"
-#include "sdmmc_cmd.h"
-#include "driver/sdmmc_host.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
 #include "esp_log.h"
 #include "esp_timer.h"
-#include "micro_model_settings.h"
-
-#define MOUNT_POINT "/sdcard"
+#include "pipeline_trace.h"
+#include "sd_card.h"
 
 static const char *TAG = "sd";
 
-namespace sdcard {
-esp_err_t mount() {
-  esp_err_t ret;
-
-  esp_vfs_fat_sdmmc_mount_config_t mount_config = {
-    .format_if_mount_failed = false,
-    .max_files = 5,
-    .allocation_unit_size = 16 * 1024
-  };
-
-  sdmmc_card_t *card;
-  sdmmc_host_t host = SDMMC_HOST_DEFAULT();
-
-  sdmmc_slot_config_t slot_config = {
-    .clk = GPIO_NUM_15,
-    .cmd = GPIO_NUM_7,
-    .d0 = GPIO_NUM_4,
-    .d1 = GPIO_NUM_NC,
-    .d2 = GPIO_NUM_NC,
-    .d3 = GPIO_NUM_NC,
-    .cd = SDMMC_SLOT_NO_CD,
-    .wp = SDMMC_SLOT_NO_WP,
-    .width   = 1,
-    .flags = SDMMC_SLOT_FLAG_INTERNAL_PULLUP,
-  };
-
-  ret = esp_vfs_fat_sdmmc_mount(MOUNT_POINT, &host, &slot_config, &mount_config, &card);
-
-  if (ret != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to mount SD card (%s)", esp_err_to_name(ret));
-    return ret;
-  }
-
-  ESP_LOGI(TAG, "SD card mounted at %s", MOUNT_POINT);
-  sdmmc_card_print_info(stdout, card);
-  return ESP_OK;
-}
+// The host build has no sdkconfig of its own.
+#ifdef CONFIG_PREDICTION_LOG_COMMIT_MS
+constexpr int kPredictionLogCommitMs = CONFIG_PREDICTION_LOG_COMMIT_MS;
+constexpr int kPredictionLogCommitRecords = CONFIG_PREDICTION_LOG_COMMIT_RECORDS;
+#else
+constexpr int kPredictionLogCommitMs = 2000;
+constexpr int kPredictionLogCommitRecords = 32;
+#endif
+#ifdef CONFIG_PREDICTION_LOG_FORMAT_BINARY
+constexpr sdcard::PredictionLogger::Format kPredictionLogFormat =
+    sdcard::PredictionLogger::Format::kBinary;
+#else
+constexpr sdcard::PredictionLogger::Format kPredictionLogFormat =
+    sdcard::PredictionLogger::Format::kCsv;
+#endif
+#ifdef CONFIG_PREDICTION_LOG_SPARSE
+constexpr bool kPredictionLogSparse = true;
+constexpr int kPredictionLogTopK = CONFIG_PREDICTION_LOG_TOP_K;
+#else
+constexpr bool kPredictionLogSparse = false;
+constexpr int kPredictionLogTopK = 5;
+#endif
 
-void unmount() {
-  esp_vfs_fat_sdcard_unmount(MOUNT_POINT, nullptr);
-  ESP_LOGI(TAG, "SD card unmounted");
+namespace sdcard {
+namespace {
+PredictionLogger g_prediction_logger;
+bool g_wait_when_full = false;
+PredictionLogger::Format g_format = kPredictionLogFormat;
+bool g_sparse = kPredictionLogSparse;
+int g_top_k = kPredictionLogTopK;
+// kCategoryLogMinScores, quantized like the scores
+int8_t g_min_scores[kCategoryCount];
+}  // namespace
+
+void logPredictions(const int8_t* scores) {
+  logPredictions(scores, esp_timer_get_time() / 1000);
 }
 
-void logPredictions(float* predictions) {
-  static FILE* prediction_file = nullptr;
-  static char current_filename[64] = {0};
-  static unsigned int file_index = 0;
-  static bool index_initialized = false;
-  const size_t MAX_FILE_SIZE = 512 * 1024; // 512KB
-
-  if (predictions == nullptr) {
-    ESP_LOGE(TAG, "Predictions array is null");
-    return;
-  }
-
-  // Initialize file index on first run by finding the highest existing index
-  if (!index_initialized) {
-    DIR* dir = opendir("/sdcard");
-    if (dir == nullptr) {
-      ESP_LOGE(TAG, "Failed to open /sdcard directory: %s", strerror(errno));
-      return;
-    }
-
-    struct dirent* entry;
-    uint32_t max_index = 0;
-    while ((entry = readdir(dir)) != nullptr) {
-      unsigned int index;
-      if (sscanf(entry->d_name, "%u.csv", &index) == 1) {
-        if (index > max_index) {
-          max_index = index;
-        }
-      }
-    }
-    closedir(dir);
-    file_index = max_index;
-    ESP_LOGI(TAG, "Curr file index: %d", file_index);
-
-    // Check if current max file exists and is under size limit
-    snprintf(current_filename, sizeof(current_filename), "/sdcard/%u.csv", file_index);
-    struct stat file_stat = {};
-    if (stat(current_filename, &file_stat) == 0 && file_stat.st_size < MAX_FILE_SIZE) {
-      // Current file exists and has space, continue using it
-      ESP_LOGI(TAG, "Continuing with existing file: %s (size: %ld bytes)",
-               current_filename, file_stat.st_size);
-    } else {
-      // Need new file
-      file_index++;
-      snprintf(current_filename, sizeof(current_filename), "/sdcard/%u.csv", file_index);
-    }
-    index_initialized = true;
-  }
-
-  // Check if current file needs rotation (size limit reached)
-  bool need_new_file = false;
-  if (prediction_file != nullptr) {
-    if (fseek(prediction_file, 0, SEEK_END) != 0) {
-      ESP_LOGE(TAG, "Failed to seek file, closing: %s", strerror(errno));
-      fclose(prediction_file);
-      prediction_file = nullptr;
-      return;
-    }
-
-    long current_size = ftell(prediction_file);
-    if (current_size >= MAX_FILE_SIZE) {
-      need_new_file = true;
-      fclose(prediction_file);
-      prediction_file = nullptr;
-      ESP_LOGI(TAG, "File %s reached size limit (%ld bytes), rotating",
-               current_filename, current_size);
+esp_err_t startPredictionLog(float scale, int zero_point) {
+  if (g_sparse) {
+    // The lowest score q with (q - zero_point) * scale >= the minimum
+    for (int i = 0; i < kCategoryCount; i++) {
+      const float q = std::ceil(kCategoryLogMinScores[i] / scale) + zero_point;
+      g_min_scores[i] = static_cast<int8_t>(std::min(std::max(q, -128.0f), 127.0f));
     }
   }
+  return g_prediction_logger.Start(
+      mountPoint(),
+      {kPredictionLogCommitMs, kPredictionLogCommitRecords, g_format, scale, zero_point,
+       g_sparse ? g_top_k : 0, g_sparse ? g_min_scores : nullptr});
+}
 
-  // Open file if needed (first run or after rotation)
-  if (prediction_file == nullptr) {
-    if (need_new_file) {
-      file_index++;
-      snprintf(current_filename, sizeof(current_filename), "/sdcard/%u.csv", file_index);
-    }
+void setPredictionLogFormat(PredictionLogger::Format format) {
+  g_format = format;
+}
 
-    prediction_file = fopen(current_filename, "a");
-    if (prediction_file == nullptr) {
-      ESP_LOGE(TAG, "Failed to open predictions file %s: %s", current_filename, strerror(errno));
-      return;
-    }
+void setPredictionLogSparse(bool sparse, int top_k) {
+  g_sparse = sparse;
+  g_top_k = top_k;
+}
 
-    ESP_LOGI(TAG, "Opened prediction file: %s", current_filename);
-
-    // Write header if file is new (check if empty)
-    fseek(prediction_file, 0, SEEK_END);
-    if (ftell(prediction_file) == 0) {
-      fprintf(prediction_file, "timestamp");
-      for (auto kCategoryLabel : kCategoryLabels) {
-        fprintf(prediction_file, ",%s", kCategoryLabel);
-      }
-      fprintf(prediction_file, "\n");
-      ESP_LOGD(TAG, "Written CSV header to new file");
-    }
+void logPredictions(const int8_t* scores, int64_t timestamp_ms) {
+  TRACE_STAGE(kLogPredictions);
+  if (scores == nullptr) {
+    ESP_LOGE(TAG, "Scores array is null");
+    return;
   }
-
-  // Write prediction data
-  int64_t timestamp_ms = esp_timer_get_time() / 1000;
-  if (fprintf(prediction_file, "%lld", timestamp_ms) < 0) {
-    ESP_LOGE(TAG, "Failed to write to file: %s", strerror(errno));
+  if (!g_prediction_logger.started()) {
     return;
   }
-
-  for (int i = 0; i < kCategoryCount; i++) {
-    if (fprintf(prediction_file, ",%.4f", predictions[i]) < 0) {
-      ESP_LOGE(TAG, "Failed to write prediction data: %s", strerror(errno));
+  while (!g_prediction_logger.Log(scores, timestamp_ms, !g_wait_when_full)) {
+    if (!g_wait_when_full) {
+      ESP_LOGD(TAG, "Prediction log queue full, record dropped");
       return;
     }
+    g_prediction_logger.Flush();
   }
-  fprintf(prediction_file, "\n");
+}
 
-  // Ensure data is written immediately
-  if (fflush(prediction_file) != 0) {
-    ESP_LOGE(TAG, "Failed to flush file: %s", strerror(errno));
-  }
-  if (fsync(fileno(prediction_file)) != 0) {
-    ESP_LOGE(TAG, "Failed to sync file: %s", strerror(errno));
-  }
+void flushPredictions() {
+  g_prediction_logger.Flush();
+}
+
+void setPredictionLogBackpressure(bool wait) {
+  g_wait_when_full = wait;
+}
 
-  ESP_LOGD(TAG, "Logged predictions to %s", current_filename);
-  ESP_LOGD(TAG, "File size %lu/%zu", ftell(prediction_file), MAX_FILE_SIZE);
+PredictionLogger::Stats predictionLogStats() {
+  return g_prediction_logger.GetStats();
 }
 
 bool writeBytes(char* filename, const void* data, size_t size) {
@@ -1,10 +1,38 @@
 # pragma once
+#include <cstddef>
+#include <cstdint>
 #include "esp_err.h"
+#include "prediction_logger.h"
+#include "stream_writer.h"
 
 
 namespace sdcard {
 esp_err_t mount();
 void unmount();
-void logPredictions(float *predictions);
+// Directory the card is mounted at (a local directory on the host build).
+const char* mountPoint();
+// Starts the background task that writes the prediction log, see
+// PredictionLogger: CSV, or binary with CONFIG_PREDICTION_LOG_FORMAT_BINARY
+// or setPredictionLogFormat(). The classifier's scores are logged raw, scale
+// and zero_point are their quantization.
+esp_err_t startPredictionLog(float scale, int zero_point);
+void setPredictionLogFormat(PredictionLogger::Format format);
+// Logs only the top_k scores of each record (all with 0) of those that reach
+// their category's kCategoryLogMinScores, as CONFIG_PREDICTION_LOG_SPARSE
+// does. Before startPredictionLog().
+void setPredictionLogSparse(bool sparse, int top_k);
+// Queues the kCategoryCount int8 scores for the writer task, without waiting
+// for the card. Does nothing before startPredictionLog().
+void logPredictions(const int8_t* scores);
+void logPredictions(const int8_t* scores, int64_t timestamp_ms);
+// Blocks until every prediction logged so far is on the card.
+void flushPredictions();
+// With wait set, logPredictions() waits for room in the queue when the writer
+// is behind instead of dropping the record: for offline processing, which
+// has no deadline but shouldn't lose rows.
+void setPredictionLogBackpressure(bool wait);
+PredictionLogger::Stats predictionLogStats();
+// Appends to filename and syncs it, opening and closing it every time: for
+// occasional writes. Streams go through a StreamWriter.
 bool writeBytes(char* filename, const void* data, size_t size);
 }  // namespace sdcard
\ No newline at end of file
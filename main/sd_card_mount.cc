@@ -0,0 +1,58 @@
+#include "esp_vfs.h"
+#include "esp_vfs_fat.h"
+#include "sdmmc_cmd.h"
+#include "driver/sdmmc_host.h"
+#include "esp_log.h"
+#include "sd_card.h"
+
+#define MOUNT_POINT "/sdcard"
+
+static const char *TAG = "sd";
+
+namespace sdcard {
+esp_err_t mount() {
+  esp_err_t ret;
+
+  esp_vfs_fat_sdmmc_mount_config_t mount_config = {
+    .format_if_mount_failed = false,
+    .max_files = 5,
+    .allocation_unit_size = 16 * 1024
+  };
+
+  sdmmc_card_t *card;
+  sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+
+  sdmmc_slot_config_t slot_config = {
+    .clk = GPIO_NUM_15,
+    .cmd = GPIO_NUM_7,
+    .d0 = GPIO_NUM_4,
+    .d1 = GPIO_NUM_NC,
+    .d2 = GPIO_NUM_NC,
+    .d3 = GPIO_NUM_NC,
+    .cd = SDMMC_SLOT_NO_CD,
+    .wp = SDMMC_SLOT_NO_WP,
+    .width   = 1,
+    .flags = SDMMC_SLOT_FLAG_INTERNAL_PULLUP,
+  };
+
+  ret = esp_vfs_fat_sdmmc_mount(MOUNT_POINT, &host, &slot_config, &mount_config, &card);
+
+  if (ret != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to mount SD card (%s)", esp_err_to_name(ret));
+    return ret;
+  }
+
+  ESP_LOGI(TAG, "SD card mounted at %s", MOUNT_POINT);
+  sdmmc_card_print_info(stdout, card);
+  return ESP_OK;
+}
+
+void unmount() {
+  esp_vfs_fat_sdcard_unmount(MOUNT_POINT, nullptr);
+  ESP_LOGI(TAG, "SD card unmounted");
+}
+
+const char* mountPoint() {
+  return MOUNT_POINT;
+}
+}  // namespace sdcard
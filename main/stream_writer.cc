@@ -0,0 +1,262 @@
+#include "stream_writer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char* TAG = "stream_writer";
+
+namespace sdcard {
+namespace {
+// The shared buffers: a set bit is a buffer in use. Each one is allocated
+// the first time it's taken and kept for good, so writers coming and going
+// don't fragment the heap.
+uint8_t* g_pool_buffers[StreamWriter::kPoolBuffers] = {};
+std::atomic<uint32_t> g_pool_used{0};
+
+uint8_t* TakePoolBuffer() {
+  uint32_t used = g_pool_used.load(std::memory_order_relaxed);
+  for (int i = 0; i < StreamWriter::kPoolBuffers; ++i) {
+    const uint32_t bit = 1u << i;
+    while (!(used & bit)) {
+      if (!g_pool_used.compare_exchange_weak(used, used | bit, std::memory_order_acquire)) {
+        continue;
+      }
+      if (g_pool_buffers[i] == nullptr) {
+        // The SD driver can DMA straight from internal, word-aligned memory;
+        // anything else goes through its bounce buffer.
+        g_pool_buffers[i] = static_cast<uint8_t*>(
+            heap_caps_malloc(StreamWriter::kUnitSize, MALLOC_CAP_DMA));
+      }
+      if (g_pool_buffers[i] == nullptr) {
+        g_pool_buffers[i] = static_cast<uint8_t*>(
+            heap_caps_malloc(StreamWriter::kUnitSize, MALLOC_CAP_DEFAULT));
+      }
+      if (g_pool_buffers[i] == nullptr) {
+        g_pool_used.fetch_and(~bit, std::memory_order_release);
+        return nullptr;
+      }
+      return g_pool_buffers[i];
+    }
+  }
+  return nullptr;
+}
+
+void GiveBackPoolBuffer(uint8_t* buffer) {
+  for (int i = 0; i < StreamWriter::kPoolBuffers; ++i) {
+    if (g_pool_buffers[i] == buffer) {
+      g_pool_used.fetch_and(~(1u << i), std::memory_order_release);
+      return;
+    }
+  }
+}
+}  // namespace
+
+esp_err_t StreamWriter::Open(const Config& config) {
+  if (fd_ >= 0) {
+    return ESP_OK;
+  }
+  config_ = config;
+  buffer_ = TakePoolBuffer();
+  if (buffer_ == nullptr) {
+    ESP_LOGE(TAG, "No stream buffer left in the pool");
+    return ESP_ERR_NO_MEM;
+  }
+
+  // Start after the highest numbered file in the directory
+  file_index_ = 0;
+  DIR* dir = opendir(config_.directory);
+  if (dir == nullptr) {
+    ESP_LOGE(TAG, "Failed to open %s directory: %s", config_.directory, strerror(errno));
+  } else {
+    char pattern[16];
+    snprintf(pattern, sizeof(pattern), "%%u.%s", config_.extension);
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+      unsigned int index;
+      if (sscanf(entry->d_name, pattern, &index) == 1) {
+        file_index_ = std::max(file_index_, index + 1);
+      }
+    }
+    closedir(dir);
+  }
+
+  if (!OpenFile()) {
+    GiveBackPoolBuffer(buffer_);
+    buffer_ = nullptr;
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+bool StreamWriter::Write(const void* data, size_t size) {
+  if (fd_ < 0) {
+    return false;
+  }
+  if (config_.max_file_size > 0 && file_size() > config_.header_size &&
+      file_size() + size > config_.max_file_size) {
+    ESP_LOGI(TAG, "File %u.%s reached size limit (%zu bytes), rotating", file_index_,
+             config_.extension, file_size());
+    if (!Rotate()) {
+      return false;
+    }
+  }
+  if (!Append(static_cast<const uint8_t*>(data), size)) {
+    return false;
+  }
+
+  unsynced_bytes_ += size;
+  if ((config_.sync_bytes > 0 && unsynced_bytes_ >= config_.sync_bytes) ||
+      (config_.sync_interval_ms > 0 &&
+       esp_timer_get_time() - last_sync_us_ >= int64_t{config_.sync_interval_ms} * 1000)) {
+    return Sync();
+  }
+  return true;
+}
+
+bool StreamWriter::Append(const uint8_t* data, size_t size) {
+  while (size > 0) {
+    const size_t unit_left = kUnitSize - file_size_ % kUnitSize;
+    if (buffer_fill_ == 0 && size >= unit_left) {
+      // Up to the last unit boundary it reaches, straight from the caller
+      const size_t direct = unit_left + (size - unit_left) / kUnitSize * kUnitSize;
+      if (!WriteOut(data, direct)) {
+        return false;
+      }
+      data += direct;
+      size -= direct;
+      continue;
+    }
+    const size_t piece = std::min(size, unit_left - buffer_fill_);
+    memcpy(buffer_ + buffer_fill_, data, piece);
+    buffer_fill_ += piece;
+    data += piece;
+    size -= piece;
+    if (buffer_fill_ == unit_left) {
+      buffer_fill_ = 0;
+      if (!WriteOut(buffer_, unit_left)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool StreamWriter::WriteOut(const void* data, size_t size) {
+  const int64_t start_us = esp_timer_get_time();
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  size_t done = 0;
+  while (done < size) {
+    const ssize_t written = write(fd_, bytes + done, size - done);
+    if (written <= 0) {
+      ESP_LOGE(TAG, "Failed to write to %u.%s: %s", file_index_, config_.extension,
+               strerror(errno));
+      stats_.write_errors++;
+      return false;
+    }
+    done += written;
+  }
+  const int64_t write_us = esp_timer_get_time() - start_us;
+  stats_.writes++;
+  stats_.write_sum_us += write_us;
+  stats_.write_max_us = std::max(stats_.write_max_us, write_us);
+  stats_.bytes += size;
+  file_size_ += size;
+  return true;
+}
+
+bool StreamWriter::Sync() {
+  if (fd_ < 0) {
+    return false;
+  }
+  bool ok = buffer_fill_ == 0 || WriteOut(buffer_, buffer_fill_);
+  buffer_fill_ = 0;
+  const int64_t start_us = esp_timer_get_time();
+  if (fsync(fd_) != 0) {
+    ESP_LOGE(TAG, "Failed to sync %u.%s: %s", file_index_, config_.extension,
+             strerror(errno));
+    stats_.write_errors++;
+    ok = false;
+  }
+  last_sync_us_ = esp_timer_get_time();
+  stats_.syncs++;
+  stats_.sync_max_us = std::max(stats_.sync_max_us, last_sync_us_ - start_us);
+  unsynced_bytes_ = 0;
+  return ok;
+}
+
+bool StreamWriter::Rotate() {
+  if (fd_ < 0) {
+    return false;
+  }
+  const bool closed = CloseFile();
+  file_index_++;
+  return OpenFile() && closed;
+}
+
+void StreamWriter::Close() {
+  if (fd_ >= 0) {
+    CloseFile();
+  }
+  if (buffer_ != nullptr) {
+    GiveBackPoolBuffer(buffer_);
+    buffer_ = nullptr;
+  }
+}
+
+bool StreamWriter::OpenFile() {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%u.%s", config_.directory, file_index_,
+           config_.extension);
+  fd_ = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    ESP_LOGE(TAG, "Failed to open %s: %s", path, strerror(errno));
+    return false;
+  }
+  // Seeking past the end of a file open for writing makes FATFS allocate the
+  // clusters up to there (ftruncate() only shrinks on the board).
+  if (config_.preallocate_size > 0 &&
+      (lseek(fd_, config_.preallocate_size - 1, SEEK_SET) < 0 || write(fd_, "", 1) != 1 ||
+       lseek(fd_, 0, SEEK_SET) != 0)) {
+    ESP_LOGW(TAG, "Failed to preallocate %zu bytes for %s: %s", config_.preallocate_size,
+             path, strerror(errno));
+    lseek(fd_, 0, SEEK_SET);
+  }
+  file_size_ = 0;
+  buffer_fill_ = 0;
+  unsynced_bytes_ = 0;
+  last_sync_us_ = esp_timer_get_time();
+  stats_.files++;
+  ESP_LOGI(TAG, "Opened %s", path);
+  if (config_.header_size > 0 &&
+      !Append(static_cast<const uint8_t*>(config_.header), config_.header_size)) {
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  return true;
+}
+
+bool StreamWriter::CloseFile() {
+  bool ok = Sync();
+  if (config_.preallocate_size > 0 && ftruncate(fd_, file_size_) != 0) {
+    ESP_LOGE(TAG, "Failed to trim %u.%s: %s", file_index_, config_.extension,
+             strerror(errno));
+    stats_.write_errors++;
+    ok = false;
+  }
+  close(fd_);
+  fd_ = -1;
+  return ok;
+}
+
+}  // namespace sdcard
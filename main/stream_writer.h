@@ -0,0 +1,106 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "esp_err.h"
+
+namespace sdcard {
+
+// Streams data to numbered files on the card through one open handle,
+// instead of opening, syncing and closing the file on every write like
+// writeBytes() does. Meant for features, audio or telemetry written from a
+// single task.
+//
+// Writes are gathered in a buffer of kUnitSize bytes, the card's allocation
+// unit, taken from a pool of kPoolBuffers DMA-capable buffers allocated once
+// and shared by all writers. The buffer goes out whenever it fills up to the
+// next unit boundary of the file, so that FATFS gets whole, aligned
+// clusters; writes that reach past a boundary on their own go out straight
+// from the caller's memory. The file is synced at durability points: on
+// Sync(), and from Write() once sync_bytes were written or sync_interval_ms
+// passed since the last one.
+//
+// New files are N.ext, N counting up from the highest number already in the
+// directory, and rotate once they reach max_file_size; a Write() is never
+// split across files. With preallocate_size, each file is extended to that
+// size up front so that appending doesn't allocate clusters and walk the
+// FAT chain, and trimmed to what was written when it's closed. A file whose
+// writer never closed it, e.g. on power loss, keeps its preallocated size:
+// what follows the last durability point is undefined.
+class StreamWriter {
+ public:
+  struct Config {
+    const char* directory;
+    // File name extension, without the dot
+    const char* extension;
+    // 0 for no limit
+    size_t max_file_size;
+    // 0 to let files grow as they're written
+    size_t preallocate_size;
+    // 0 for no periodic durability points, only Sync()
+    int sync_interval_ms;
+    size_t sync_bytes;
+    // Written at the start of every file, may be null
+    const void* header;
+    size_t header_size;
+  };
+
+  // Counters since the writer was created
+  struct Stats {
+    uint32_t files;
+    uint64_t bytes;
+    // write() calls, and the time spent in them
+    uint32_t writes;
+    int64_t write_sum_us;
+    int64_t write_max_us;
+    // fsync() calls: the durability points
+    uint32_t syncs;
+    int64_t sync_max_us;
+    uint32_t write_errors;
+  };
+
+  static constexpr size_t kUnitSize = 16 * 1024;
+  static constexpr int kPoolBuffers = 4;
+
+  StreamWriter() = default;
+  ~StreamWriter() { Close(); }
+  StreamWriter(const StreamWriter&) = delete;
+  StreamWriter& operator=(const StreamWriter&) = delete;
+
+  // Takes a buffer from the pool and opens the first file. config's strings
+  // and header must outlive the writer.
+  esp_err_t Open(const Config& config);
+  // Appends size bytes. Returns false if they couldn't be written.
+  bool Write(const void* data, size_t size);
+  // Durability point: writes the buffer out and syncs the file.
+  bool Sync();
+  // Closes the current file and continues in the next one.
+  bool Rotate();
+  // Syncs and closes the file, and gives the buffer back to the pool.
+  void Close();
+
+  bool is_open() const { return fd_ >= 0; }
+  unsigned int file_index() const { return file_index_; }
+  // Bytes in the current file, including those still in the buffer
+  size_t file_size() const { return file_size_ + buffer_fill_; }
+  const Stats& stats() const { return stats_; }
+
+ private:
+  bool OpenFile();
+  bool CloseFile();
+  bool WriteOut(const void* data, size_t size);
+  // Copies into the buffer, writing out whole units as they fill up.
+  bool Append(const uint8_t* data, size_t size);
+
+  Config config_ = {};
+  int fd_ = -1;
+  unsigned int file_index_ = 0;
+  uint8_t* buffer_ = nullptr;
+  size_t buffer_fill_ = 0;
+  // Bytes written to the file, not counting the buffer
+  size_t file_size_ = 0;
+  size_t unsynced_bytes_ = 0;
+  int64_t last_sync_us_ = 0;
+  Stats stats_ = {};
+};
+
+}  // namespace sdcard
@@ -0,0 +1,57 @@
+#pragma once
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Lets one task sleep on its task notification until a condition that another
+// task makes true holds, without a lock on either side: the waiter publishes
+// its handle before checking the condition one last time, the other side
+// makes the condition true before looking for a handle to notify, and a
+// fence on each side makes sure at least one of them sees the other.
+class TaskWaiter {
+ public:
+  // Blocks the calling task until ready() holds, or ticks_to_wait passed.
+  // Returns ready().
+  template <typename Ready>
+  bool Wait(Ready ready, TickType_t ticks_to_wait) {
+    const TickType_t start = xTaskGetTickCount();
+    TickType_t remaining = ticks_to_wait;
+    while (remaining > 0) {
+      task_.store(xTaskGetCurrentTaskHandle(), std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (ready()) {
+        task_.store(nullptr, std::memory_order_relaxed);
+        return true;
+      }
+      // A notification left over from an earlier wake-up just means one more
+      // round through the loop.
+      ulTaskNotifyTake(pdTRUE, remaining);
+      task_.store(nullptr, std::memory_order_relaxed);
+      if (ready()) {
+        return true;
+      }
+      if (ticks_to_wait != portMAX_DELAY) {
+        const TickType_t elapsed = xTaskGetTickCount() - start;
+        remaining = elapsed < ticks_to_wait ? ticks_to_wait - elapsed : 0;
+      }
+    }
+    return ready();
+  }
+
+  // Notifies the waiting task, if any. Call after making its condition true.
+  void Wake() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (task_.load(std::memory_order_relaxed) == nullptr) {
+      return;
+    }
+    TaskHandle_t task = task_.exchange(nullptr, std::memory_order_acq_rel);
+    if (task != nullptr) {
+      xTaskNotifyGive(task);
+    }
+  }
+
+  void Reset() { task_.store(nullptr, std::memory_order_relaxed); }
+
+ private:
+  std::atomic<TaskHandle_t> task_{nullptr};
+};
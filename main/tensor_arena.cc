@@ -0,0 +1,77 @@
+#include "tensor_arena.h"
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "tensorflow/lite/micro/micro_allocator.h"
+
+static const char* TAG = "tensor_arena";
+
+TensorArena::~TensorArena() {
+  Free();
+}
+
+void TensorArena::Free() {
+  heap_caps_free(psram_);
+  heap_caps_free(internal_);
+  psram_ = nullptr;
+  internal_ = nullptr;
+  size_ = 0;
+  internal_size_ = 0;
+  placement_ = Placement::kPsram;
+}
+
+esp_err_t TensorArena::Allocate(Placement placement, size_t size, size_t internal_size) {
+  Free();
+  psram_ = static_cast<uint8_t*>(heap_caps_malloc(size, MALLOC_CAP_SPIRAM));
+  if (psram_ == nullptr) {
+    psram_ = static_cast<uint8_t*>(heap_caps_malloc(size, MALLOC_CAP_DEFAULT));
+  }
+  if (psram_ == nullptr) {
+    ESP_LOGE(TAG, "Can't allocate a tensor arena of %u bytes", (unsigned) size);
+    return ESP_ERR_NO_MEM;
+  }
+  size_ = size;
+
+  if (placement == Placement::kHybrid) {
+    constexpr uint32_t kInternalCaps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    const size_t free_size = heap_caps_get_free_size(kInternalCaps);
+    const size_t largest_block = heap_caps_get_largest_free_block(kInternalCaps);
+    if (internal_size <= largest_block && internal_size + kInternalReserve <= free_size) {
+      internal_ = static_cast<uint8_t*>(heap_caps_malloc(internal_size, kInternalCaps));
+    }
+    if (internal_ == nullptr) {
+      ESP_LOGW(TAG, "Not enough internal RAM for %u bytes of tensors (%u free, largest "
+               "block %u, %u reserved), the arena stays in PSRAM", (unsigned) internal_size,
+               (unsigned) free_size, (unsigned) largest_block, (unsigned) kInternalReserve);
+    } else {
+      internal_size_ = internal_size;
+      placement_ = Placement::kHybrid;
+    }
+  }
+  ESP_LOGI(TAG, "Tensor arena: %s, %u bytes + %u bytes internal", placement_name(),
+           (unsigned) size_, (unsigned) internal_size_);
+  return ESP_OK;
+}
+
+tflite::MicroAllocator* TensorArena::CreateAllocator() {
+  if (placement_ == Placement::kHybrid) {
+    return tflite::MicroAllocator::Create(psram_, size_, internal_, internal_size_);
+  }
+  return tflite::MicroAllocator::Create(psram_, size_);
+}
+
+void TensorArena::FallBackToPsram() {
+  if (placement_ != Placement::kHybrid) {
+    return;
+  }
+  ESP_LOGW(TAG, "Tensors don't fit in %u bytes of internal RAM, moving them to PSRAM",
+           (unsigned) internal_size_);
+  heap_caps_free(internal_);
+  internal_ = nullptr;
+  internal_size_ = 0;
+  placement_ = Placement::kPsram;
+}
+
+const char* TensorArena::placement_name() const {
+  return placement_ == Placement::kHybrid ? "hybrid" : "PSRAM";
+}
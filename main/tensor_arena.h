@@ -0,0 +1,64 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+namespace tflite {
+class MicroAllocator;
+}  // namespace tflite
+
+// Memory for a TFLM interpreter's tensors. TFLM keeps the tensors and
+// buffers that only live during Invoke(), the activations and the kernels'
+// scratch buffers, in a non-persistent arena, and whatever is set up once
+// and kept, like the tensor metadata and the ops' quantization data, in a
+// persistent one. Every op reads and writes the former, so a hybrid arena
+// gives it internal SRAM and leaves the persistent part in PSRAM, where a
+// single arena puts all of it behind the PSRAM cache.
+//
+// Internal RAM is shared with the task stacks and buffers allocated after
+// the interpreter, so a hybrid arena only takes it if that leaves
+// kInternalReserve free; when it doesn't, or the tensors turn out not to fit
+// in it, the arena falls back to PSRAM alone.
+class TensorArena {
+ public:
+  enum class Placement { kPsram, kHybrid };
+
+#ifdef CONFIG_TENSOR_ARENA_INTERNAL_RESERVE_KB
+  static constexpr size_t kInternalReserve = CONFIG_TENSOR_ARENA_INTERNAL_RESERVE_KB * 1024;
+#else
+  static constexpr size_t kInternalReserve = 96 * 1024;
+#endif
+
+  TensorArena() = default;
+  ~TensorArena();
+  TensorArena(const TensorArena&) = delete;
+  TensorArena& operator=(const TensorArena&) = delete;
+
+  // Allocates size bytes of PSRAM, or of the default heap without PSRAM,
+  // and with kHybrid also internal_size bytes of internal RAM for the
+  // non-persistent part if there's enough of it. The PSRAM part is kept
+  // whole in either case, so that the arena can fall back to it.
+  esp_err_t Allocate(Placement placement, size_t size, size_t internal_size);
+  void Free();
+
+  // A MicroAllocator for an interpreter on the arena, created in the arena
+  // itself: the previous one is gone. Null if the arena is too small for it.
+  tflite::MicroAllocator* CreateAllocator();
+
+  // Frees the internal part of a hybrid arena, for when the interpreter's
+  // tensors didn't fit in it. The arena is then a PSRAM one.
+  void FallBackToPsram();
+
+  Placement placement() const { return placement_; }
+  const char* placement_name() const;
+  size_t size() const { return size_; }
+  size_t internal_size() const { return internal_size_; }
+
+ private:
+  uint8_t* psram_ = nullptr;
+  uint8_t* internal_ = nullptr;
+  size_t size_ = 0;
+  size_t internal_size_ = 0;
+  Placement placement_ = Placement::kPsram;
+};
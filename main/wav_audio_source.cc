@@ -0,0 +1,120 @@
+#include "wav_audio_source.h"
+
+#include <cerrno>
+#include <cstring>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "wav_audio_source";
+
+namespace {
+uint32_t LittleEndian32(const uint8_t* bytes) {
+  return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+uint16_t LittleEndian16(const uint8_t* bytes) {
+  return bytes[0] | (bytes[1] << 8);
+}
+}  // namespace
+
+WavAudioSource::WavAudioSource(const char* path, bool real_time)
+    : path_(path), real_time_(real_time) {}
+
+WavAudioSource::~WavAudioSource() {
+  if (file_ != nullptr) {
+    fclose(file_);
+  }
+}
+
+TfLiteStatus WavAudioSource::Start() {
+  file_ = fopen(path_, "rb");
+  if (file_ == nullptr) {
+    ESP_LOGE(TAG, "Failed to open %s: %s", path_, strerror(errno));
+    return kTfLiteError;
+  }
+
+  uint8_t riff_header[12];
+  if (fread(riff_header, 1, sizeof(riff_header), file_) != sizeof(riff_header)
+      || memcmp(riff_header, "RIFF", 4) != 0
+      || memcmp(riff_header + 8, "WAVE", 4) != 0) {
+    ESP_LOGE(TAG, "%s is not a RIFF/WAVE file", path_);
+    return kTfLiteError;
+  }
+
+  // Walk the chunks until the samples, picking up the format on the way.
+  uint8_t chunk_header[8];
+  while (fread(chunk_header, 1, sizeof(chunk_header), file_) == sizeof(chunk_header)) {
+    const uint32_t chunk_size = LittleEndian32(chunk_header + 4);
+    if (memcmp(chunk_header, "fmt ", 4) == 0) {
+      uint8_t fmt[16];
+      if (chunk_size < sizeof(fmt) || fread(fmt, 1, sizeof(fmt), file_) != sizeof(fmt)) {
+        ESP_LOGE(TAG, "Truncated fmt chunk in %s", path_);
+        return kTfLiteError;
+      }
+      const uint16_t audio_format = LittleEndian16(fmt);
+      const uint32_t sample_rate = LittleEndian32(fmt + 4);
+      const uint16_t bits_per_sample = LittleEndian16(fmt + 14);
+      channels_ = LittleEndian16(fmt + 2);
+      if (audio_format != 1 || bits_per_sample != 16 || channels_ == 0) {
+        ESP_LOGE(TAG, "%s: only 16-bit PCM is supported", path_);
+        return kTfLiteError;
+      }
+      if (sample_rate != kAudioSampleFrequency) {
+        ESP_LOGE(TAG, "%s: sample rate %lu, expected %d", path_,
+                 (unsigned long) sample_rate, kAudioSampleFrequency);
+        return kTfLiteError;
+      }
+      fseek(file_, chunk_size - sizeof(fmt) + (chunk_size & 1), SEEK_CUR);
+    } else if (memcmp(chunk_header, "data", 4) == 0) {
+      if (channels_ == 0) {
+        ESP_LOGE(TAG, "%s: data chunk before fmt chunk", path_);
+        return kTfLiteError;
+      }
+      data_bytes_left_ = chunk_size;
+      ESP_LOGI(TAG, "Streaming %s: %d channel(s), %lu ms", path_, channels_,
+               (unsigned long) (1000ull * chunk_size / (2 * channels_) / kAudioSampleFrequency));
+      return kTfLiteOk;
+    } else {
+      fseek(file_, chunk_size + (chunk_size & 1), SEEK_CUR);
+    }
+  }
+  ESP_LOGE(TAG, "No data chunk in %s", path_);
+  return kTfLiteError;
+}
+
+TfLiteStatus WavAudioSource::Read(int* samples_size, int16_t** samples) {
+  const int frames_per_block = kBlockSamples / channels_;
+  size_t frames_wanted = data_bytes_left_ / (2 * channels_);
+  if (frames_wanted > frames_per_block) {
+    frames_wanted = frames_per_block;
+  }
+  const size_t frames_read = fread(block_, 2 * channels_, frames_wanted, file_);
+  data_bytes_left_ -= frames_read * 2 * channels_;
+  if (frames_read < frames_wanted) {
+    data_bytes_left_ = 0;
+  }
+  // Keep the first channel of each frame
+  for (size_t i = 1; i < frames_read && channels_ > 1; ++i) {
+    block_[i] = block_[i * channels_];
+  }
+
+  if (real_time_ && frames_read > 0) {
+    if (samples_delivered_ == 0) {
+      start_time_us_ = esp_timer_get_time();
+    }
+    // A block only exists once all of its samples have been "recorded"
+    const int64_t due_us = start_time_us_ +
+        (samples_delivered_ + frames_read) * 1000000 / kAudioSampleFrequency;
+    const int64_t wait_us = due_us - esp_timer_get_time();
+    if (wait_us > 0) {
+      vTaskDelay(pdMS_TO_TICKS(wait_us / 1000));
+    }
+  }
+  samples_delivered_ += frames_read;
+
+  *samples_size = frames_read;
+  *samples = block_;
+  return kTfLiteOk;
+}
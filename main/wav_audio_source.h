@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdio>
+#include "audio_source.h"
+#include "micro_model_settings.h"
+
+// Streams a 16-bit PCM WAV file recorded at kAudioSampleFrequency. For
+// multi-channel files only the first channel is used.
+class WavAudioSource : public AudioSource {
+ public:
+  // With real_time set, blocks are handed out no faster than the wall clock,
+  // like the microphone would deliver them.
+  WavAudioSource(const char* path, bool real_time);
+  ~WavAudioSource() override;
+
+  TfLiteStatus Start() override;
+  TfLiteStatus Read(int* samples_size, int16_t** samples) override;
+  bool IsRealTime() const override { return real_time_; }
+
+  // 100ms per block, the same granularity as the I2S capture.
+  static constexpr int kBlockSamples = kAudioSampleFrequency / 10;
+
+ private:
+  const char* path_;
+  bool real_time_;
+  FILE* file_ = nullptr;
+  int channels_ = 0;
+  uint32_t data_bytes_left_ = 0;
+  int64_t start_time_us_ = 0;
+  int64_t samples_delivered_ = 0;
+  int16_t block_[kBlockSamples] = {};
+};